@@ -0,0 +1,798 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_bench.c
+//  Description    : This is the main program of the CART benchmark.  It runs
+//                   a workload through the driver, a synthetic mix or a
+//                   compiled workload (cart_sim -C), on one or more threads,
+//                   and writes what it measured as JSON: throughput, latency
+//                   histograms of cart_open, cart_read, cart_write and
+//                   cart_seek and of each bus opcode (p50, p99, p999) and the
+//                   bus operations each driver call cost.
+//
+//                   The synthetic mix first fills its files (the opens are
+//                   measured, the filling writes are not), then measures
+//                   reads and writes of the files in place, at the file
+//                   position or after a seek to a random offset.  Every
+//                   byte of a file holds a letter that follows from its
+//                   offset, so each read is checked.  With -R the measured
+//                   calls go through the driver's ring, several at a time.
+//
+//   Author        : Jason Jincheng Tu
+//   Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project Includes
+#include <cart_driver.h>
+#include <cart_cache.h>
+#include <cart_network.h>
+#include <cart_workload.h>
+#include <cart_hist.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_BENCH_ARGUMENTS "hvwLzl:c:t:p:f:s:b:n:r:q:T:R:S:x:W:o:"
+#define CART_BENCH_MAX_THREADS 64
+#define CART_BENCH_MAX_FILES 1000
+#define CART_BENCH_MAX_DEPTH 1024
+#define CART_BENCH_SCHEMA "cart-bench/1"
+#define USAGE \
+	"USAGE: cart_bench [-h] [-v] [-w] [-L] [-z] [-l <logfile>] [-c <sz>] [-t <uri>] [-p <port>]\n" \
+	"                  [-f <files>] [-s <bytes>] [-b <bytes>] [-n <ops>] [-r <ratio>] [-q <ratio>]\n" \
+	"                  [-T <threads>] [-R <depth>] [-S <writes>] [-x <seed>] [-W <binfile>]\n" \
+	"                  [-o <jsonfile>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -w - buffer writes in the cache until a sync (no write-through)\n" \
+	"    -L - log-structured layout, writes go to the head of a log\n" \
+	"    -z - compress frames on the wire if the server supports it\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -c - set the cart block cache to size <sz>\n" \
+	"    -t - server transport(s), as for cart_sim\n" \
+	"    -p - port number of the server to connect to\n" \
+	"    -f - files of the synthetic mix, default 16\n" \
+	"    -s - bytes in each of them, default 262144\n" \
+	"    -b - bytes read or written at a time, default 4096\n" \
+	"    -n - measured operations (reads and writes), default 20000\n" \
+	"    -r - share of them that are reads, default 0.5\n" \
+	"    -q - share of them at the file position (sequential), default 0.5,\n" \
+	"         the others seek to a random offset first\n" \
+	"    -T - threads, each with its share of the files, default 1\n" \
+	"    -R - submit the mix through the driver's ring, <depth> calls in\n" \
+	"         flight (one thread)\n" \
+	"    -S - cart_fsync the file written after every <writes> writes of the\n" \
+	"         mix (a thread's), a failed sync fails the run\n" \
+	"    -x - random seed, default 1\n" \
+	"    -W - replay the compiled workload <binfile> instead of the mix\n" \
+	"    -o - write the results to <jsonfile>, default the standard output\n" \
+	"\n"
+
+// The driver calls measured
+typedef enum {
+	BENCH_OPEN  = 0,
+	BENCH_READ  = 1,
+	BENCH_WRITE = 2,
+	BENCH_SEEK  = 3,
+	BENCH_FSYNC = 4,
+	BENCH_CALLS = 5,
+} BenchCall;
+
+static const char *call_names[BENCH_CALLS] = { "open", "read", "write", "seek", "fsync" };
+static const char *bus_names[CART_OP_MAXVAL] = { "INITMS", "BZERO", "LDCART", "RDFRME", "WRFRME", "POWOFF" };
+
+// A benchmark thread
+typedef struct {
+	int       id;
+	pthread_t thread;
+	uint64_t  seed;
+	uint64_t  ops;         // measured calls that moved data
+	uint64_t  bytes;
+	int       result;      // 0 if it ran to the end
+} BenchThread;
+
+//
+// Global data
+int          nfiles = 16, nthreads = 1, ring_depth = 0, sync_every = 0;
+uint32_t     file_size = 262144, op_size = 4096;
+uint64_t     nops = 20000;
+double       read_ratio = 0.5, seq_ratio = 0.5;
+char        *workload = NULL;     // compiled workload, NULL for the mix
+CartHistogram calls[BENCH_CALLS]; // driver call latencies
+pthread_barrier_t filled;         // every thread filled its files
+pthread_barrier_t measuring;      // the counters were reset
+
+// The compiled workload, if there is one
+CartWorkloadHeader *wl_hdr;
+CartWorkloadOp     *wl_ops;
+char               *wl_names, *wl_payloads;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : now_ns / next_random
+// Description  : read the monotonic clock / a thread's random numbers
+//
+// Inputs       : none / state - the thread's generator
+// Outputs      : nanoseconds / 64 random bits
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return( (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec );
+}
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return( *state * 2685821657736338717ULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : timed_open / timed_seek / timed_fsync / timed_io
+// Description  : a driver call, with its latency recorded
+//
+// Inputs       : as the driver calls, write - 1 for cart_write
+// Outputs      : what the driver returned
+
+static int16_t timed_open(char *path) {
+	uint64_t started = now_ns();
+	int16_t fd = cart_open(path);
+
+	cart_hist_record(&calls[BENCH_OPEN], now_ns() - started);
+	return( fd );
+}
+
+static int32_t timed_seek(int16_t fd, uint32_t loc) {
+	uint64_t started = now_ns();
+	int32_t ret = cart_seek(fd, loc);
+
+	cart_hist_record(&calls[BENCH_SEEK], now_ns() - started);
+	return( ret );
+}
+
+static int32_t timed_fsync(int16_t fd) {
+	uint64_t started = now_ns();
+	int32_t ret = cart_fsync(fd);
+
+	cart_hist_record(&calls[BENCH_FSYNC], now_ns() - started);
+	return( ret );
+}
+
+static int32_t timed_io(int16_t fd, void *buf, int32_t count, int write) {
+	uint64_t started = now_ns();
+	int32_t ret = write ? cart_write(fd, buf, count) : cart_read(fd, buf, count);
+
+	cart_hist_record(&calls[write ? BENCH_WRITE : BENCH_READ], now_ns() - started);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_read
+// Description  : check the bytes a read of the mix returned, byte x of a
+//                file of thread t is 'a' + (x + t) % 26
+//
+// Inputs       : letters - the letters from offset 0, data - what was read
+//                off, len - where it was read
+// Outputs      : 0 if they are right, -1 if not
+
+static int check_read(char *letters, char *data, uint32_t off, uint32_t len) {
+	if (memcmp(data, &letters[off % 26], len) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: read of %u bytes at %u returned the wrong data.", len, off);
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_reap
+// Description  : reap one completion of the ring mix and check it
+//
+// Inputs       : letters - as for check_read, bufs - the read buffers
+//                sent, offs, lens, writes - the calls in flight by slot
+//                (writes holds the BenchCall)
+//                free_slots, nfree - the slots not in flight
+// Outputs      : 0 if the call went right, -1 if not
+
+static int ring_reap(char *letters, char *bufs, uint64_t *sent, uint32_t *offs, uint32_t *lens,
+		uint8_t *writes, int *free_slots, int *nfree) {
+	CartRingCqe cqe;
+	int slot;
+
+	cart_ring_reap(&cqe, 1);
+	slot = (int)cqe.user_data;
+	cart_hist_record(&calls[writes[slot]], now_ns() - sent[slot]);
+	free_slots[(*nfree)++] = slot;
+	if (cqe.result != (int32_t)lens[slot]) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: %s of %u bytes at %u failed.", call_names[writes[slot]],
+			lens[slot], offs[slot]);
+		return( -1 );
+	}
+	return( (writes[slot] != BENCH_READ) ? 0 :
+		check_read(letters, &bufs[(size_t)slot * op_size], offs[slot], lens[slot]) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : run_mix
+// Description  : the synthetic mix on the files of one thread: fill them,
+//                wait for the others, then the measured reads and writes
+//
+// Inputs       : t - the thread
+// Outputs      : 0 if successful, -1 if failure
+
+static int run_mix(BenchThread *t) {
+	int16_t fds[CART_BENCH_MAX_FILES];
+	uint32_t pos[CART_BENCH_MAX_FILES], len, off;
+	char name[CART_MAX_PATH_LENGTH], *letters = malloc(op_size + 26), *buf = malloc(op_size);
+	int mine = 0, f, write, result = 0;
+	uint64_t written = 0;
+
+	// in the ring mode, the calls in flight by slot
+	int depth = ring_depth, nfree = 0, free_slots[CART_BENCH_MAX_DEPTH];
+	char *bufs = NULL;
+	uint64_t sent[CART_BENCH_MAX_DEPTH];
+	uint32_t offs[CART_BENCH_MAX_DEPTH], lens[CART_BENCH_MAX_DEPTH];
+	uint8_t writes[CART_BENCH_MAX_DEPTH];
+	CartRingSqe sqe;
+
+	// Open and fill the files of this thread, the filling is not measured
+	for (uint32_t i = 0; i < op_size + 26; i++) {
+		letters[i] = 'a' + (t->id + i) % 26;
+	}
+	for (f = t->id; (result == 0) && (f < nfiles); f += nthreads) {
+		snprintf(name, sizeof(name), "bench%03d", f);
+		if ((fds[mine] = timed_open(name)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART bench: cannot open [%s].", name);
+			result = -1;
+			break;
+		}
+		for (off = 0; off < file_size; off += len) {
+			len = (file_size - off < op_size) ? file_size - off : op_size;
+			if (cart_write(fds[mine], &letters[off % 26], len) != len) {
+				logMessage(LOG_ERROR_LEVEL, "CART bench: cannot fill [%s].", name);
+				result = -1;
+				break;
+			}
+		}
+		pos[mine++] = 0;
+		cart_seek(fds[mine - 1], 0);
+	}
+	pthread_barrier_wait(&filled);
+	pthread_barrier_wait(&measuring);
+
+	// The measured mix through the ring, a call goes in whenever a slot is free
+	if (depth > 0) {
+		bufs = malloc((size_t)depth * op_size);
+		for (nfree = 0; nfree < depth; nfree++) {
+			free_slots[nfree] = depth - 1 - nfree;
+		}
+	}
+	for (uint64_t i = 0; (depth > 0) && (result == 0) && (mine > 0) && (i < nops); i++) {
+		int slot;
+
+		if ( (nfree == 0) && (ring_reap(letters, bufs, sent, offs, lens, writes, free_slots, &nfree) != 0) ) {
+			result = -1;
+			break;
+		}
+		slot = free_slots[--nfree];
+		f = next_random(&t->seed) % mine;
+		write = ((next_random(&t->seed) >> 11) * (1.0 / 9007199254740992.0)) >= read_ratio;
+		len = (op_size < file_size) ? op_size : file_size;
+		if ( ((next_random(&t->seed) >> 11) * (1.0 / 9007199254740992.0) < seq_ratio) &&
+				(pos[f] + len <= file_size) ) {
+			off = pos[f];
+		} else {
+			off = (pos[f] + len > file_size) ? 0 : next_random(&t->seed) % (file_size - len + 1);
+		}
+		sqe.op = write ? CART_RING_WRITE : CART_RING_READ;
+		sqe.fd = fds[f];
+		sqe.buf = write ? &letters[off % 26] : &bufs[(size_t)slot * op_size];
+		sqe.count = len;
+		sqe.offset = off;
+		sqe.user_data = slot;
+		offs[slot] = off;
+		lens[slot] = len;
+		writes[slot] = write ? BENCH_WRITE : BENCH_READ;
+		sent[slot] = now_ns();
+		if (cart_ring_submit(&sqe) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "CART bench: the ring refused a call.");
+			result = -1;
+			break;
+		}
+		pos[f] = off + len;
+		t->ops++;
+		t->bytes += len;
+
+		// the sync goes on the ring too, it covers the writes done by the time it runs
+		if ( write && sync_every && ((++written % sync_every) == 0) ) {
+			if ( (nfree == 0) && (ring_reap(letters, bufs, sent, offs, lens, writes, free_slots, &nfree) != 0) ) {
+				result = -1;
+				break;
+			}
+			slot = free_slots[--nfree];
+			sqe.op = CART_RING_FSYNC;
+			sqe.offset = -1;
+			sqe.user_data = slot;
+			offs[slot] = lens[slot] = 0;
+			writes[slot] = BENCH_FSYNC;
+			sent[slot] = now_ns();
+			if (cart_ring_submit(&sqe) != 0) {
+				logMessage(LOG_ERROR_LEVEL, "CART bench: the ring refused a call.");
+				result = -1;
+				break;
+			}
+		}
+	}
+	while ( (depth > 0) && (nfree < depth) ) {
+		if (ring_reap(letters, bufs, sent, offs, lens, writes, free_slots, &nfree) != 0) {
+			result = -1;
+		}
+	}
+
+	// The measured mix, each thread does its share of the operations
+	for (uint64_t i = t->id; (depth == 0) && (result == 0) && (mine > 0) && (i < nops); i += nthreads) {
+		f = next_random(&t->seed) % mine;
+		write = ((next_random(&t->seed) >> 11) * (1.0 / 9007199254740992.0)) >= read_ratio;
+		len = (op_size < file_size) ? op_size : file_size;
+		if ( ((next_random(&t->seed) >> 11) * (1.0 / 9007199254740992.0) < seq_ratio) &&
+				(pos[f] + len <= file_size) ) {
+			off = pos[f];
+		} else {
+			off = (pos[f] + len > file_size) ? 0 : next_random(&t->seed) % (file_size - len + 1);
+			if (timed_seek(fds[f], off) != 0) {
+				result = -1;
+				break;
+			}
+		}
+		if (timed_io(fds[f], write ? &letters[off % 26] : buf, len, write) != len) {
+			logMessage(LOG_ERROR_LEVEL, "CART bench: %s of %u bytes at %u failed.", write ? "write" : "read",
+				len, off);
+			result = -1;
+			break;
+		}
+		if ( !write && (check_read(letters, buf, off, len) != 0) ) {
+			result = -1;
+			break;
+		}
+		if ( write && sync_every && ((++written % sync_every) == 0) && (timed_fsync(fds[f]) != 0) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART bench: cart_fsync failed.");
+			result = -1;
+			break;
+		}
+		pos[f] = off + len;
+		t->ops++;
+		t->bytes += len;
+	}
+
+	free(letters);
+	free(buf);
+	free(bufs);
+	return( result );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : run_compiled
+// Description  : the operations of a compiled workload on the files of one
+//                thread (file number modulo the threads), all measured
+//
+// Inputs       : t - the thread
+// Outputs      : 0 if successful, -1 if failure
+
+static int run_compiled(BenchThread *t) {
+	int16_t fds[CART_MAX_TOTAL_FILES];
+	char *rbuf = malloc(wl_hdr->max_read + 1);
+	CartWorkloadOp *op;
+	int ok = 1;
+
+	pthread_barrier_wait(&filled);
+	pthread_barrier_wait(&measuring);
+	memset(fds, 0xff, sizeof(fds));
+	for (uint32_t i = 0; ok && (i < wl_hdr->ops); i++) {
+		op = &wl_ops[i];
+		if (op->file % nthreads != t->id) {
+			continue;
+		}
+		if ( (fds[op->file] == -1) &&
+				((fds[op->file] = timed_open(wl_names + op->file * CART_WORKLOAD_NAME)) == -1) ) {
+			ok = 0;
+			break;
+		}
+		switch (op->command) {
+		case CART_WORKLOAD_WRITEAT:
+			ok = (timed_seek(fds[op->file], op->off) == 0) &&
+				(timed_io(fds[op->file], wl_payloads + op->data, op->len, 1) == op->len);
+			break;
+		case CART_WORKLOAD_WRITE:
+			ok = (timed_io(fds[op->file], wl_payloads + op->data, op->len, 1) == op->len);
+			break;
+		case CART_WORKLOAD_SEEK:
+			ok = (timed_seek(fds[op->file], op->off) == op->len);
+			break;
+		default:
+			ok = (timed_io(fds[op->file], rbuf, op->len, 0) == op->len);
+			break;
+		}
+		if (op->command != CART_WORKLOAD_SEEK) {
+			t->ops++;
+			t->bytes += op->len;
+		}
+	}
+	if ( !ok ) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: a workload operation failed.");
+	}
+
+	free(rbuf);
+	return( ok ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_thread
+// Description  : a benchmark thread
+//
+// Inputs       : arg - the BenchThread
+// Outputs      : NULL
+
+static void *bench_thread(void *arg) {
+	BenchThread *t = arg;
+
+	t->result = (workload != NULL) ? run_compiled(t) : run_mix(t);
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : map_workload
+// Description  : map a compiled workload and check it
+//
+// Inputs       : path - the file
+// Outputs      : 0 if successful, -1 if failure
+
+static int map_workload(const char *path) {
+	struct stat st;
+	uint64_t need = sizeof(CartWorkloadHeader);
+	char *map;
+	int fh;
+
+	if ( ((fh = open(path, O_RDONLY)) == -1) || (fstat(fh, &st) == -1) ||
+			((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fh, 0)) == MAP_FAILED) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: cannot map [%s] : [%s]", path, strerror(errno));
+		return( -1 );
+	}
+	close(fh);
+	wl_hdr = (CartWorkloadHeader *)map;
+	if ((uint64_t)st.st_size >= need) {
+		need += (uint64_t)wl_hdr->files * CART_WORKLOAD_NAME + (uint64_t)wl_hdr->ops * sizeof(CartWorkloadOp) +
+			wl_hdr->payload_size;
+	}
+	if ( (need != (uint64_t)st.st_size) || memcmp(wl_hdr->magic, CART_WORKLOAD_MAGIC, sizeof(wl_hdr->magic)) ||
+			(wl_hdr->op_size != sizeof(CartWorkloadOp)) || (wl_hdr->files > CART_MAX_TOTAL_FILES) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: [%s] is not a compiled workload.", path);
+		return( -1 );
+	}
+	wl_names = map + sizeof(CartWorkloadHeader);
+	wl_ops = (CartWorkloadOp *)(wl_names + wl_hdr->files * CART_WORKLOAD_NAME);
+	wl_payloads = (char *)(wl_ops + wl_hdr->ops);
+	for (uint32_t i = 0; i < wl_hdr->ops; i++) {
+		if ( (wl_ops[i].file >= wl_hdr->files) || (wl_ops[i].command > CART_WORKLOAD_READ) ||
+				((wl_ops[i].command <= CART_WORKLOAD_WRITEAT) &&
+				((uint64_t)wl_ops[i].data + wl_ops[i].len > wl_hdr->payload_size)) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART bench: [%s] has a bad operation %u.", path, i);
+			return( -1 );
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : json_histogram
+// Description  : write a histogram as a JSON object, in microseconds
+//
+// Inputs       : out - the file, name - its key, h - the histogram
+//                last - no comma after it
+// Outputs      : none
+
+static void json_histogram(FILE *out, const char *name, CartHistogram *h, int last) {
+	fprintf(out, "    \"%s\": { \"count\": %lu, \"mean_us\": %.3f, \"min_us\": %.3f, \"p50_us\": %.3f, "
+		"\"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f }%s\n", name, (unsigned long)h->count,
+		cart_hist_mean(h) / 1e3, cart_hist_min(h) / 1e3, cart_hist_percentile(h, 50) / 1e3,
+		cart_hist_percentile(h, 99) / 1e3, cart_hist_percentile(h, 99.9) / 1e3, h->max / 1e3, last ? "" : ",");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, buffered = 0, log_layout = 0, failed = 0;
+	uint32_t cache_size = 0;
+	uint64_t seed = 1, bus_before[CART_OP_MAXVAL], bus_ops = 0, ops = 0, bytes = 0, started, filling, elapsed;
+	char *json = NULL;
+	BenchThread threads[CART_BENCH_MAX_THREADS];
+	FILE *out = stdout;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_BENCH_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'w': // Buffered writes flag
+			buffered = 1;
+			break;
+
+		case 'L': // Log-structured layout flag
+			log_layout = 1;
+			break;
+
+		case 'z': // Wire compression flag
+			cart_network_compress = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'c': // Cache size
+			if (sscanf(optarg, "%u", &cache_size) != 1) {
+				fprintf( stderr, "Bad cache size [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 't': // Transport
+			cart_network_uri = strdup(optarg);
+			break;
+
+		case 'p': // Port
+			if (sscanf(optarg, "%hu", &cart_network_port) != 1) {
+				fprintf( stderr, "Bad port number [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'f': // Files
+			if ( (sscanf(optarg, "%d", &nfiles) != 1) || (nfiles < 1) || (nfiles > CART_BENCH_MAX_FILES) ) {
+				fprintf( stderr, "Bad file count [%s], 1 to %d\n", optarg, CART_BENCH_MAX_FILES );
+				return( -1 );
+			}
+			break;
+
+		case 's': // Sizes
+		case 'b':
+			if ( (sscanf(optarg, "%u", (ch == 's') ? &file_size : &op_size) != 1) ||
+					(((ch == 's') ? file_size : op_size) == 0) ) {
+				fprintf( stderr, "Bad size [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'n': // Operations
+			if (sscanf(optarg, "%lu", (unsigned long *)&nops) != 1) {
+				fprintf( stderr, "Bad operation count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'r': // The mix
+		case 'q': {
+			double x;
+			if ( (sscanf(optarg, "%lf", &x) != 1) || (x < 0) || (x > 1) ) {
+				fprintf( stderr, "Bad ratio [%s]\n", optarg );
+				return( -1 );
+			}
+			*((ch == 'r') ? &read_ratio : &seq_ratio) = x;
+			break;
+		}
+
+		case 'T': // Threads
+			if ( (sscanf(optarg, "%d", &nthreads) != 1) || (nthreads < 1) || (nthreads > CART_BENCH_MAX_THREADS) ) {
+				fprintf( stderr, "Bad thread count [%s], 1 to %d\n", optarg, CART_BENCH_MAX_THREADS );
+				return( -1 );
+			}
+			break;
+
+		case 'R': // Ring depth
+			if ( (sscanf(optarg, "%d", &ring_depth) != 1) || (ring_depth < 1) || (ring_depth > CART_BENCH_MAX_DEPTH) ) {
+				fprintf( stderr, "Bad ring depth [%s], 1 to %d\n", optarg, CART_BENCH_MAX_DEPTH );
+				return( -1 );
+			}
+			break;
+
+		case 'S': // Sync every so many writes
+			if ( (sscanf(optarg, "%d", &sync_every) != 1) || (sync_every < 1) ) {
+				fprintf( stderr, "Bad sync interval [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'x': // Seed
+			if ( (sscanf(optarg, "%lu", (unsigned long *)&seed) != 1) || (seed == 0) ) {
+				fprintf( stderr, "Bad seed [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'W': // Compiled workload
+			workload = strdup(optarg);
+			break;
+
+		case 'o': // JSON file
+			json = optarg;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+	if ( (workload != NULL) && (map_workload(workload) == -1) ) {
+		return( -1 );
+	}
+	if ( (ring_depth > 0) && ((workload != NULL) || (nthreads != 1)) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: the ring mode runs the mix on one thread.");
+		return( -1 );
+	}
+	if ( (json != NULL) && ((out = fopen(json, "w")) == NULL) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: cannot create [%s] : [%s]", json, strerror(errno));
+		return( -1 );
+	}
+
+	// Start the driver the way cart_sim does
+	if (cache_size != 0) {
+		set_cart_cache_size(cache_size);
+	}
+	if (cart_poweron() == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: driver failed initialization.");
+		return( -1 );
+	}
+	if (buffered) {
+		cart_set_write_through(0);
+	}
+	if (log_layout) {
+		cart_set_log_structured(1);
+	}
+	if ( (ring_depth > 0) && (cart_ring_init(ring_depth) == -1) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: cannot start the ring.");
+		return( -1 );
+	}
+
+	// Start the threads, wait for the files to be filled
+	pthread_barrier_init(&filled, NULL, nthreads + 1);
+	pthread_barrier_init(&measuring, NULL, nthreads + 1);
+	started = now_ns();
+	for (int i = 0; i < nthreads; i++) {
+		memset(&threads[i], 0, sizeof(BenchThread));
+		threads[i].id = i;
+		threads[i].seed = seed * 0x9e3779b97f4a7c15ULL + i + 1;
+		if (pthread_create(&threads[i].thread, NULL, bench_thread, &threads[i]) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "CART bench: cannot start a thread.");
+			return( -1 );
+		}
+	}
+	pthread_barrier_wait(&filled);
+	filling = now_ns() - started;
+
+	// Measure from here, the bus counters start over
+	for (int op = 0; op < CART_OP_MAXVAL; op++) {
+		cart_hist_reset(&cart_bus_latency[op]);
+		bus_before[op] = cart_bus_ops[op];
+	}
+	cart_hist_reset(&calls[BENCH_READ]);
+	cart_hist_reset(&calls[BENCH_WRITE]);
+	cart_hist_reset(&calls[BENCH_SEEK]);
+	cart_hist_reset(&calls[BENCH_FSYNC]);
+	started = now_ns();
+	pthread_barrier_wait(&measuring);
+	for (int i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		ops += threads[i].ops;
+		bytes += threads[i].bytes;
+		failed |= (threads[i].result != 0);
+	}
+	elapsed = now_ns() - started;
+	for (int op = 0; op < CART_OP_MAXVAL; op++) {
+		bus_before[op] = cart_bus_ops[op] - bus_before[op];
+		bus_ops += bus_before[op];
+	}
+
+	// The results, always the same keys in the same order
+	fprintf(out, "{\n");
+	fprintf(out, "  \"schema\": \"%s\",\n", CART_BENCH_SCHEMA);
+	fprintf(out, "  \"config\": { \"workload\": \"");
+	for (char *c = (workload != NULL) ? workload : "mix"; *c; c++) {
+		fprintf(out, ((*c == '"') || (*c == '\\')) ? "\\%c" : "%c", *c);
+	}
+	fprintf(out, "\", \"files\": %d, ", (workload != NULL) ? (int)wl_hdr->files : nfiles);
+	if (workload != NULL) {
+		//the mix settings mean nothing to a compiled workload
+		fprintf(out, "\"file_size\": null, \"op_size\": null, \"ops\": %u, \"read_ratio\": null, "
+			"\"sequential_ratio\": null, \"threads\": %d, \"seed\": null, ", wl_hdr->ops, nthreads);
+	} else {
+		fprintf(out, "\"file_size\": %u, \"op_size\": %u, \"ops\": %lu, \"read_ratio\": %.3f, "
+			"\"sequential_ratio\": %.3f, \"threads\": %d, \"seed\": %lu, ", file_size, op_size,
+			(unsigned long)nops, read_ratio, seq_ratio, nthreads, (unsigned long)seed);
+	}
+	fprintf(out, "\"cache_frames\": %u, \"write_through\": %s, \"log_structured\": %s, \"compress\": %s, "
+		"\"servers\": %d, \"ring_depth\": %d, \"sync_every\": %d },\n", get_cart_cache_size(),
+		buffered ? "false" : "true", log_layout ? "true" : "false", cart_network_compress ? "true" : "false",
+		cart_bus_servers, ring_depth, sync_every);
+	fprintf(out, "  \"ok\": %s,\n", failed ? "false" : "true");
+	fprintf(out, "  \"fill_s\": %.6f,\n", filling / 1e9);
+	fprintf(out, "  \"elapsed_s\": %.6f,\n", elapsed / 1e9);
+	fprintf(out, "  \"operations\": %lu,\n", (unsigned long)ops);
+	fprintf(out, "  \"bytes\": %lu,\n", (unsigned long)bytes);
+	fprintf(out, "  \"throughput_ops_s\": %.3f,\n", ops / (elapsed / 1e9));
+	fprintf(out, "  \"throughput_mb_s\": %.3f,\n", bytes / (elapsed / 1e3));
+	fprintf(out, "  \"bus_ops\": %lu,\n", (unsigned long)bus_ops);
+	fprintf(out, "  \"bus_ops_per_operation\": %.4f,\n", ops ? (double)bus_ops / ops : 0.0);
+	fprintf(out, "  \"driver\": {\n");
+	for (int c = 0; c < BENCH_CALLS; c++) {
+		json_histogram(out, call_names[c], &calls[c], c == BENCH_CALLS - 1);
+	}
+	fprintf(out, "  },\n");
+	fprintf(out, "  \"bus\": {\n");
+	for (int op = 0; op < CART_OP_MAXVAL; op++) {
+		json_histogram(out, bus_names[op], &cart_bus_latency[op], op == CART_OP_MAXVAL - 1);
+	}
+	fprintf(out, "  }\n");
+	fprintf(out, "}\n");
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	// Shut down
+	if (ring_depth > 0) {
+		cart_ring_exit();
+	}
+	if (cart_poweroff() == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART bench: driver failed shutdown.");
+		return( -1 );
+	}
+	return( failed ? -1 : 0 );
+}
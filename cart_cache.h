@@ -13,15 +13,19 @@
 
 // Includes
 #include <cart_controller.h>
+#include <cart_network.h>
 
 // Defines
 #define DEFAULT_CART_FRAME_CACHE_SIZE 1024  // Default size for cache
+#define DEFAULT_CART_SHARED_CACHE_FRAMES 4096  // Default size of a shared segment
 // struct defined for link list for cache
 typedef struct node{
 	struct node * previous;
 	struct node * next;
 	uint16_t cart;
 	uint16_t frm;
+	uint8_t dirty;		// frame changed in cache but not yet written to the bus
+	uint32_t version;	// of its set in the shared segment when it was read
 	char buffer[DEFAULT_CART_FRAME_CACHE_SIZE];
 } node;
 
@@ -32,16 +36,43 @@ typedef struct map{
 	uint16_t frm;
 } map;
 
-int16_t current_Cartridge;	// record the current cartridge number so cartridge will not reload
+int16_t current_Cartridge[CART_MAX_SERVERS];	// record the cartridge loaded on each server so it will not reload
 
 // Cache Interfaces
 
 uint64_t make_cart(uint8_t KY1, uint8_t KY2, uint16_t CT1, uint16_t FT1);
 	//make cart function shared by both cache and driver
 
+void reads(uint16_t cart, uint16_t frm, char *buf);
+	// Read a frame from the bus, loading the cartridge if needed
+
+void writes(uint16_t cart, uint16_t frm, char *buf);
+	// Write a frame to the bus, loading the cartridge if needed
+
+void writes_pipelined(uint16_t cart, uint16_t frm, char *buf);
+	// Queue a frame write on the bus without waiting for the answer
+
+void writes_batch(uint16_t cart, uint16_t frm, uint16_t n, char *buf);
+	// Queue a write of n frames in a row on a cartridge as one request
+
+void writes_partial(uint16_t cart, uint16_t frm, uint16_t off, uint16_t len, char *buf);
+	// Queue a write of len bytes at off in a frame
+
+int flush_bus(void);
+	// Wait for every queued bus request, returns the number that failed
+
 int set_cart_cache_size(uint32_t max_frames);
 	// Set the size of the cache (must be called before init)
 
+uint32_t get_cart_cache_size(void);
+	// Get the maximum number of frames the cache holds
+
+int set_cart_cache_shared(const char *name, uint32_t frames);
+	// Share frames with other processes through a shared memory segment (before init)
+
+int set_cart_cache_trace(const char *path);
+	// Record the frames the cache is asked about for cart_cachesim (before init)
+
 int init_cart_cache(void);
 	// Initialize the cache 
 
@@ -54,6 +85,30 @@ int put_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *frame);
 void * get_cart_cache(CartridgeIndex dsk, CartFrameIndex blk);
 	// Get an object from the cache (and return it)
 
+int dirty_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *frame);
+	// Put a frame into the cache and hold it back from the bus until it is flushed
+
+int flush_cart_cache(CartridgeIndex cart, CartFrameIndex frm);
+	// Write a cached frame back to the bus if it is dirty
+
+int patch_cart_cache(CartridgeIndex cart, CartFrameIndex frm, uint16_t off, uint16_t len, void *buf);
+	// Change part of a cached frame, returns 1 if it was cached
+
+uint32_t flush_list_cart_cache(CartridgeIndex *carts, CartFrameIndex *frms, uint32_t n);
+	// Write back the dirty frames of a list, runs batched when possible
+
+int read_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf);
+	// Copy a frame out of the cache, reading it from the bus on a miss
+
+int drop_cart_cache(CartridgeIndex cart, CartFrameIndex frm);
+	// Forget a cached frame without writing it back
+
+uint32_t dirty_list_cart_cache(CartridgeIndex *carts, CartFrameIndex *frms, uint32_t max);
+	// List up to max dirty frames in the cache, returns the number listed
+
+uint32_t prefetch_cart_cache(CartridgeIndex *carts, CartFrameIndex *frms, uint32_t n);
+	// Read the frames not yet cached in one pipelined batch
+
 //
 // Unit test
 
@@ -0,0 +1,724 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_cachesim.c
+//  Description    : This is the main program of the CART frame cache
+//                   simulator.  It runs an access trace recorded by the
+//                   cache (cart_sim -A) against cache configurations, every
+//                   replacement policy and size asked for, in memory and in
+//                   parallel, and prints what each would have cost: hit
+//                   ratio, bus reads and writes, cartridge loads and a
+//                   modeled time from per-operation costs.
+//
+//                   The model follows cart_cache.c: a get reads the frame
+//                   on a miss, put and patch were written through, dirty
+//                   frames go to the bus when flushed or evicted, prefetch
+//                   reads what is missing without touching the rest.  A
+//                   cartridge load is counted whenever a bus operation goes
+//                   to a cartridge its server does not have loaded.
+//
+//   Author        : Jason Jincheng Tu
+//   Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Project Includes
+#include <cart_network.h>
+#include <cart_controller.h>
+#include <cart_trace.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_CACHESIM_ARGUMENTS "hvl:p:s:j:r:w:L:H:"
+#define CART_CACHESIM_MAX_CONFIGS 256
+#define CART_CACHESIM_SIZES "64,128,256,512,1024,2048,4096"
+#define CART_CACHESIM_KEYS (CART_BUS_MAX_CARTRIDGES * CART_CARTRIDGE_SIZE)
+#define CART_CACHESIM_NEVER UINT32_MAX // Next use of a frame not used again
+#define USAGE \
+	"USAGE: cart_cachesim [-h] [-v] [-l <logfile>] [-p <policy>[,<policy>...]] [-s <frames>[,<frames>...]]\n" \
+	"                     [-j <threads>] [-r <us>] [-w <us>] [-L <us>] [-H <us>] <tracefile>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - replacement policies: lru (the driver's), fifo, clock, random, opt\n" \
+	"         (Belady, the bound), default all of them\n" \
+	"    -s - cache sizes in frames, default " CART_CACHESIM_SIZES "\n" \
+	"    -j - configurations run at once, default one per processor\n" \
+	"    -r - modeled cost of a frame read, default 35 us\n" \
+	"    -w - modeled cost of a frame write, default 35 us\n" \
+	"    -L - modeled cost of a cartridge load, default 10000 us\n" \
+	"    -H - modeled cost of a cache hit, default 0.2 us\n" \
+	"\n" \
+	"    <tracefile> - frame cache accesses recorded with cart_sim -A\n" \
+	"\n"
+
+// The replacement policies
+typedef enum {
+	SIM_LRU    = 0,  // least recently used, what cart_cache.c does
+	SIM_FIFO   = 1,  // oldest in
+	SIM_CLOCK  = 2,  // second chance
+	SIM_RANDOM = 3,  // any frame
+	SIM_OPT    = 4,  // the frame used again last (needs the future)
+	SIM_POLICIES = 5,
+} SimPolicy;
+
+static const char *policy_names[SIM_POLICIES] = { "lru", "fifo", "clock", "random", "opt" };
+
+// A cache configuration and what it cost
+typedef struct {
+	SimPolicy policy;
+	uint32_t frames;
+
+	uint64_t gets, hits;       // of get accesses
+	uint64_t reads, writes;    // bus frame operations
+	uint64_t writebacks;       // of which dirty frames evicted
+	uint64_t prefetched;       // frames read by prefetch
+	uint64_t loads;            // cartridge loads
+	double modeled;            // seconds
+} SimConfig;
+
+// The state of one simulated cache
+typedef struct {
+	SimConfig *cfg;
+	uint32_t used;
+	int32_t *slot_of;          // key -> slot, -1 if not cached
+	uint32_t *key_of;          // slot -> key
+	uint8_t *dirty, *ref;
+	int32_t *prev, *next;      // LRU/FIFO list, head is the newest
+	int32_t head, tail;
+	uint32_t hand;             // clock hand
+	uint32_t *next_use;        // opt: slot -> access that uses it next
+	uint64_t *heap;            // opt: next use << 32 | slot, largest on top
+	uint64_t heap_len, heap_cap;
+	uint32_t rand_state;
+	int32_t loaded[CART_MAX_SERVERS];
+} SimCache;
+
+//
+// Global data
+CartAccessRecord *accesses = NULL;  // the trace
+uint64_t          access_count;
+uint32_t          trace_servers = 1;
+uint32_t         *next_access = NULL; // access -> the next access of its frame
+double            cost_read = 35e-6, cost_write = 35e-6, cost_load = 10e-3, cost_hit = 0.2e-6;
+SimConfig         configs[CART_CACHESIM_MAX_CONFIGS];
+int               config_count = 0;
+int               next_config = 0;    // the next configuration a worker takes
+pthread_mutex_t   config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : now_ns
+// Description  : read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : nanoseconds
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return( (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : load_accesses
+// Description  : read an access trace into memory
+//
+// Inputs       : path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+static int load_accesses(const char *path) {
+	CartTraceHeader hdr;
+	FILE *f = fopen(path, "rb");
+	long size;
+
+	if (f == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CART cachesim: cannot open [%s] : [%s]", path, strerror(errno));
+		return( -1 );
+	}
+	if ( (fread(&hdr, sizeof(hdr), 1, f) != 1) || memcmp(hdr.magic, CART_ACCESS_MAGIC, sizeof(hdr.magic)) ||
+			(hdr.record_size != sizeof(CartAccessRecord)) || (hdr.servers == 0) ||
+			(hdr.servers > CART_MAX_SERVERS) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART cachesim: [%s] is not a cache access trace", path);
+		fclose(f);
+		return( -1 );
+	}
+	trace_servers = hdr.servers;
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f) - sizeof(hdr);
+	fseek(f, sizeof(hdr), SEEK_SET);
+	access_count = size / sizeof(CartAccessRecord);
+	accesses = malloc((access_count + 1) * sizeof(CartAccessRecord));
+	if ( (accesses == NULL) || (fread(accesses, sizeof(CartAccessRecord), access_count, f) != access_count) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART cachesim: cannot read [%s]", path);
+		fclose(f);
+		return( -1 );
+	}
+	fclose(f);
+
+	for (uint64_t i = 0; i < access_count; i++) {
+		if ( (accesses[i].op >= CART_ACCESS_MAXVAL) ||
+				((uint32_t)accesses[i].cart * CART_CARTRIDGE_SIZE + accesses[i].frm >= CART_CACHESIM_KEYS) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART cachesim: bad access %lu in [%s]", (unsigned long)i, path);
+			return( -1 );
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : key_of_access
+// Description  : the frame of an access as one number
+//
+// Inputs       : a - the access
+// Outputs      : the key
+
+static uint32_t key_of_access(CartAccessRecord *a) {
+	return( (uint32_t)a->cart * CART_CARTRIDGE_SIZE + a->frm );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : plan_next_uses
+// Description  : for every access, find the next access of the same frame,
+//                what the opt policy looks ahead at
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int plan_next_uses(void) {
+	uint32_t *last = malloc(CART_CACHESIM_KEYS * sizeof(uint32_t));
+
+	next_access = malloc((access_count + 1) * sizeof(uint32_t));
+	if ( (last == NULL) || (next_access == NULL) || (access_count >= CART_CACHESIM_NEVER) ) {
+		free(last);
+		return( -1 );
+	}
+	for (uint32_t k = 0; k < CART_CACHESIM_KEYS; k++) {
+		last[k] = CART_CACHESIM_NEVER;
+	}
+	for (uint64_t i = access_count; i-- > 0; ) {
+		uint32_t key = key_of_access(&accesses[i]);
+		next_access[i] = last[key];
+		last[key] = i;
+	}
+	free(last);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bus_op
+// Description  : count a frame going over the bus, and the cartridge load
+//                it needs if its server has another cartridge loaded
+//
+// Inputs       : c - the cache, key - the frame, write - 1 for a write
+// Outputs      : none
+
+static void bus_op(SimCache *c, uint32_t key, int write) {
+	int32_t cart = key / CART_CARTRIDGE_SIZE;
+	int32_t *loaded = &c->loaded[cart % trace_servers];
+
+	if (*loaded != cart) {
+		*loaded = cart;
+		c->cfg->loads++;
+	}
+	if (write) {
+		c->cfg->writes++;
+	} else {
+		c->cfg->reads++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : heap_push
+// Description  : opt: remember when a slot is used next
+//
+// Inputs       : c - the cache, slot - the slot, use - its next use
+// Outputs      : none
+
+static void heap_push(SimCache *c, int32_t slot, uint32_t use) {
+	uint64_t item = (uint64_t)use << 32 | (uint32_t)slot, i;
+
+	if (c->heap_len == c->heap_cap) {
+		c->heap_cap = c->heap_cap ? c->heap_cap * 2 : 1024;
+		c->heap = realloc(c->heap, c->heap_cap * sizeof(uint64_t));
+	}
+	for (i = c->heap_len++; (i > 0) && (c->heap[(i - 1) / 2] < item); i = (i - 1) / 2) {
+		c->heap[i] = c->heap[(i - 1) / 2];
+	}
+	c->heap[i] = item;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : heap_pop
+// Description  : opt: take the entry used furthest ahead off the heap
+//
+// Inputs       : c - the cache
+// Outputs      : the entry
+
+static uint64_t heap_pop(SimCache *c) {
+	uint64_t top = c->heap[0], last = c->heap[--c->heap_len], i = 0, child;
+
+	while ((child = 2 * i + 1) < c->heap_len) {
+		if ( (child + 1 < c->heap_len) && (c->heap[child + 1] > c->heap[child]) ) {
+			child++;
+		}
+		if (c->heap[child] <= last) {
+			break;
+		}
+		c->heap[i] = c->heap[child];
+		i = child;
+	}
+	c->heap[i] = last;
+	return( top );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : list_unlink / list_push
+// Description  : take a slot off the LRU/FIFO list, put it at the head
+//
+// Inputs       : c - the cache, slot - the slot
+// Outputs      : none
+
+static void list_unlink(SimCache *c, int32_t slot) {
+	if (c->prev[slot] != -1) {
+		c->next[c->prev[slot]] = c->next[slot];
+	} else {
+		c->head = c->next[slot];
+	}
+	if (c->next[slot] != -1) {
+		c->prev[c->next[slot]] = c->prev[slot];
+	} else {
+		c->tail = c->prev[slot];
+	}
+}
+
+static void list_push(SimCache *c, int32_t slot) {
+	c->prev[slot] = -1;
+	c->next[slot] = c->head;
+	if (c->head != -1) {
+		c->prev[c->head] = slot;
+	}
+	c->head = slot;
+	if (c->tail == -1) {
+		c->tail = slot;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : touch
+// Description  : a cached frame was used
+//
+// Inputs       : c - the cache, slot - its slot, i - the access
+// Outputs      : none
+
+static void touch(SimCache *c, int32_t slot, uint64_t i) {
+	switch (c->cfg->policy) {
+	case SIM_LRU:
+		list_unlink(c, slot);
+		list_push(c, slot);
+		break;
+	case SIM_CLOCK:
+		c->ref[slot] = 1;
+		break;
+	case SIM_OPT:
+		c->next_use[slot] = next_access[i];
+		heap_push(c, slot, next_access[i]);
+		break;
+	default:
+		break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : remove_slot
+// Description  : take a frame out of the cache
+//
+// Inputs       : c - the cache, slot - its slot
+// Outputs      : none
+
+static void remove_slot(SimCache *c, int32_t slot) {
+	c->slot_of[c->key_of[slot]] = -1;
+	c->key_of[slot] = CART_CACHESIM_NEVER;
+	if ( (c->cfg->policy == SIM_LRU) || (c->cfg->policy == SIM_FIFO) ) {
+		list_unlink(c, slot);
+	}
+	c->used--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : victim
+// Description  : pick the frame to evict from a full cache
+//
+// Inputs       : c - the cache
+// Outputs      : its slot
+
+static int32_t victim(SimCache *c) {
+	uint64_t item;
+	int32_t slot;
+
+	switch (c->cfg->policy) {
+	case SIM_CLOCK:
+		while (c->ref[c->hand]) {
+			c->ref[c->hand] = 0;
+			c->hand = (c->hand + 1) % c->cfg->frames;
+		}
+		slot = c->hand;
+		c->hand = (c->hand + 1) % c->cfg->frames;
+		return( slot );
+	case SIM_RANDOM:
+		c->rand_state = c->rand_state * 1103515245U + 12345U;
+		return( (c->rand_state >> 8) % c->cfg->frames );
+	case SIM_OPT:
+		//entries left behind by later uses are skipped
+		do {
+			item = heap_pop(c);
+			slot = (int32_t)(item & 0xffffffff);
+		} while ( (c->key_of[slot] == CART_CACHESIM_NEVER) || (c->next_use[slot] != (item >> 32)) );
+		return( slot );
+	default:
+		return( c->tail );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : insert
+// Description  : put a frame in the cache, evicting (and writing back) one
+//                if it is full
+//
+// Inputs       : c - the cache, key - the frame, i - the access
+//                dirty - whether the bus has yet to see it
+// Outputs      : none
+
+static void insert(SimCache *c, uint32_t key, uint64_t i, uint8_t dirty) {
+	int32_t slot;
+
+	if (c->used == c->cfg->frames) {
+		slot = victim(c);
+		if (c->dirty[slot]) {
+			bus_op(c, c->key_of[slot], 1);
+			c->cfg->writebacks++;
+		}
+		remove_slot(c, slot);
+	} else {
+		//the slots fill up in order, eviction reuses the one it freed
+		for (slot = c->used; c->key_of[slot] != CART_CACHESIM_NEVER; slot = (slot + 1) % c->cfg->frames);
+	}
+
+	c->slot_of[key] = slot;
+	c->key_of[slot] = key;
+	c->dirty[slot] = dirty;
+	c->ref[slot] = 0;
+	c->used++;
+	if ( (c->cfg->policy == SIM_LRU) || (c->cfg->policy == SIM_FIFO) ) {
+		list_push(c, slot);
+	} else if (c->cfg->policy == SIM_OPT) {
+		c->next_use[slot] = next_access[i];
+		heap_push(c, slot, next_access[i]);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulate
+// Description  : run the whole trace against one configuration
+//
+// Inputs       : cfg - the configuration, filled with the results
+// Outputs      : 0 if successful, -1 if failure
+
+static int simulate(SimConfig *cfg) {
+	SimCache c;
+	uint32_t n = cfg->frames;
+
+	memset(&c, 0, sizeof(c));
+	c.cfg = cfg;
+	c.slot_of = malloc(CART_CACHESIM_KEYS * sizeof(int32_t));
+	c.key_of = malloc(n * sizeof(uint32_t));
+	c.dirty = calloc(n, 1);
+	c.ref = calloc(n, 1);
+	c.prev = malloc(n * sizeof(int32_t));
+	c.next = malloc(n * sizeof(int32_t));
+	c.next_use = malloc(n * sizeof(uint32_t));
+	if ( !c.slot_of || !c.key_of || !c.dirty || !c.ref || !c.prev || !c.next || !c.next_use ) {
+		return( -1 );
+	}
+	memset(c.slot_of, 0xff, CART_CACHESIM_KEYS * sizeof(int32_t));
+	memset(c.key_of, 0xff, n * sizeof(uint32_t));
+	c.head = c.tail = -1;
+	c.rand_state = 0x43415254;
+
+	//power on leaves the last cartridge of every server loaded
+	for (uint32_t s = 0; s < trace_servers; s++) {
+		c.loaded[s] = (CART_MAX_CARTRIDGES - 1) * trace_servers + s;
+	}
+
+	for (uint64_t i = 0; i < access_count; i++) {
+		uint32_t key = key_of_access(&accesses[i]);
+		int32_t slot = c.slot_of[key];
+
+		switch (accesses[i].op) {
+		case CART_ACCESS_GET:
+			cfg->gets++;
+			if (slot != -1) {
+				cfg->hits++;
+				touch(&c, slot, i);
+			} else {
+				bus_op(&c, key, 0);
+				insert(&c, key, i, 0);
+			}
+			break;
+
+		case CART_ACCESS_PUT:
+			bus_op(&c, key, 1);
+			if (slot != -1) {
+				touch(&c, slot, i);
+				c.dirty[slot] = 0;
+			} else {
+				insert(&c, key, i, 0);
+			}
+			break;
+
+		case CART_ACCESS_DIRTY:
+			if (slot != -1) {
+				touch(&c, slot, i);
+				c.dirty[slot] = 1;
+			} else {
+				insert(&c, key, i, 1);
+			}
+			break;
+
+		case CART_ACCESS_PATCH:
+			bus_op(&c, key, 1);
+			if (slot != -1) {
+				touch(&c, slot, i);
+			}
+			break;
+
+		case CART_ACCESS_DROP:
+			if (slot != -1) {
+				remove_slot(&c, slot);
+			}
+			break;
+
+		case CART_ACCESS_FLUSH:
+			if ( (slot != -1) && c.dirty[slot] ) {
+				bus_op(&c, key, 1);
+				c.dirty[slot] = 0;
+			}
+			break;
+
+		case CART_ACCESS_PREFETCH:
+			if (slot == -1) {
+				bus_op(&c, key, 0);
+				cfg->prefetched++;
+				insert(&c, key, i, 0);
+			}
+			break;
+		}
+	}
+
+	cfg->modeled = cfg->reads * cost_read + cfg->writes * cost_write + cfg->loads * cost_load +
+		cfg->hits * cost_hit;
+
+	free(c.slot_of);
+	free(c.key_of);
+	free(c.dirty);
+	free(c.ref);
+	free(c.prev);
+	free(c.next);
+	free(c.next_use);
+	free(c.heap);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : worker
+// Description  : a thread taking configurations until none are left
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void *worker(void *arg) {
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&config_lock);
+		i = next_config++;
+		pthread_mutex_unlock(&config_lock);
+		if (i >= config_count) {
+			break;
+		}
+		if (simulate(&configs[i]) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART cachesim: out of memory for %s/%u.",
+				policy_names[configs[i].policy], configs[i].frames);
+		}
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART cache simulator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, threads = sysconf(_SC_NPROCESSORS_ONLN);
+	char *policies = NULL, *sizes = CART_CACHESIM_SIZES, *list, *item, *save;
+	int use_policy[SIM_POLICIES] = { 1, 1, 1, 1, 1 };
+	pthread_t *workers;
+	uint64_t start;
+	uint32_t frames;
+	int p;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_CACHESIM_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Policies
+			policies = optarg;
+			break;
+
+		case 's': // Sizes
+			sizes = optarg;
+			break;
+
+		case 'j': // Threads
+			if ( (sscanf(optarg, "%d", &threads) != 1) || (threads < 1) ) {
+				fprintf( stderr, "Bad thread count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'r': // Costs, in microseconds
+		case 'w':
+		case 'L':
+		case 'H': {
+			double us;
+			if ( (sscanf(optarg, "%lf", &us) != 1) || (us < 0) ) {
+				fprintf( stderr, "Bad cost [%s]\n", optarg );
+				return( -1 );
+			}
+			*((ch == 'r') ? &cost_read : (ch == 'w') ? &cost_write : (ch == 'L') ? &cost_load : &cost_hit) = us / 1e6;
+			break;
+		}
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+	if (optind != argc - 1) {
+		fprintf( stderr, USAGE );
+		return( -1 );
+	}
+
+	// The configurations: every policy at every size
+	if (policies != NULL) {
+		memset(use_policy, 0, sizeof(use_policy));
+		list = strdup(policies);
+		for (item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+			for (p = 0; (p < SIM_POLICIES) && strcmp(item, policy_names[p]); p++);
+			if (p == SIM_POLICIES) {
+				fprintf( stderr, "Unknown policy [%s]\n", item );
+				return( -1 );
+			}
+			use_policy[p] = 1;
+		}
+		free(list);
+	}
+	for (p = 0; p < SIM_POLICIES; p++) {
+		list = strdup(sizes);
+		for (item = strtok_r(list, ",", &save); use_policy[p] && (item != NULL); item = strtok_r(NULL, ",", &save)) {
+			if ( (sscanf(item, "%u", &frames) != 1) || (frames == 0) || (config_count == CART_CACHESIM_MAX_CONFIGS) ) {
+				fprintf( stderr, "Bad cache size [%s] (at most %d configurations)\n", item, CART_CACHESIM_MAX_CONFIGS );
+				return( -1 );
+			}
+			configs[config_count].policy = p;
+			configs[config_count].frames = frames;
+			config_count++;
+		}
+		free(list);
+	}
+
+	if ( (load_accesses(argv[optind]) == -1) || (use_policy[SIM_OPT] && (plan_next_uses() == -1)) ) {
+		return( -1 );
+	}
+
+	// Every configuration reads the same trace, each thread takes the next one
+	start = now_ns();
+	workers = malloc(threads * sizeof(pthread_t));
+	for (int t = 0; t < threads; t++) {
+		pthread_create(&workers[t], NULL, worker, NULL);
+	}
+	for (int t = 0; t < threads; t++) {
+		pthread_join(workers[t], NULL);
+	}
+
+	printf("%lu accesses, %u server(s), %d configurations in %.3f s on %d threads\n",
+		(unsigned long)access_count, trace_servers, config_count, (now_ns() - start) / 1e9, threads);
+	printf("%-7s %8s %8s %10s %10s %10s %10s %10s %12s\n", "policy", "frames", "hit%", "reads",
+		"writes", "writeback", "prefetch", "LDCART", "modeled s");
+	for (int i = 0; i < config_count; i++) {
+		SimConfig *cfg = &configs[i];
+		printf("%-7s %8u %8.2f %10lu %10lu %10lu %10lu %10lu %12.3f\n", policy_names[cfg->policy], cfg->frames,
+			cfg->gets ? 100.0 * cfg->hits / cfg->gets : 0.0, (unsigned long)cfg->reads,
+			(unsigned long)cfg->writes, (unsigned long)cfg->writebacks, (unsigned long)cfg->prefetched,
+			(unsigned long)cfg->loads, cfg->modeled);
+	}
+
+	free(workers);
+	return( 0 );
+}
@@ -17,9 +17,18 @@
 #include <unistd.h>
 #include <errno.h>
 #include <arpa/inet.h> 
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <pthread.h>
 
 // Project Include Files
 #include <cart_network.h>
+#include <cart_transport.h>
+#include <cart_codec.h>
+#include <cart_trace.h>
 #include <cmpsc311_log.h>
 #include <cart_controller.h>
 #include <cart_cache.h>
@@ -31,97 +40,1204 @@
 int                cart_network_shutdown = 0;   // Flag indicating shutdown
 char     	  *cart_network_address = NULL; // Address of CART server
 unsigned short     cart_network_port = 0;       // Port of CART serve
+char              *cart_network_uri = NULL;     // Transport URI, overrides address/port
+int                cart_network_compress = 0;   // Ask the server for compressed frames
+char              *cart_network_trace = NULL;   // Record the bus traffic to this file
 unsigned long      CartControllerLLevel = 0; // Controller log level (global)
 unsigned long      CartDriverLLevel = 0;     // Driver log level (global)
 unsigned long      CartSimulatorLLevel = 0;  // Driver log level (global)
 
-int 			socket_handle = -1;	//for socket id
-struct sockaddr_in 	caddr;			//for address making
-CartXferRegister 	buffer_reg;		//for change reg to network format
+uint64_t		cart_bus_ops[CART_OP_MAXVAL];	//requests sent, by opcode
+CartHistogram	cart_bus_latency[CART_OP_MAXVAL];	//time to the answer, by opcode
+uint8_t			cart_bus_features = 0;	//extensions every server agreed to
+int			cart_bus_servers = 1;	//servers the cartridges are spread over
+uint16_t		cart_bus_cartridges = CART_MAX_CARTRIDGES;	//cartridges on all of them
+uint64_t		cart_bus_batched = 0;	//frames moved by batch requests
+uint64_t		cart_bus_partial = 0;	//partial frame writes sent
+int				rx_locks_ready = 0;	//the rx locks live for the life of the process
+
+//requests sent but not answered yet, oldest first
+typedef struct {
+	CartXferRegister reg;	// the request
+	void *buf;				// where the frame of a read goes
+	uint64_t sent;			// when it went out (ns)
+	uint32_t digest;		// of the bytes written, when tracing
+	uint32_t bytes;			// frame bytes written
+	uint16_t offset;		// of a partial write
+	CartBusTicket *ticket;	// where the answer goes, NULL if nobody waits for it
+} in_flight;
+
+//a server and the connection to it, each keeps its own requests in flight.
+//Requests to a server are sent by one thread at a time (the callers see to
+//that, servers are independent of each other), the
+//answers are read by whoever holds rx_lock, so a thread waiting for its
+//answer does not hold up the next request.
+typedef struct {
+	CartTransport transport;	// where the server is
+	int socket_handle;			// for socket id
+	CartShmRegion *shm_region;	// for a shared-memory server
+	int connected;
+	int lost;					// dropped after an error, closed before the next request
+	uint8_t features;			// extensions agreed at INITMS
+	uint16_t cartridges;		// cartridges it has, CART_MAX_CARTRIDGES unless it said
+	uint16_t session;			// whose cartridges they are (a proxy session), 0 if everybody's
+
+	in_flight pipeline[CART_PIPELINE_DEPTH];
+	uint32_t pipe_head;			// next request to be answered (under rx_lock)
+	uint32_t pipe_tail;			// next free slot (by the sender)
+	pthread_mutex_t rx_lock;	// held while reading answers
+	uint32_t failed;			// failed requests nobody waited for, since the last flush
+	int dropped;				// the connection was lost since the last flush
+	CartCodecStats codec_in;	// frames expanded
+	CartCodecStats codec_out;	// frames compressed
+
+	//compressed writes are encoded here by the sender
+	char tx_buf[CART_BATCH_MAX_FRAMES * (CART_CODEC_HEADER + CART_FRAME_SIZE)];
+
+	//compressed frames are variable length, so answers are read through a buffer
+	char rx_buf[CART_SOCKET_BUFFER];
+	size_t rx_pos, rx_fill;
+
+	uint64_t requests;			// requests sent
+	uint64_t bytes_out;			// bytes sent on the socket
+	uint64_t bytes_in;			// bytes received on the socket
+} bus_server;
+
+bus_server		servers[CART_MAX_SERVERS];
+
+//time from sending a request to its answer, by opcode
+uint64_t		bus_lat_ns[CART_OP_MAXVAL];
+uint64_t		bus_lat_max[CART_OP_MAXVAL];
+uint64_t		bus_lat_count[CART_OP_MAXVAL];
+static const char *bus_op_names[CART_OP_MAXVAL] = {
+	"INITMS", "BZERO", "LDCART", "RDFRME", "WRFRME", "POWOFF" };
+
+//the trace being recorded, see cart_trace.h
+FILE			*trace_file = NULL;
+uint64_t		trace_start;	//ns the record times count from
+uint64_t		trace_records;
 
 //
 // Functions
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : client_cart_bus_request
-// Description  : This the client operation that sends a request to the CART
-//                server process.   It will:
+// Function     : now_ns
+// Description  : read the monotonic clock
 //
-//                1) if INIT make a connection to the server
-//                2) send any request to the server, returning results
-//                3) if CLOSE, will close the connection
+// Inputs       : none
+// Outputs      : nanoseconds
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return( (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Inputs       : reg - the request reqisters for the command
-//                buf - the block to be read/written from (READ/WRITE)
-// Outputs      : the response structure encoded as needed
+// Function     : trace_digest
+// Description  : FNV-1a of some bytes, what a trace keeps of a payload
+//
+// Inputs       : buf, len - the bytes
+// Outputs      : the digest
 
-CartXferRegister client_cart_bus_request(CartXferRegister reg, void *buf) {
-	uint64_t result;
+static uint32_t trace_digest(const void *buf, size_t len) {
+	const unsigned char *p = buf;
+	uint32_t h = 2166136261U;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ p[i]) * 16777619U;
+	}
+	return( h );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_open
+// Description  : start recording the bus traffic to cart_network_trace,
+//                once per process
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int trace_open(void) {
+	CartTraceHeader hdr;
+
+	if ( (trace_file = fopen(cart_network_trace, "wb")) == NULL ) {
+		logMessage(LOG_ERROR_LEVEL, "CART client: cannot record to [%s] : [%s]",
+			cart_network_trace, strerror(errno));
+		return( -1 );
+	}
+	setvbuf(trace_file, NULL, _IOFBF, CART_TRACE_BUFFER);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CART_TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.servers = cart_bus_servers;
+	hdr.record_size = sizeof(CartTraceRecord);
+	fwrite(&hdr, sizeof(hdr), 1, trace_file);
+	trace_start = now_ns();
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_request
+// Description  : record a request that was just answered
+//
+// Inputs       : s - the server, req - the request, resp - the answer
+//                took - ns it took
+// Outputs      : none
+
+static void trace_request(bus_server *s, in_flight *req, CartXferRegister resp, uint64_t took) {
+	CartTraceRecord rec;
+	uint64_t op = req->reg >> 56;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.reg = req->reg;
+	rec.sent = req->sent - trace_start;
+	rec.took = (took > UINT32_MAX) ? UINT32_MAX : took;
+	rec.server = s - servers;
+	rec.failed = (resp >> 47) & 1;
+	if (op == CART_OP_WRFRME) {
+		rec.digest = req->digest;
+		rec.bytes = req->bytes;
+		rec.offset = req->offset;
+	} else if ( (op == CART_OP_RDFRME) && !rec.failed ) {
+		rec.bytes = CART_BATCH_FRAMES(req->reg) * CART_FRAME_SIZE;
+		rec.digest = trace_digest(req->buf, rec.bytes);
+	}
+	fwrite(&rec, sizeof(rec), 1, trace_file);
+	__atomic_add_fetch(&trace_records, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_open
+// Description  : connect to a TCP server and set the socket up for small
+//                requests: no Nagle delay, and buffers that hold a full
+//                pipeline in each direction
+//
+// Inputs       : s - the server
+// Outputs      : 0 if successful, -1 if failure
+
+static int tcp_open(bus_server *s) {
+	struct sockaddr_in caddr;
+	int one = 1, bufsize = CART_SOCKET_BUFFER;
+
+	memset(&caddr, 0, sizeof(caddr));
+	caddr.sin_family = AF_INET;
+	caddr.sin_port = htons(s->transport.port);
+	if ( inet_aton(s->transport.host, &caddr.sin_addr) == 0 ) {
+		logMessage(LOG_OUTPUT_LEVEL, "Error: inet_aton");
+		return( -1 );
+	}
+
+	//Create the socket
+	s->socket_handle = socket(PF_INET, SOCK_STREAM, 0);
+	if (s->socket_handle == -1){
+		logMessage(LOG_OUTPUT_LEVEL, "Error: socket create");
+		return( -1 );
+	}
+
+	//requests are small and answered one by one, never hold them back
+	if ( (setsockopt(s->socket_handle, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) ||
+			(setsockopt(s->socket_handle, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize)) == -1) ||
+			(setsockopt(s->socket_handle, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize)) == -1) ) {
+		logMessage(LOG_OUTPUT_LEVEL, "Error: socket options [%s]", strerror(errno));
+	}
+
+	//Create the connection
+	if ( connect(s->socket_handle, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1 ) {
+		logMessage(LOG_OUTPUT_LEVEL, "Error: connection issue [%s:%u]",
+			s->transport.host, s->transport.port);
+		close( s->socket_handle );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unix_open
+// Description  : connect to a server on this host over a Unix-domain
+//                socket, the requests then go over it just like TCP
+//
+// Inputs       : s - the server
+// Outputs      : 0 if successful, -1 if failure
+
+static int unix_open(bus_server *s) {
+	struct sockaddr_un uaddr;
+	int bufsize = CART_SOCKET_BUFFER;
+
+	memset(&uaddr, 0, sizeof(uaddr));
+	uaddr.sun_family = AF_UNIX;
+	if (strlen(s->transport.path) >= sizeof(uaddr.sun_path)) {
+		logMessage(LOG_OUTPUT_LEVEL, "Error: socket path too long [%s]", s->transport.path);
+		return( -1 );
+	}
+	strcpy(uaddr.sun_path, s->transport.path);
+
+	s->socket_handle = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s->socket_handle == -1){
+		logMessage(LOG_OUTPUT_LEVEL, "Error: socket create");
+		return( -1 );
+	}
+	setsockopt(s->socket_handle, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+	setsockopt(s->socket_handle, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+	if ( connect(s->socket_handle, (const struct sockaddr *)&uaddr, sizeof(uaddr)) == -1 ) {
+		logMessage(LOG_OUTPUT_LEVEL, "Error: connection issue [%s]", s->transport.path);
+		close( s->socket_handle );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_open
+// Description  : make the connection to one server, with nothing in flight
+//
+// Inputs       : s - the server
+// Outputs      : 0 if successful, -1 if failure
+
+static int server_open(bus_server *s) {
+	int ret;
+
+	switch (s->transport.type) {
+	case CART_TRANSPORT_TCP:
+		ret = tcp_open(s);
+		break;
+	case CART_TRANSPORT_UNIX:
+		ret = unix_open(s);
+		break;
+	case CART_TRANSPORT_SHM:
+		s->shm_region = cart_shm_map(s->transport.path, 0);
+		ret = (s->shm_region == NULL) ? -1 : 0;
+		break;
+	default:
+		ret = -1;
+	}
+	if (ret == -1) {
+		return( -1 );
+	}
+
+	s->connected = 1;
+	s->lost = 0;
+	s->features = 0;
+	s->rx_pos = s->rx_fill = 0;
+	s->pipe_head = s->pipe_tail;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : close_connection
+// Description  : close the socket, or detach from the shared region, of a
+//                server
+//
+// Inputs       : s - the server
+// Outputs      : none
+
+static void close_connection(bus_server *s) {
+	int i;
+
+	if (s->transport.type == CART_TRANSPORT_SHM) {
+		cart_shm_unmap(s->shm_region, s->transport.path, 0);
+		s->shm_region = NULL;
+	} else {
+		close( s->socket_handle );
+	}
+	s->connected = 0;
+
+	//down once the last server is closed
+	for (i = 0; i < cart_bus_servers && !servers[i].connected; i++);
+	if (i == cart_bus_servers) {
+		cart_network_shutdown = 0;
+		if (trace_file != NULL) {
+			fflush(trace_file);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_connect
+// Description  : Make the connection to the servers, over TCP unless
+//                cart_network_uri names other transports.  A list of
+//                URIs (separated by commas) spreads the cartridges over
+//                that many servers, see CART_BUS_SERVER.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int client_cart_bus_connect(void) {
+	char *list, *uri, *save = NULL;
+	int n = 0;
 
-	if (cart_network_shutdown == 0) {
+	if (cart_network_shutdown) {
+		return( 0 );
+	}
+	if (!rx_locks_ready) {
+		for (int i = 0; i < CART_MAX_SERVERS; i++) {
+			pthread_mutex_init(&servers[i].rx_lock, NULL);
+		}
+		rx_locks_ready = 1;
+	}
 
-		caddr.sin_family = AF_INET;
+	if (cart_network_uri != NULL) {
+		list = strdup(cart_network_uri);
+		for (uri = strtok_r(list, ",", &save); uri != NULL; uri = strtok_r(NULL, ",", &save)) {
+			if ( (n == CART_MAX_SERVERS) || (cart_transport_parse(uri, &servers[n].transport) == -1) ) {
+				logMessage(LOG_OUTPUT_LEVEL, "Error: bad transport [%s] (at most %d servers)",
+					uri, CART_MAX_SERVERS);
+				free(list);
+				return( -1 );
+			}
+			n++;
+		}
+		free(list);
+		if (n == 0) {
+			logMessage(LOG_OUTPUT_LEVEL, "Error: bad transport [%s]", cart_network_uri);
+			return( -1 );
+		}
+	} else {
+		memset(&servers[0].transport, 0, sizeof(CartTransport));
+		servers[0].transport.type = CART_TRANSPORT_TCP;
+		if (cart_network_address != NULL) {
+			strncpy(servers[0].transport.host, cart_network_address, CART_TRANSPORT_MAX_URI - 1);
+		}
+		servers[0].transport.port = cart_network_port;
+		n = 1;
+	}
+
+	for (int i = 0; i < n; i++) {
 		//Setup the address
-		if (cart_network_port == 0){
-			cart_network_port = CART_DEFAULT_PORT;
+		if (servers[i].transport.type == CART_TRANSPORT_TCP) {
+			if (servers[i].transport.port == 0){
+				servers[i].transport.port = CART_DEFAULT_PORT;
+			}
+			if (servers[i].transport.host[0] == '\0'){
+				strcpy(servers[i].transport.host, CART_DEFAULT_IP);
+			}
 		}
-		caddr.sin_port = htons(cart_network_port);
+		servers[i].cartridges = CART_MAX_CARTRIDGES;
+		servers[i].session = 0;
+		if ( server_open(&servers[i]) == -1 ) {
+			while (--i >= 0) {
+				close_connection(&servers[i]);
+			}
+			return( -1 );
+		}
+	}
+
+	cart_network_shutdown = 1;
+	cart_bus_servers = n;
+	cart_bus_cartridges = n * CART_MAX_CARTRIDGES;
+	cart_bus_features = 0;
+
+	//a failed trace is reported, the traffic goes on without it
+	if ( (cart_network_trace != NULL) && (trace_file == NULL) ) {
+		trace_open();
+	}
 
-		if (cart_network_address == NULL){
-			cart_network_address = CART_DEFAULT_IP;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_id
+// Description  : a hash of the servers connected (FNV-1a of their transports
+//                and the sessions they gave us, in order), processes sharing
+//                frames must agree on it
+//
+// Inputs       : none
+// Outputs      : the hash
+
+uint64_t client_cart_bus_id(void) {
+	uint64_t h = 14695981039346656037ULL;
+	char name[2 * CART_TRANSPORT_MAX_URI + 16];
+
+	for (int i = 0; i < cart_bus_servers; i++) {
+		CartTransport *t = &servers[i].transport;
+
+		snprintf(name, sizeof(name), "%d|%s|%u|%s|%u,", (int)t->type, t->host, t->port, t->path,
+			servers[i].session);
+		for (char *c = name; *c != '\0'; c++) {
+			h = (h ^ (uint8_t)*c) * 1099511628211ULL;
+		}
+	}
+	return( h );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_connection
+// Description  : give up on the connection to a server after an error,
+//                whatever was in flight on it is lost and its waiters are
+//                told so.  The socket is only shut down here, the sender
+//                may be in the middle of using it, and closed before the
+//                next request.  The caller holds rx_lock.
+//
+// Inputs       : s - the server
+// Outputs      : -1 (for the caller to return)
+
+static int drop_connection(bus_server *s) {
+	uint32_t tail = __atomic_load_n(&s->pipe_tail, __ATOMIC_ACQUIRE);
+
+	if (s->connected) {
+		logMessage(LOG_ERROR_LEVEL, "CART client: connection to server %d lost with %u requests in flight.",
+			(int)(s - servers), tail - s->pipe_head);
+		if (s->transport.type != CART_TRANSPORT_SHM) {
+			shutdown(s->socket_handle, SHUT_RDWR);
 		}
+		s->connected = 0;
+		s->lost = 1;
+	}
+	s->dropped = 1;
+
+	while (s->pipe_head != tail) {
+		CartBusTicket *t = s->pipeline[s->pipe_head % CART_PIPELINE_DEPTH].ticket;
+		if (t != NULL) {
+			t->result = -1;
+			t->status = -1;
+			t->done = 1;
+		}
+		__atomic_store_n(&s->pipe_head, s->pipe_head + 1, __ATOMIC_RELEASE);
+	}
+	return( -1 );
+}
 
-		if ( inet_aton(cart_network_address, &caddr.sin_addr) == 0 ) {
-			logMessage(LOG_OUTPUT_LEVEL, "Error: inet_aton");
- 			return( -1 );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_reopen
+// Description  : connect again to a server that was dropped or powered
+//                off, called by the sender
+//
+// Inputs       : s - the server
+// Outputs      : 0 if successful, -1 if failure
+
+static int server_reopen(bus_server *s) {
+	int ret = 0;
+
+	pthread_mutex_lock(&s->rx_lock);
+	if (s->lost) {
+		if (s->transport.type == CART_TRANSPORT_SHM) {
+			cart_shm_unmap(s->shm_region, s->transport.path, 0);
+			s->shm_region = NULL;
+		} else {
+			close( s->socket_handle );
 		}
+		s->lost = 0;
+	}
+	if (!s->connected) {
+		ret = server_open(s);
+	}
+	pthread_mutex_unlock(&s->rx_lock);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : xfer_full
+// Description  : move every byte described by an io vector over the socket
+//                with as few calls as the kernel allows, picking up where a
+//                short read or write left off
+//
+// Inputs       : sock - the socket, out - 1 to send, 0 to receive
+//                iov, cnt - the io vector (changed as it is used up)
+// Outputs      : 0 if successful, -1 if failure
 
-		//Create the socket
-		socket_handle = socket(PF_INET, SOCK_STREAM, 0);
-		if (socket_handle == -1){
-			logMessage(LOG_OUTPUT_LEVEL, "Error: socket create");
+static int xfer_full(int sock, int out, struct iovec *iov, int cnt) {
+
+	struct msghdr msg;
+
+	while (cnt > 0) {
+		ssize_t n;
+
+		//a server gone away is an error here, not a SIGPIPE
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = cnt;
+		n = out ? sendmsg(sock, &msg, MSG_NOSIGNAL) : readv(sock, iov, cnt);
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
 			return( -1 );
 		}
 
-		//Create the connection
-		if ( connect(socket_handle, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1 ) {
-			logMessage(LOG_OUTPUT_LEVEL, "Error: connection issue");
+		//skip what was done, the rest of a part goes round again
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rx_read
+// Description  : read from the socket through the receive buffer, so the
+//                small pieces of compressed answers do not cost a call each
+//
+// Inputs       : s - the server, dst - where the bytes go, len - how many
+// Outputs      : 0 if successful, -1 if failure
 
+static int rx_read(bus_server *s, void *dst, size_t len) {
+	size_t n;
+
+	while (len > 0) {
+		if (s->rx_pos == s->rx_fill) {
+			ssize_t got = recv(s->socket_handle, s->rx_buf, sizeof(s->rx_buf), 0);
+			if (got <= 0) {
+				if (got == -1 && errno == EINTR) {
+					continue;
+				}
+				return( -1 );
+			}
+			s->rx_pos = 0;
+			s->rx_fill = got;
+			s->bytes_in += got;
+		}
+		n = (len < s->rx_fill - s->rx_pos) ? len : s->rx_fill - s->rx_pos;
+		memcpy(dst, &s->rx_buf[s->rx_pos], n);
+		s->rx_pos += n;
+		dst = (char *)dst + n;
+		len -= n;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_compressed
+// Description  : read the answer to a request on a compressed connection,
+//                every frame comes with a header giving its length
+//
+// Inputs       : s - the server, req - the request
+//                resp - receives the register
+// Outputs      : 0 if successful, -1 if failure
+
+static int read_compressed(bus_server *s, in_flight *req, CartXferRegister *resp) {
+	char data[CART_FRAME_SIZE];
+	uint16_t header;
+
+	if (rx_read(s, resp, sizeof(*resp)) == -1) {
+		return( -1 );
+	}
+	if ((req->reg >> 56) != CART_OP_RDFRME) {
+		return( 0 );
+	}
+
+	for (uint32_t i = 0; i < CART_BATCH_FRAMES(req->reg); i++) {
+		if (rx_read(s, &header, sizeof(header)) == -1) {
+			return( -1 );
+		}
+		header = ntohs(header);
+		if ( ((header & CART_CODEC_LEN_MASK) > CART_FRAME_SIZE) ||
+				(rx_read(s, data, header & CART_CODEC_LEN_MASK) == -1) ||
+				(cart_codec_decode(header, data, (char *)req->buf + i * CART_FRAME_SIZE, &s->codec_in) == -1) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART client: bad compressed frame.");
 			return( -1 );
-		} 
-		cart_network_shutdown =1;
+		}
 	}
+	return( 0 );
+}
 
-	uint64_t OpCodes = reg >> 56;
-	buffer_reg = htonll64(reg);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : complete_request
+// Description  : read the response to the oldest request in flight on a
+//                server and hand it to whoever waits for it, the caller
+//                holds rx_lock
+//
+// Inputs       : s - the server
+// Outputs      : 0 if successful, 1 if the server failed the request,
+//                -1 if the connection failed
+
+static int complete_request(bus_server *s) {
+	in_flight req = s->pipeline[s->pipe_head % CART_PIPELINE_DEPTH];	//the slot is reused once answered
+	uint64_t OpCodes = req.reg >> 56, took;
+	CartXferRegister resp;
+	size_t bytes = CART_BATCH_FRAMES(req.reg) * CART_FRAME_SIZE;
+	struct iovec iov[2];
+	int quick = 1, failed;
 
-	if (OpCodes == CART_OP_RDFRME){
-		write(socket_handle, &buffer_reg, sizeof(buffer_reg));	
-		read(socket_handle, &result, sizeof(result));	
-		read(socket_handle, buf, 1024);
+	if (!s->connected) {
+		return( drop_connection(s) );
 	}
-	else if(OpCodes == CART_OP_WRFRME){
-		write(socket_handle, &buffer_reg, sizeof(buffer_reg));
-		write(socket_handle, buf, 1024);		
-		read(socket_handle, &result, sizeof(result));
+	if (s->transport.type == CART_TRANSPORT_SHM) {
+		//the frame of a read is copied straight out of the ring slot
+		if ( cart_shm_get(s->shm_region, &s->shm_region->answers, &resp,
+				(OpCodes == CART_OP_RDFRME) ? req.buf : NULL) == -1 ) {
+			return( drop_connection(s) );
+		}
+	} else {
+		//ack at once, the server holds small answers back until it sees the ack
+		if (s->transport.type == CART_TRANSPORT_TCP) {
+			setsockopt(s->socket_handle, IPPROTO_TCP, TCP_QUICKACK, &quick, sizeof(quick));
+		}
+
+		//the answer to a read carries the frame, or the run of frames
+		if (s->features & CART_FEATURE_COMPRESS) {
+			if ( read_compressed(s, &req, &resp) == -1 ) {
+				return( drop_connection(s) );
+			}
+		} else {
+			iov[0].iov_base = &resp;
+			iov[0].iov_len = sizeof(resp);
+			iov[1].iov_base = req.buf;
+			iov[1].iov_len = bytes;
+			if ( xfer_full(s->socket_handle, 0, iov, (OpCodes == CART_OP_RDFRME) ? 2 : 1) == -1 ) {
+				return( drop_connection(s) );
+			}
+			s->bytes_in += sizeof(resp) + ((OpCodes == CART_OP_RDFRME) ? bytes : 0);
+		}
+		resp = ntohll64(resp);
+	}
+
+	//the servers are read in parallel, the totals are shared
+	if (OpCodes < CART_OP_MAXVAL){
+		took = now_ns() - req.sent;
+		__atomic_add_fetch(&bus_lat_ns[OpCodes], took, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&bus_lat_count[OpCodes], 1, __ATOMIC_RELAXED);
+		uint64_t seen = __atomic_load_n(&bus_lat_max[OpCodes], __ATOMIC_RELAXED);
+		while ( (took > seen) && !__atomic_compare_exchange_n(&bus_lat_max[OpCodes], &seen, took, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+		cart_hist_record(&cart_bus_latency[OpCodes], took);
+		if (trace_file != NULL) {
+			trace_request(s, &req, resp, took);
+		}
+	}
+
+	//a server that knows the extensions answers without the ask bit, the
+	//driver only uses those every server agreed to
+	if (OpCodes == CART_OP_INITMS){
+		uint8_t ky2 = (resp >> 48) & 0xff;
+		uint16_t fewest = CART_BUS_MAX_CARTRIDGES / cart_bus_servers;
+		s->features = (ky2 & CART_FEATURE_ASK) ? 0 : ky2;
+		if ( (s->features & CART_FEATURE_CARTS) && ((resp >> 31) & 0xffff) ) {
+			s->cartridges = (resp >> 31) & 0xffff;
+		}
+		s->session = (s->features & CART_FEATURE_CARTS) ? (resp >> 15) & 0xffff : 0;
+		resp &= ~(0xffULL << 48);
+		cart_bus_features = 0xff;
+		for (int i = 0; i < cart_bus_servers; i++) {
+			cart_bus_features &= servers[i].features;
+			fewest = (servers[i].cartridges < fewest) ? servers[i].cartridges : fewest;
+		}
+
+		//the cartridges go round the servers, each gives as many as the smallest
+		cart_bus_cartridges = cart_bus_servers * fewest;
 	}
-	else if(OpCodes == CART_OP_POWOFF){
-		write(socket_handle, &buffer_reg, sizeof(buffer_reg));
-		read(socket_handle, &result, sizeof(result));
+
+	if (OpCodes == CART_OP_POWOFF){
 		//cloce connection
-		close( socket_handle );
-		cart_network_shutdown = 0;
+		close_connection(s);
+	}
+
+	//a failure nobody waits for is counted for the next flush
+	failed = (resp >> 47) & 1;	//RT1
+	if (req.ticket != NULL) {
+		req.ticket->result = resp;
+		req.ticket->status = failed;
+		req.ticket->done = 1;
+	} else {
+		s->failed += failed;
+	}
+	__atomic_store_n(&s->pipe_head, s->pipe_head + 1, __ATOMIC_RELEASE);
+	return( failed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : send_request
+// Description  : put a request on the wire and in the pipeline of a
+//                server, reading the oldest answer first if the pipeline
+//                is full.  One thread sends to a server at a time.
+//
+// Inputs       : s - the server
+//                reg - the request register (cartridge number of the server)
+//                buf - the frame of a write or where a read goes
+//                iov, cnt - what follows the register on a socket,
+//                           iov[0] is filled in with the register here
+//                ticket - where the answer goes, NULL if nobody waits for it
+// Outputs      : 0 if successful, -1 if failure
+
+static int send_request(bus_server *s, CartXferRegister reg, void *buf, struct iovec *iov, int cnt,
+		CartBusTicket *ticket) {
+	uint64_t OpCodes = reg >> 56;
+	CartXferRegister net_reg;
+	size_t bytes = 0;
+	int ret = 0;
+
+	//a server lost after an error is reconnected on its next request
+	if ( !s->connected && (server_reopen(s) == -1) ) {
+		return( -1 );
+	}
+
+	//backpressure, make room by reading the oldest answer
+	if (s->pipe_tail - __atomic_load_n(&s->pipe_head, __ATOMIC_ACQUIRE) == CART_PIPELINE_DEPTH) {
+		pthread_mutex_lock(&s->rx_lock);
+		if (s->pipe_tail - s->pipe_head == CART_PIPELINE_DEPTH) {
+			ret = complete_request(s);
+		}
+		pthread_mutex_unlock(&s->rx_lock);
+		if (ret == -1) {
+			return( -1 );
+		}
+	}
+
+	if (OpCodes < CART_OP_MAXVAL){
+		__atomic_add_fetch(&cart_bus_ops[OpCodes], 1, __ATOMIC_RELAXED);
+	}
+	s->requests += 1;
+
+	//ask for the extensions, the shared-memory ring carries single frames
+	if ( (OpCodes == CART_OP_INITMS) && (s->transport.type != CART_TRANSPORT_SHM) ) {
+		reg |= (uint64_t)(CART_FEATURE_ASK | CART_FEATURE_BATCH | CART_FEATURE_PARTIAL | CART_FEATURE_CARTS |
+			(cart_network_compress ? CART_FEATURE_COMPRESS : 0)) << 48;
+	}
+
+	//the frames written may be reused once they are sent, digest them now
+	if ( (trace_file != NULL) && (OpCodes == CART_OP_WRFRME) ) {
+		in_flight *req = &s->pipeline[s->pipe_tail % CART_PIPELINE_DEPTH];
+		if ((reg >> 48) & CART_FEATURE_PARTIAL) {
+			req->offset = ntohs(((uint16_t *)iov[1].iov_base)[0]);
+			req->bytes = iov[2].iov_len;
+			req->digest = trace_digest(iov[2].iov_base, req->bytes);
+		} else {
+			req->offset = 0;
+			req->bytes = CART_BATCH_FRAMES(reg) * CART_FRAME_SIZE;
+			req->digest = trace_digest(buf, req->bytes);
+		}
+	}
+
+	s->pipeline[s->pipe_tail % CART_PIPELINE_DEPTH].sent = now_ns();
+	if (s->transport.type == CART_TRANSPORT_SHM) {
+		//the register stays in host order, the frame is copied once into the slot
+		if ( cart_shm_put(s->shm_region, &s->shm_region->requests, reg,
+				(OpCodes == CART_OP_WRFRME) ? buf : NULL) == -1 ) {
+			ret = -1;
+		}
+	} else {
+		//the register and its payload go out in one call
+		net_reg = htonll64(reg);
+		iov[0].iov_base = &net_reg;
+		iov[0].iov_len = CART_NET_HEADER_SIZE;
+		for (int i = 0; i < cnt; i++) {
+			bytes += iov[i].iov_len;
+		}
+		if ( xfer_full(s->socket_handle, 1, iov, cnt) == -1 ) {
+			ret = -1;
+		}
+		s->bytes_out += bytes;
+	}
+	if (ret == -1) {
+		pthread_mutex_lock(&s->rx_lock);
+		drop_connection(s);
+		pthread_mutex_unlock(&s->rx_lock);
+		return( -1 );
+	}
+
+	//the answer can be read once the slot is in the pipeline
+	s->pipeline[s->pipe_tail % CART_PIPELINE_DEPTH].reg = reg;
+	s->pipeline[s->pipe_tail % CART_PIPELINE_DEPTH].buf = buf;
+	s->pipeline[s->pipe_tail % CART_PIPELINE_DEPTH].ticket = ticket;
+	__atomic_store_n(&s->pipe_tail, s->pipe_tail + 1, __ATOMIC_RELEASE);
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : route_request
+// Description  : find the server a request goes to and make its cartridge
+//                number the one that server knows it by
+//
+// Inputs       : reg - the request register, its cartridge is rewritten
+// Outputs      : the server, NULL if not connected
+
+static bus_server *route_request(CartXferRegister *reg) {
+	uint16_t cart = (*reg >> 31) & 0xffff;
+
+	//normally connected at power on, this only catches a caller that was not
+	if ( (cart_network_shutdown == 0) && (client_cart_bus_connect() == -1) ) {
+		return( NULL );
 	}
-	else{
-		write(socket_handle, &buffer_reg, sizeof(buffer_reg));	
-		read(socket_handle, &result, sizeof(result));	
+
+	*reg = (*reg & ~(0xffffULL << 31)) | ((uint64_t)CART_BUS_LOCAL(cart) << 31);
+	return( &servers[CART_BUS_SERVER(cart)] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : submit_to
+// Description  : send a request to a server without waiting for the answer
+//
+// Inputs       : s - the server, reg - the request (already routed)
+//                buf - the frames of a write or where a read goes
+//                ticket - where the answer goes, NULL if nobody waits for it
+// Outputs      : 0 if successful, -1 if failure
+
+static int submit_to(bus_server *s, CartXferRegister reg, void *buf, CartBusTicket *ticket) {
+	struct iovec iov[2];
+
+	iov[1].iov_base = buf;
+	iov[1].iov_len = CART_BATCH_FRAMES(reg) * CART_FRAME_SIZE;
+
+	//on a compressed connection the frames of a write go out encoded
+	if ( (s->features & CART_FEATURE_COMPRESS) && ((reg >> 56) == CART_OP_WRFRME) ) {
+		iov[1].iov_base = s->tx_buf;
+		iov[1].iov_len = 0;
+		for (uint32_t i = 0; i < CART_BATCH_FRAMES(reg); i++) {
+			iov[1].iov_len += cart_codec_encode((char *)buf + i * CART_FRAME_SIZE,
+				&s->tx_buf[iov[1].iov_len], &s->codec_out);
+		}
 	}
-	return result;
+	return( send_request(s, reg, buf, iov, ((reg >> 56) == CART_OP_WRFRME) ? 2 : 1, ticket) );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_server
+// Description  : wait for the answers to every request sent to a server
+//                so far.  The failures counted are those of the requests
+//                nobody waited for, since the last flush.
+//
+// Inputs       : s - the server
+// Outputs      : number of requests the server failed, -1 if the
+//                connection failed
 
+static int flush_server(bus_server *s) {
+	uint32_t tail = __atomic_load_n(&s->pipe_tail, __ATOMIC_ACQUIRE);
+	int failed;
 
+	pthread_mutex_lock(&s->rx_lock);
+	while ( ((int32_t)(tail - s->pipe_head) > 0) && (complete_request(s) != -1) );
+	failed = s->dropped ? -1 : (int)s->failed;
+	s->failed = 0;
+	s->dropped = 0;
+	pthread_mutex_unlock(&s->rx_lock);
 
+	return( failed );
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_submit
+// Description  : Send a request to the CART server without waiting for the
+//                answer.  Up to CART_PIPELINE_DEPTH requests are kept in
+//                flight on each server, beyond that the oldest is waited
+//                for first.  INITMS and POWOFF go to every server.
+//
+// Inputs       : reg - the request reqisters for the command
+//                buf - the block to be read/written from (READ/WRITE), a
+//                      read buffer must stay valid until it is answered
+// Outputs      : 0 if successful, -1 if failure
+
+int client_cart_bus_submit(CartXferRegister reg, void *buf) {
+	uint64_t OpCodes = reg >> 56;
+	bus_server *s;
+
+	//a run of frames only goes to a server that agreed to it
+	if ( (reg & CART_BATCH_MASK) && !(cart_bus_features & CART_FEATURE_BATCH) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART client: batch request without server support.");
+		return( -1 );
+	}
+	if (reg & CART_BATCH_MASK){
+		__atomic_add_fetch(&cart_bus_batched, CART_BATCH_FRAMES(reg), __ATOMIC_RELAXED);
+	}
+
+	if ( (OpCodes == CART_OP_INITMS) || (OpCodes == CART_OP_POWOFF) ) {
+		if ( (cart_network_shutdown == 0) && (client_cart_bus_connect() == -1) ) {
+			return( -1 );
+		}
+		for (int i = 0; i < cart_bus_servers; i++) {
+			if ( submit_to(&servers[i], reg, NULL, NULL) == -1 ) {
+				return( -1 );
+			}
+		}
+		return( 0 );
+	}
+
+	if ( (s = route_request(&reg)) == NULL ) {
+		return( -1 );
+	}
+	return( submit_to(s, reg, buf, NULL) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_send
+// Description  : Send a request to one server without waiting for the
+//                answer, which is kept in a ticket for
+//                client_cart_bus_wait.  The sender can let other threads
+//                send as soon as this returns and wait afterwards.
+//
+// Inputs       : reg - the request (not INITMS or POWOFF)
+//                buf - the frame of a write or where a read goes, which
+//                      must stay valid until the answer is in
+//                ticket - receives the answer
+// Outputs      : 0 if successful, -1 if failure (the ticket says so too)
+
+int client_cart_bus_send(CartXferRegister reg, void *buf, CartBusTicket *ticket) {
+	uint64_t OpCodes = reg >> 56;
+	bus_server *s;
 
+	ticket->done = 0;
+	if ( (OpCodes == CART_OP_INITMS) || (OpCodes == CART_OP_POWOFF) ||
+			((reg & CART_BATCH_MASK) && !(cart_bus_features & CART_FEATURE_BATCH)) ||
+			((s = route_request(&reg)) == NULL) ) {
+		ticket->server = -1;
+	} else {
+		if (reg & CART_BATCH_MASK){
+			__atomic_add_fetch(&cart_bus_batched, CART_BATCH_FRAMES(reg), __ATOMIC_RELAXED);
+		}
+		ticket->server = s - servers;
+		if ( submit_to(s, reg, buf, ticket) == 0 ) {
+			return( 0 );
+		}
+	}
+
+	ticket->result = -1;
+	ticket->status = -1;
+	ticket->done = 1;
+	return( -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_wait
+// Description  : Wait for the answer to a request sent with
+//                client_cart_bus_send.  The answers of a server come in
+//                order, whoever waits reads them (others' too) until its
+//                own is in.
+//
+// Inputs       : ticket - the request
+// Outputs      : the response register, -1 if the connection failed
+
+CartXferRegister client_cart_bus_wait(CartBusTicket *ticket) {
+	bus_server *s;
+
+	if (ticket->server < 0) {
+		return( ticket->result );
+	}
+	s = &servers[ticket->server];
+
+	pthread_mutex_lock(&s->rx_lock);
+	while ( !ticket->done && (s->pipe_head != __atomic_load_n(&s->pipe_tail, __ATOMIC_ACQUIRE)) ) {
+		complete_request(s);
+	}
+	if ( !ticket->done ) {
+		ticket->result = -1;
+		ticket->status = -1;
+		ticket->done = 1;
+	}
+	pthread_mutex_unlock(&s->rx_lock);
+
+	return( ticket->result );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_submit_partial
+// Description  : Send a write of part of a frame without waiting for the
+//                answer, only the bytes that changed go over the wire
+//
+// Inputs       : reg - a WRFRME request register
+//                off, len - where in the frame the bytes go
+//                data - the bytes, sent before this returns
+// Outputs      : 0 if successful, -1 if failure
+
+int client_cart_bus_submit_partial(CartXferRegister reg, uint16_t off, uint16_t len, void *data) {
+	uint16_t hdr[2] = { htons(off), htons(len) };
+	struct iovec iov[3];
+	bus_server *s;
+
+	if ( !(cart_bus_features & CART_FEATURE_PARTIAL) || ((reg >> 56) != CART_OP_WRFRME) ||
+			(off + len > CART_FRAME_SIZE) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART client: bad partial write request.");
+		return( -1 );
+	}
+	if ( (s = route_request(&reg)) == NULL ) {
+		return( -1 );
+	}
+	__atomic_add_fetch(&cart_bus_partial, 1, __ATOMIC_RELAXED);
+
+	iov[1].iov_base = hdr;
+	iov[1].iov_len = sizeof(hdr);
+	iov[2].iov_base = data;
+	iov[2].iov_len = len;
+	return( send_request(s, reg | ((uint64_t)CART_FEATURE_PARTIAL << 48), NULL, iov, 3, NULL) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_flush
+// Description  : Wait for the answers to every request in flight, on every
+//                server
+//
+// Inputs       : none
+// Outputs      : number of requests the servers failed, -1 if a
+//                connection failed
+
+int client_cart_bus_flush(void) {
+	int failed = 0, lost = 0, ret;
+
+	for (int i = 0; i < cart_bus_servers; i++) {
+		if ( (ret = flush_server(&servers[i])) == -1 ) {
+			lost = 1;
+		} else {
+			failed += ret;
+		}
+	}
+	if (failed > 0) {
+		logMessage(LOG_ERROR_LEVEL, "CART client: %d pipelined requests failed.", failed);
+	}
+	return( lost ? -1 : failed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_request
+// Description  : This the client operation that sends a request to the CART
+//                server process.   It will:
+//
+//                1) if INIT make a connection to the server
+//                2) send any request to the server, returning results
+//                3) if CLOSE, will close the connection
+//
+//                Whatever was sent to the server before is answered
+//                first.  INITMS and POWOFF go to every server, the answer
+//                carries RT1 if any of them failed.
+//
+// Inputs       : reg - the request reqisters for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+CartXferRegister client_cart_bus_request(CartXferRegister reg, void *buf) {
+	uint64_t OpCodes = reg >> 56;
+	CartBusTicket tickets[CART_MAX_SERVERS];
+	CartXferRegister result = 0, resp;
+	int n;
+
+	if ( (OpCodes == CART_OP_INITMS) || (OpCodes == CART_OP_POWOFF) ) {
+		if ( (cart_network_shutdown == 0) && (client_cart_bus_connect() == -1) ) {
+			return( -1 );
+		}
+
+		//one round trip for all of them, every ticket sent is waited for
+		n = cart_bus_servers;
+		for (int i = 0; i < n; i++) {
+			tickets[i].server = i;
+			tickets[i].done = 0;
+			if ( submit_to(&servers[i], reg, NULL, &tickets[i]) == -1 ) {
+				tickets[i].server = -1;
+				tickets[i].result = -1;
+				tickets[i].done = 1;
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			resp = client_cart_bus_wait(&tickets[i]);
+			if ( (i == 0) || ((resp >> 47) & 1) ) {
+				result = resp;
+			}
+		}
+		return result;
+	}
+
+	client_cart_bus_send(reg, buf, &tickets[0]);
+	return( client_cart_bus_wait(&tickets[0]) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : codec_add
+// Description  : add the codec counters of one server to a total
+//
+// Inputs       : total - the sum so far, s - the counters of the server
+// Outputs      : none
+
+static void codec_add(CartCodecStats *total, CartCodecStats *s) {
+	total->frames += s->frames;
+	total->raw_frames += s->raw_frames;
+	total->bytes_raw += s->bytes_raw;
+	total->bytes_wire += s->bytes_wire;
+	total->ns += s->ns;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_report
+// Description  : Log the time requests took from being sent to being
+//                answered, by opcode
+//
+// Inputs       : none
+// Outputs      : none
+
+void client_cart_bus_report(void) {
+	char name[CART_TRANSPORT_MAX_URI + 8];
+	CartCodecStats codec_out, codec_in;
+	uint64_t bytes_out = 0, bytes_in = 0;
+	int op, sockets = 0;
+
+	if (cart_bus_batched > 0) {
+		logMessage(LOG_OUTPUT_LEVEL, "CART bus batches: %lu frames moved in runs",
+			(unsigned long)cart_bus_batched);
+	}
+	if (cart_bus_partial > 0) {
+		logMessage(LOG_OUTPUT_LEVEL, "CART bus partial writes: %lu", (unsigned long)cart_bus_partial);
+	}
+	if (trace_file != NULL) {
+		logMessage(LOG_OUTPUT_LEVEL, "CART bus trace: %lu requests recorded to [%s]",
+			(unsigned long)trace_records, cart_network_trace);
+	}
+	for (int i = 0; i < cart_bus_servers; i++) {
+		bus_server *s = &servers[i];
+
+		if (s->transport.type != CART_TRANSPORT_SHM) {
+			bytes_out += s->bytes_out;
+			bytes_in += s->bytes_in;
+			sockets++;
+		}
+		if (cart_bus_servers > 1) {
+			if (s->transport.type == CART_TRANSPORT_TCP) {
+				snprintf(name, sizeof(name), "%s:%u", s->transport.host, s->transport.port);
+			} else {
+				snprintf(name, sizeof(name), "%s", s->transport.path);
+			}
+			logMessage(LOG_OUTPUT_LEVEL, "CART bus server %d [%s]: %lu requests, %lu bytes sent, %lu received",
+				i, name, (unsigned long)s->requests, (unsigned long)s->bytes_out, (unsigned long)s->bytes_in);
+		}
+	}
+	if (sockets > 0) {
+		logMessage(LOG_OUTPUT_LEVEL, "CART bus bytes: %lu sent, %lu received",
+			(unsigned long)bytes_out, (unsigned long)bytes_in);
+	}
+	memset(&codec_out, 0, sizeof(codec_out));
+	memset(&codec_in, 0, sizeof(codec_in));
+	for (int i = 0; i < cart_bus_servers; i++) {
+		codec_add(&codec_out, &servers[i].codec_out);
+		codec_add(&codec_in, &servers[i].codec_in);
+	}
+	cart_codec_report("CART bus", "sent", &codec_out);
+	cart_codec_report("CART bus", "received", &codec_in);
+
+	for (op = 0; op < CART_OP_MAXVAL; op++) {
+		if (bus_lat_count[op] > 0) {
+			logMessage(LOG_OUTPUT_LEVEL, "CART bus latency %s: %lu requests, avg %.1f us, max %.1f us",
+				bus_op_names[op], (unsigned long)bus_lat_count[op],
+				bus_lat_ns[op] / 1e3 / bus_lat_count[op], bus_lat_max[op] / 1e3);
+		}
+	}
+}
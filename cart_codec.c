@@ -0,0 +1,336 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_codec.c
+//  Description    : This is the frame codec for the CART wire protocol, a
+//                   small LZ77 coder in the style of LZ4.  A block is a run
+//                   of sequences, each a token (literal count in the high
+//                   nibble, match length - 4 in the low), more literal count
+//                   bytes when the nibble is 15, the literals, then unless
+//                   the block ends a 2 byte offset and more match length
+//                   bytes when that nibble is 15.
+//
+//  Author         : Jason Jincheng Tu
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <cart_codec.h>
+#include <cart_controller.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CODEC_MIN_MATCH 4
+#define CODEC_HASH_BITS 10
+#define CODEC_MAX_OFFSET 65535
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : codec_hash
+// Description  : hash four bytes for the match table
+//
+// Inputs       : v - the bytes
+// Outputs      : the table slot
+
+static uint32_t codec_hash(uint32_t v) {
+	return( (v * 2654435761U) >> (32 - CODEC_HASH_BITS) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read32
+// Description  : load four bytes from anywhere
+//
+// Inputs       : p - the bytes
+// Outputs      : their value
+
+static uint32_t read32(const char *p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return( v );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_length
+// Description  : write the bytes that extend a length beyond its nibble
+//
+// Inputs       : len - what is left of the length after the nibble
+//                op - where to write, end - the end of the output
+// Outputs      : the next output byte, NULL if out of room
+
+static char *put_length(uint32_t len, char *op, char *end) {
+	while (len >= 255) {
+		if (op >= end) {
+			return( NULL );
+		}
+		*op++ = (char)255;
+		len -= 255;
+	}
+	if (op >= end) {
+		return( NULL );
+	}
+	*op++ = (char)len;
+	return( op );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_sequence
+// Description  : write one sequence, the match is left out for the last
+//
+// Inputs       : lit, nlit - the literals
+//                offset, mlen - the match (mlen 0 for the last sequence)
+//                op - where to write, end - the end of the output
+// Outputs      : the next output byte, NULL if out of room
+
+static char *put_sequence(const char *lit, uint32_t nlit, uint32_t offset, uint32_t mlen,
+		char *op, char *end) {
+	uint32_t mcode = mlen ? mlen - CODEC_MIN_MATCH : 0;
+	char *token = op++;
+
+	if (token >= end) {
+		return( NULL );
+	}
+	*token = (char)(((nlit < 15 ? nlit : 15) << 4) | (mcode < 15 ? mcode : 15));
+	if ( (nlit >= 15) && ((op = put_length(nlit - 15, op, end)) == NULL) ) {
+		return( NULL );
+	}
+	if (op + nlit > end) {
+		return( NULL );
+	}
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	if (mlen == 0) {
+		return( op );
+	}
+	if (op + 2 > end) {
+		return( NULL );
+	}
+	*op++ = (char)(offset & 0xff);
+	*op++ = (char)(offset >> 8);
+	if ( (mcode >= 15) && ((op = put_length(mcode - 15, op, end)) == NULL) ) {
+		return( NULL );
+	}
+	return( op );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_compress
+// Description  : Compress a block of bytes
+//
+// Inputs       : in, n - the bytes (at most 65535)
+//                out, cap - where the compressed bytes go
+// Outputs      : the compressed size, -1 if it does not fit in cap
+
+int cart_compress(const char *in, int n, char *out, int cap) {
+	uint16_t table[1 << CODEC_HASH_BITS];	// position + 1 of the last use of a hash
+	char *op = out, *end = out + cap;
+	int ip = 0, anchor = 0;
+
+	memset(table, 0, sizeof(table));
+	while (ip + CODEC_MIN_MATCH <= n) {
+		uint32_t v = read32(&in[ip]), h = codec_hash(v);
+		int ref = (int)table[h] - 1;
+		table[h] = (uint16_t)(ip + 1);
+
+		if ( (ref < 0) || (ip - ref > CODEC_MAX_OFFSET) || (read32(&in[ref]) != v) ) {
+			ip++;
+			continue;
+		}
+
+		//stretch the match as far as it goes
+		int len = CODEC_MIN_MATCH;
+		while (ip + len < n && in[ref + len] == in[ip + len]) {
+			len++;
+		}
+		if ((op = put_sequence(&in[anchor], ip - anchor, ip - ref, len, op, end)) == NULL) {
+			return( -1 );
+		}
+		ip += len;
+		anchor = ip;
+	}
+
+	if ((op = put_sequence(&in[anchor], n - anchor, 0, 0, op, end)) == NULL) {
+		return( -1 );
+	}
+	return( op - out );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_decompress
+// Description  : Expand a compressed block, checking every length and
+//                offset against the buffers
+//
+// Inputs       : in, n - the compressed bytes
+//                out, cap - where the bytes go
+// Outputs      : the expanded size, -1 if the block is bad
+
+int cart_decompress(const char *in, int n, char *out, int cap) {
+	const unsigned char *ip = (const unsigned char *)in, *iend = ip + n;
+	char *op = out, *end = out + cap;
+	uint32_t len, offset;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		//literals
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip >= iend) {
+					return( -1 );
+				}
+				len += *ip;
+			} while (*ip++ == 255);
+		}
+		if ( (len > (uint32_t)(iend - ip)) || (len > (uint32_t)(end - op)) ) {
+			return( -1 );
+		}
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		if (ip == iend) {
+			break;
+		}
+
+		//the match, which may overlap what it writes
+		if (iend - ip < 2) {
+			return( -1 );
+		}
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		len = (token & 15);
+		if (len == 15) {
+			do {
+				if (ip >= iend) {
+					return( -1 );
+				}
+				len += *ip;
+			} while (*ip++ == 255);
+		}
+		len += CODEC_MIN_MATCH;
+		if ( (offset == 0) || (offset > (uint32_t)(op - out)) || (len > (uint32_t)(end - op)) ) {
+			return( -1 );
+		}
+		const char *match = op - offset;
+		for (uint32_t i = 0; i < len; i++) {
+			op[i] = match[i];
+		}
+		op += len;
+	}
+	return( op - out );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : codec_now
+// Description  : read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : nanoseconds
+
+static uint64_t codec_now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return( (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_codec_encode
+// Description  : Put a frame on the wire, compressed if that makes it
+//                smaller and raw (flagged in the header) otherwise
+//
+// Inputs       : frame - the frame
+//                out - room for CART_CODEC_HEADER + CART_FRAME_SIZE bytes
+//                stats - what the codec did, updated
+// Outputs      : the bytes used in out
+
+size_t cart_codec_encode(const char *frame, char *out, CartCodecStats *stats) {
+	uint64_t start = codec_now();
+	int len = cart_compress(frame, CART_FRAME_SIZE, out + CART_CODEC_HEADER, CART_FRAME_SIZE - 1);
+	uint16_t header;
+
+	if (len < 0) {
+		memcpy(out + CART_CODEC_HEADER, frame, CART_FRAME_SIZE);
+		len = CART_FRAME_SIZE;
+		header = htons(CART_CODEC_RAW | CART_FRAME_SIZE);
+		stats->raw_frames += 1;
+	} else {
+		header = htons((uint16_t)len);
+	}
+	memcpy(out, &header, sizeof(header));
+
+	stats->frames += 1;
+	stats->bytes_raw += CART_FRAME_SIZE;
+	stats->bytes_wire += CART_CODEC_HEADER + len;
+	stats->ns += codec_now() - start;
+	return( CART_CODEC_HEADER + len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_codec_decode
+// Description  : Take a frame off the wire
+//
+// Inputs       : header - the frame header (host order)
+//                in - the header & CART_CODEC_LEN_MASK bytes that followed
+//                frame - where the frame goes
+//                stats - what the codec did, updated
+// Outputs      : 0 if successful, -1 if the frame is bad
+
+int cart_codec_decode(uint16_t header, const char *in, char *frame, CartCodecStats *stats) {
+	uint64_t start = codec_now();
+	int len = header & CART_CODEC_LEN_MASK;
+
+	int ret = 0;
+
+	if (header & CART_CODEC_RAW) {
+		stats->raw_frames += 1;
+		if (len != CART_FRAME_SIZE) {
+			ret = -1;
+		} else {
+			memcpy(frame, in, CART_FRAME_SIZE);
+		}
+	} else if (cart_decompress(in, len, frame, CART_FRAME_SIZE) != CART_FRAME_SIZE) {
+		ret = -1;
+	}
+
+	stats->frames += 1;
+	stats->bytes_raw += CART_FRAME_SIZE;
+	stats->bytes_wire += CART_CODEC_HEADER + len;
+	stats->ns += codec_now() - start;
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_codec_report
+// Description  : Log what the codec did
+//
+// Inputs       : who - the side reporting, dir - "sent" or "received"
+//                stats - the counts
+// Outputs      : none
+
+void cart_codec_report(const char *who, const char *dir, CartCodecStats *stats) {
+	if (stats->frames == 0) {
+		return;
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "%s compression %s: %lu frames (%lu raw), %lu bytes as %lu (%.1f%%), %.1f us/frame",
+		who, dir, (unsigned long)stats->frames, (unsigned long)stats->raw_frames,
+		(unsigned long)stats->bytes_raw, (unsigned long)stats->bytes_wire,
+		100.0 * stats->bytes_wire / stats->bytes_raw, stats->ns / 1e3 / stats->frames);
+}
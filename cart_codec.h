@@ -0,0 +1,51 @@
+#ifndef CART_CODEC_INCLUDED
+#define CART_CODEC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_codec.h
+//  Description    : This is the header file for the frame codec used to
+//                   compress frames on the wire between the client and a
+//                   server that agreed to it.
+//
+//  Author         : Jason Jincheng Tu
+//  Last Modified  : 10/18/2026
+//
+
+// Include files
+#include <stdint.h>
+#include <stddef.h>
+
+// Defines
+#define CART_CODEC_HEADER 2        // Bytes in front of every frame on the wire
+#define CART_CODEC_RAW 0x8000      // Header flag, the frame follows as is
+#define CART_CODEC_LEN_MASK 0x7fff // Header bytes that follow
+
+// What the codec did, for the reports
+typedef struct {
+	uint64_t frames;       // frames encoded or decoded
+	uint64_t raw_frames;   // of which went raw
+	uint64_t bytes_raw;    // frame bytes before encoding / after decoding
+	uint64_t bytes_wire;   // bytes on the wire, headers included
+	uint64_t ns;           // time spent in the codec
+} CartCodecStats;
+
+//
+// Functional Prototypes
+
+int cart_compress(const char *in, int n, char *out, int cap);
+	// Compress n bytes, returns the size or -1 if it would not fit in cap
+
+int cart_decompress(const char *in, int n, char *out, int cap);
+	// Expand n compressed bytes, returns the size or -1 if they are bad
+
+size_t cart_codec_encode(const char *frame, char *out, CartCodecStats *stats);
+	// Put a frame on the wire (header then data), returns the bytes used
+
+int cart_codec_decode(uint16_t header, const char *in, char *frame, CartCodecStats *stats);
+	// Take a frame off the wire given its header, 0 if successful
+
+void cart_codec_report(const char *who, const char *dir, CartCodecStats *stats);
+	// Log what the codec did
+
+#endif
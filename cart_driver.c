@@ -12,6 +12,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 // Project Includes
 #include <cart_driver.h>
@@ -23,75 +26,334 @@
 //
 // Implementation
 
+// Defines
+#define FRAME_REF(c, f) (((uint32_t)(c) << 16) | (f))	// pack a cartridge/frame pair
+#define REF_CART(r) ((uint16_t)((r) >> 16))
+#define REF_FRAME(r) ((uint16_t)((r) & 0xffff))
+#define CART_NO_FRAME 0xffffffff	// no frame to be had
+#define CART_FRAME_SHARED -1		// owner of a frame that is or was shared
+
+// Log-structured layout, the cartridges are cut into segments that are
+// written front to back and only reused once the cleaner has emptied them
+#define CART_LFS_SEGMENT_FRAMES 64	// frames in a segment
+#define CART_LFS_SEGS_PER_CART (CART_CARTRIDGE_SIZE / CART_LFS_SEGMENT_FRAMES)
+#define CART_LFS_SEGMENTS (cart_bus_cartridges * CART_LFS_SEGS_PER_CART)	// on the servers connected
+#define CART_LFS_MAX_SEGMENTS (CART_BUS_MAX_CARTRIDGES * CART_LFS_SEGS_PER_CART)
+#define CART_LFS_LOW_WATER 32		// the cleaner runs below this many clean segments
+#define CART_LFS_RESERVE 2			// clean segments only the cleaner may open
+#define CART_DEFRAG_BATCH 16		// frames moved between looks at the foreground
+#define CART_DEFRAG_PAUSE_US 2000	// back off this long when the foreground is busy
+#define CART_PREFETCH_FRAMES 32		// most frames a read brings in ahead of time
+#define CART_PREFETCH_MAX_FRAMES 256	// ... for a striped file, a stripe at a time
+#define CART_MIGRATE_INTERVAL_MS 100	// how often the migrator looks at the heat
+#define CART_MIGRATE_MIN_OPS 64		// foreground calls needed for a new round
+#define REF_SEGMENT(r) (REF_CART(r) * CART_LFS_SEGS_PER_CART + REF_FRAME(r) / CART_LFS_SEGMENT_FRAMES)
+
+// the states of a segment
+typedef enum {
+	CART_SEG_CLEAN = 0,	// no live frames, free to be opened
+	CART_SEG_OPEN  = 1,	// the head of the log
+	CART_SEG_USED  = 2,	// written, waiting for the cleaner
+} CartSegmentState;
+
 //declare all the variable used in the drive
 
+// a run of frames held by a reader or writer of a file
+typedef struct range{
+	struct range *next;
+	uint32_t first;		// first frame (in file order)
+	uint32_t last;		// last frame (in file order)
+	int exclusive;		// writers exclude everybody, readers only writers
+} range;
+
 // for file mapping between a file handle and corresponding frame.
 struct File{
-	int position;
-	uint16_t Cartridge;
-	uint16_t Frame;
-	int ending_position;
-	uint16_t ending_cartridge;
-	uint16_t ending_frame;
+	uint32_t position;	// the file cursor, bytes from the start of the file
+	uint32_t length;	// bytes in the file
+	uint32_t nframes;	// frames given to the file
+	uint32_t capacity;	// room in the frames array
+	uint32_t *frames;	// the frames of the file in order, see FRAME_REF
 	char fileName[CART_MAX_PATH_LENGTH];
+	uint32_t heat;		// recent calls on the file, halved every migrator round
+	int hot;			// 1 + the hot cartridge the file belongs on, 0 if it is cold
+	int readonly;		// a snapshot, writes are refused
+	uint16_t stripe_width;	// servers the file is striped over, 0 if it is not
+	uint16_t stripe_unit;	// frames in a stripe unit
+	uint16_t stripe_base;	// server of the first stripe unit
+
+	pthread_rwlock_t layout;	// frames/nframes, written only to add or drop frames
+	pthread_mutex_t cursor;		// held across a cart_read/cart_write/cart_seek
+	pthread_mutex_t lock;		// length and the range list
+	pthread_cond_t range_free;	// a range was released
+	range *ranges;				// ranges currently held
 } FileList[CART_MAX_TOTAL_FILES];
 
-//buffer for read and write function
-char buffer[1024];
+//write every frame to the bus as it changes, otherwise hold it in the cache
+int write_through = 1;
+
+//files waiting on the next group commit, and a request to flush everything
+uint8_t sync_pending[CART_MAX_TOTAL_FILES];
+int sync_all_pending = 0;
+
+//group commit state, a commit is started by whoever finds none running
+pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t sync_done = PTHREAD_COND_INITIALIZER;
+uint64_t sync_started = 0;		// commits started
+uint64_t sync_finished = 0;		// commits finished
+int sync_running = 0;
+
+//a thread waiting on a commit, the leader tells it how the commit went
+typedef struct sync_waiter{
+	uint64_t target;			// the commit that picks it up
+	int failed;					// set if that commit failed
+	struct sync_waiter *next;
+} sync_waiter;
+sync_waiter *sync_waiters = NULL;
+
+//the file table and the cartridge map
+pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+int locks_ready = 0;
+
+//cartridge (local to its server) each server's part of the current flush
+//batch is ordered from
+static uint16_t flush_base[CART_MAX_SERVERS];
+
+//for every frame in use, where it sits in its file (owner is in CartridgeMap)
+uint32_t FrameIndex[CART_BUS_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE];
+
+//files holding a frame besides the first, frames are shared by clones and
+//snapshots until one of the holders writes them
+uint16_t FrameShares[CART_BUS_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE];
+uint64_t clone_frames_shared;	// frames handed out by cart_clone/cart_snapshot
+uint64_t clone_frames_copied;	// frames copied on a write
+
+//log-structured layout, the tables and the log head are under alloc_lock
+int log_structured = 0;
+uint8_t seg_state[CART_LFS_MAX_SEGMENTS];
+uint16_t seg_live[CART_LFS_MAX_SEGMENTS];	// live frames in each segment
+uint32_t clean_segments;
+int32_t log_seg = -1;		// the open segment
+uint32_t log_next;			// next frame in the open segment
+pthread_mutex_t clean_lock = PTHREAD_MUTEX_INITIALIZER;	// one cleaning at a time
+pthread_cond_t cleaner_wake = PTHREAD_COND_INITIALIZER;
+pthread_t cleaner_thread;
+int cleaner_running = 0;
+
+//log statistics
+uint64_t lfs_user_frames;		// frames written for callers
+uint64_t lfs_cleaner_frames;	// frames copied by the cleaner
+uint64_t lfs_segments_cleaned;
+uint64_t lfs_cleaner_ns;		// time spent cleaning
+
+//defragmentation, and the foreground I/O it stays out of the way of
+_Atomic uint64_t foreground_ops = 0;	// cart_pread/cart_pwrite calls
+uint64_t defrag_frames_moved;
+uint64_t defrag_runs;
+
+//hot/cold placement, the first hot_cartridges cartridges hold the hot files
+uint16_t hot_cartridges = 0;
+uint32_t migrate_heat[CART_MAX_TOTAL_FILES];	// heat as seen by the current round
+pthread_mutex_t migrate_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t migrate_wake = PTHREAD_COND_INITIALIZER;
+pthread_t migrator_thread;
+int migrator_running = 0;
+uint64_t migrate_frames_moved;
+uint64_t migrate_rounds;
+uint64_t bus_ops_base[CART_OP_MAXVAL];	// bus counts at the last report reset
+uint64_t foreground_base;
+
+//
+// Functional Prototypes
+
+void writing(uint16_t cart, uint16_t frm, char *buf);
+int free_frame(uint32_t ref);
+uint32_t reserve_frame(int16_t fd, int first, int last);
+int log_clean(int16_t held);
+int log_store(int16_t fd, uint32_t idx, char *data, int cleaner);
+void stop_migrator(void);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_ok
+// Description  : check a file handle refers to an open file
+//
+// Inputs       : fd - the file handle
+// Outputs      : 1 if the file is open, 0 otherwise
+
+int file_ok(int16_t fd){
+	return (fd > 0 && fd < CART_MAX_TOTAL_FILES && FileList[fd].fileName[0] != '\0');
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stripe_frame
+// Description  : take the next frame of a striped file on the server of its
+//                stripe unit, right after the frame before it in the same
+//                column so each unit is a run on one cartridge.  The caller
+//                holds alloc_lock.
+//
+// Inputs       : fd - the file
+// Outputs      : the frame (see FRAME_REF), CART_NO_FRAME if that server is full
+
+uint32_t stripe_frame(int16_t fd){
+	struct File *f = &FileList[fd];
+	uint32_t i = f->nframes, unit = f->stripe_unit, width = f->stripe_width;
+	uint32_t span = (cart_bus_cartridges / cart_bus_servers) * CART_CARTRIDGE_SIZE, first = 0, prev = CART_NO_FRAME;
+	int server = (f->stripe_base + (i / unit) % width) % cart_bus_servers;
+
+	//the same unit, or the last frame of this column's previous unit
+	if (i % unit != 0){
+		prev = f->frames[i - 1];
+	} else if (i >= width * unit){
+		prev = f->frames[i - (width - 1) * unit - 1];
+	}
+	if (prev != CART_NO_FRAME && CART_BUS_SERVER(REF_CART(prev)) == server){
+		first = CART_BUS_LOCAL(REF_CART(prev)) * CART_CARTRIDGE_SIZE + REF_FRAME(prev) + 1;
+	}
+
+	//first fit over the cartridges of the server only
+	for (uint32_t n = 0; n < span; n++){
+		uint32_t slot = (first + n) % span;
+		int c = CART_BUS_CART(server, slot / CART_CARTRIDGE_SIZE);
+		int j = slot % CART_CARTRIDGE_SIZE;
+		if (CartridgeMap[c][j] == 0){
+			CartridgeMap[c][j] = fd;
+			return (FRAME_REF(c, j));
+		}
+	}
+	return (CART_NO_FRAME);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : locate_empty_frame
-// Description  : get a new empty frame for a file
+// Description  : get a new empty frame for a file and add it to the end of
+//                the file, the caller holds the layout lock for writing.
+//                With hot/cold placement the file's own side is tried first.
 //
 // Inputs       : file id
 // Outputs      : 0 if successful, 1 if failure
 
 int locate_empty_frame(uint16_t fd){
-	for (int i = FileList[fd].ending_cartridge; i < CART_MAX_CARTRIDGES; i++){
-		for (int j = FileList[fd].ending_frame+1; j < CART_CARTRIDGE_SIZE; j++){
+	struct File *f = &FileList[fd];
+	uint32_t start = 0, lo = 0, hi = cart_bus_cartridges * CART_CARTRIDGE_SIZE;
+
+	//make room in the frame list
+	if (f->nframes == f->capacity){
+		uint32_t cap = (f->capacity == 0) ? 16 : f->capacity * 2;
+		uint32_t *frames = realloc(f->frames, cap * sizeof(uint32_t));
+		if (frames == NULL){
+			return (1);
+		}
+		f->frames = frames;
+		f->capacity = cap;
+	}
+
+	//first fit, starting right after the last frame of the file
+	if (f->nframes > 0){
+		uint32_t last = f->frames[f->nframes - 1];
+		start = REF_CART(last) * CART_CARTRIDGE_SIZE + REF_FRAME(last) + 1;
+	}
+
+	//hot files live on their hot cartridge, the rest stay off them
+	if (hot_cartridges > 0){
+		if (f->hot){
+			lo = (f->hot - 1) * CART_CARTRIDGE_SIZE;
+			hi = f->hot * CART_CARTRIDGE_SIZE;
+		} else {
+			lo = hot_cartridges * CART_CARTRIDGE_SIZE;
+		}
+	}
+
+	pthread_mutex_lock(&alloc_lock);
+	if (f->stripe_width > 1){
+		uint32_t ref = stripe_frame(fd);
+		if (ref != CART_NO_FRAME){
+			FrameIndex[REF_CART(ref)][REF_FRAME(ref)] = f->nframes;
+			pthread_mutex_unlock(&alloc_lock);
+			f->frames[f->nframes++] = ref;
+			return (0);
+		}
+	}
+	for (int pass = 0; pass < 2; pass++){
+		uint32_t span = hi - lo;
+		uint32_t first = (start >= lo && start < hi) ? start - lo : 0;
+
+		for (uint32_t n = 0; n < span; n++){
+			uint32_t slot = lo + (first + n) % span;
+			int i = slot / CART_CARTRIDGE_SIZE;
+			int j = slot % CART_CARTRIDGE_SIZE;
 			if (CartridgeMap[i][j] == 0){
 				CartridgeMap[i][j] = fd;
-				FileList[fd].Cartridge = i;
-				FileList[fd].Frame = j;
-				FileList[fd].position = 0;
-				FileList[fd].ending_position = 0;
-				FileList[fd].ending_cartridge = i;
-				FileList[fd].ending_frame = j;
+				FrameIndex[i][j] = f->nframes;
+				pthread_mutex_unlock(&alloc_lock);
+				f->frames[f->nframes++] = FRAME_REF(i, j);
 				return (0);	//return successful
 			}
 		}
-		FileList[fd].ending_frame = 0;
+
+		//our side is full, anywhere will do (the migrator sorts it out)
+		lo = 0;
+		hi = cart_bus_cartridges * CART_CARTRIDGE_SIZE;
 	}
+	pthread_mutex_unlock(&alloc_lock);
 	return (1);//return fail
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : find_next_frame
-// Description  : find the next frame that belongs to a file
+// Function     : range_lock
+// Description  : wait until no conflicting range of the file is held, then
+//                hold the frames first to last
 //
-// Inputs       : file id
-// Outputs      : 0 if successful, -1 if failure, 1 if it is already the end of the file
+// Inputs       : fd - the file, r - the range to hold (filled in here)
+//                first, last - the frames, exclusive - 1 for writers
+// Outputs      : none
 
-//for locate the next frame for this file, return 1 if this is the last frame, return 0 if it is find, return -1 for error
+void range_lock(int16_t fd, range *r, uint32_t first, uint32_t last, int exclusive){
+	struct File *f = &FileList[fd];
+	range *held;
 
-int find_next_frame(int16_t fd){
-	if(FileList[fd].Cartridge == FileList[fd].ending_cartridge && FileList[fd].Frame == FileList[fd].ending_frame){
-		return(1);
-	}
-	for (int i = FileList[fd].Cartridge; i < CART_MAX_CARTRIDGES; i++){
-		for (int j = FileList[fd].Frame+1; j < CART_CARTRIDGE_SIZE; j++){
-			if (CartridgeMap[i][j] == fd){
-				FileList[fd].Cartridge = i;
-				FileList[fd].Frame = j;
-				FileList[fd].position = 0;
-				return(0);
+	r->first = first;
+	r->last = last;
+	r->exclusive = exclusive;
+
+	pthread_mutex_lock(&f->lock);
+	do {
+		for (held = f->ranges; held != NULL; held = held->next){
+			if (held->first <= last && first <= held->last && (exclusive || held->exclusive)){
+				pthread_cond_wait(&f->range_free, &f->lock);
+				break;
 			}
 		}
-		FileList[fd].Frame = 0;
+	} while (held != NULL);
+	r->next = f->ranges;
+	f->ranges = r;
+	pthread_mutex_unlock(&f->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : range_unlock
+// Description  : give up a range held with range_lock
+//
+// Inputs       : fd - the file, r - the range
+// Outputs      : none
+
+void range_unlock(int16_t fd, range *r){
+	struct File *f = &FileList[fd];
+	range **link;
+
+	pthread_mutex_lock(&f->lock);
+	for (link = &f->ranges; *link != NULL; link = &(*link)->next){
+		if (*link == r){
+			*link = r->next;
+			break;
+		}
 	}
-	return(-1);
+	pthread_cond_broadcast(&f->range_free);
+	pthread_mutex_unlock(&f->lock);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -104,42 +366,73 @@ int find_next_frame(int16_t fd){
 
 int32_t cart_poweron(void) {
 
+	//set the connection up here, not on the first request
+	if (client_cart_bus_connect() == -1){
+		logMessage(LOG_ERROR_LEVEL, "CART driver: cannot reach the CART server.");
+		return (-1);
+	}
+
+	//a proxy may turn the client away, or give it fewer cartridges
 	CartXferRegister cart = make_cart(CART_OP_INITMS,0,0,0);
-	client_cart_bus_request(cart, NULL);
+	if ((client_cart_bus_request(cart, NULL) >> 47) & 1){
+		logMessage(LOG_ERROR_LEVEL, "CART driver: the server refused to power on.");
+		return (-1);
+	}
 
 	uint16_t Cartriage = 0;
-	
-	//load and bzero all the cartridge
-	while(Cartriage < 64){
-		
+
+	//load and bzero all the cartridge, pipelined so it costs one round trip
+	while(Cartriage < cart_bus_cartridges){
+
 		cart = make_cart(CART_OP_LDCART,0,Cartriage,0);
-		client_cart_bus_request(cart, NULL);
+		client_cart_bus_submit(cart, NULL);
 
 		cart = make_cart(CART_OP_BZERO,0,Cartriage,0);
-		client_cart_bus_request(cart, NULL);
+		client_cart_bus_submit(cart, NULL);
 
 		Cartriage++;
 	}
-	
+	if (client_cart_bus_flush() != 0){
+		logMessage(LOG_ERROR_LEVEL, "CART driver: failed to zero the cartridges.");
+		return (-1);
+	}
+
+	//the locks live for the life of the process
+	if (!locks_ready){
+		for(int i=0;i<CART_MAX_TOTAL_FILES;i++){
+			pthread_rwlock_init(&FileList[i].layout, NULL);
+			pthread_mutex_init(&FileList[i].cursor, NULL);
+			pthread_mutex_init(&FileList[i].lock, NULL);
+			pthread_cond_init(&FileList[i].range_free, NULL);
+		}
+		locks_ready = 1;
+	}
+
 	strncpy(FileList[0].fileName,"Reserved", 10);//the first spot in file map is reserved for programming purpose
 
-	//initial the file map	
-	for(int i=1;i<1024;i++){
+	//initial the file map
+	for(int i=1;i<CART_MAX_TOTAL_FILES;i++){
 		FileList[i].fileName[0]='\0';
+		FileList[i].frames = NULL;
+		FileList[i].nframes = 0;
+		FileList[i].capacity = 0;
+		FileList[i].ranges = NULL;
 	}
 
 	//initial the cartridge map
-	for (int i = 0; i < CART_MAX_CARTRIDGES; i++){
+	for (int i = 0; i < CART_BUS_MAX_CARTRIDGES; i++){
 		for (int j = 0; j < CART_CARTRIDGE_SIZE; j++){
 			CartridgeMap[i][j] = 0;
+			FrameShares[i][j] = 0;
 		}
 	}
 
 	//initial cache
 	init_cart_cache();
 
-	//initial socket
-	client_socket = -1;
+	//the statistics count from here
+	memcpy(bus_ops_base, cart_bus_ops, sizeof(bus_ops_base));
+	foreground_base = atomic_load(&foreground_ops);
 
 	// Return successfully
 	return(0);
@@ -154,18 +447,39 @@ int32_t cart_poweron(void) {
 // Outputs      : 0 if successful
 
 int32_t cart_poweroff(void) {
+	//nothing buffered may be lost on the way down
+	stop_migrator();
+	cart_sync();
+	cart_report_stats();
+	hot_cartridges = 0;
+
+	//stop the log cleaner
+	if (log_structured){
+		pthread_mutex_lock(&alloc_lock);
+		cleaner_running = 0;
+		pthread_cond_signal(&cleaner_wake);
+		pthread_mutex_unlock(&alloc_lock);
+		pthread_join(cleaner_thread, NULL);
+		log_structured = 0;
+	}
+
 	//close cache
 	close_cart_cache();
 
 	//clean the filelist
-	for(int i = 0; i < 20; i++){
+	for(int i = 1; i < CART_MAX_TOTAL_FILES; i++){
 		FileList[i].fileName[0] = '\0';
+		free(FileList[i].frames);
+		FileList[i].frames = NULL;
+		FileList[i].nframes = 0;
+		FileList[i].capacity = 0;
 	}
 
 	//clean the mapping
-	for(int c = 0; c < 64; c++){
+	for(int c = 0; c < CART_BUS_MAX_CARTRIDGES; c++){
 		for(int f = 0; f<1024;f++){
 			CartridgeMap[c][f] = 0;
+			FrameShares[c][f] = 0;
 		}
 	}
 
@@ -182,20 +496,31 @@ int32_t cart_poweroff(void) {
 // Description  : This function opens the file and returns a file handle
 //
 // Inputs       : path - filename of the file to open
-// Outputs      : file handle
+// Outputs      : file handle, -1 if the file table is full
 
 int16_t cart_open(char *path) {
-	int16_t i=0;
-	while(FileList[i].fileName[0] != '\0'){
-		i++;	
-	}
-	
-	strncpy(FileList[i].fileName, path, 128);
-	
-	FileList[i].ending_cartridge = 0;
-	FileList[i].ending_frame = 0;
-	locate_empty_frame(i);
-	
+	int16_t i=1;
+
+	pthread_mutex_lock(&files_lock);
+	while(i < CART_MAX_TOTAL_FILES && FileList[i].fileName[0] != '\0'){
+		i++;
+	}
+	if (i == CART_MAX_TOTAL_FILES){
+		pthread_mutex_unlock(&files_lock);
+		return (-1);
+	}
+
+	strncpy(FileList[i].fileName, path, CART_MAX_PATH_LENGTH - 1);
+	FileList[i].fileName[CART_MAX_PATH_LENGTH - 1] = '\0';
+	FileList[i].position = 0;
+	FileList[i].length = 0;
+	FileList[i].nframes = 0;
+	FileList[i].heat = 0;
+	FileList[i].hot = 1;	//new data starts out hot
+	FileList[i].readonly = 0;
+	FileList[i].stripe_width = 0;
+	pthread_mutex_unlock(&files_lock);
+
 	//RETURN A FILE HANDLE
 	return (i);
 }
@@ -210,15 +535,28 @@ int16_t cart_open(char *path) {
 
 int16_t cart_close(int16_t fd) {
 
-	FileList[fd].fileName[0] = '\0';
+	if (!file_ok(fd)){
+		return (-1);
+	}
 
-	for(int c = 0; c < 64; c++){
-		for(int f = 0; f<1024;f++){
-			if (CartridgeMap[c][f] == fd){
-				CartridgeMap[c][f] = 0;
-			}
-		}
+	//the frames are given up below, so write them out while we still own them
+	cart_fsync(fd);
+
+	pthread_rwlock_wrlock(&FileList[fd].layout);
+	pthread_mutex_lock(&alloc_lock);
+	for (uint32_t i = 0; i < FileList[fd].nframes; i++){
+		free_frame(FileList[fd].frames[i]);
 	}
+	pthread_mutex_unlock(&alloc_lock);
+	free(FileList[fd].frames);
+	FileList[fd].frames = NULL;
+	FileList[fd].nframes = 0;
+	FileList[fd].capacity = 0;
+	pthread_rwlock_unlock(&FileList[fd].layout);
+
+	pthread_mutex_lock(&files_lock);
+	FileList[fd].fileName[0] = '\0';
+	pthread_mutex_unlock(&files_lock);
 
 	// Return successfully
 	return (0);
@@ -226,203 +564,2019 @@ int16_t cart_close(int16_t fd) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : reading
-// Description  : use to call cache for data
+// Function     : clone_file
+// Description  : make a new file sharing every frame of another one, no
+//                frame is read or written
+//
+// Inputs       : src - the file to clone, path - the name of the new file
+//                readonly - refuse writes to the new file
+// Outputs      : the new file handle, -1 if failure
+
+int16_t clone_file(int16_t src, char *path, int readonly){
+	struct File *f = &FileList[src], *c;
+	int16_t fd;
+
+	if (!file_ok(src) || (fd = cart_open(path)) == -1){
+		return (-1);
+	}
+	c = &FileList[fd];
+
+	//the layout lock keeps writers out, so the clone is one point in time
+	pthread_rwlock_wrlock(&f->layout);
+	c->frames = malloc((f->nframes > 0 ? f->nframes : 1) * sizeof(uint32_t));
+	if (c->frames == NULL){
+		pthread_rwlock_unlock(&f->layout);
+		cart_close(fd);
+		return (-1);
+	}
+	memcpy(c->frames, f->frames, f->nframes * sizeof(uint32_t));
+	c->capacity = (f->nframes > 0) ? f->nframes : 1;
+
+	pthread_mutex_lock(&alloc_lock);
+	for (uint32_t i = 0; i < f->nframes; i++){
+		uint32_t ref = f->frames[i];
+		FrameShares[REF_CART(ref)][REF_FRAME(ref)] += 1;
+		CartridgeMap[REF_CART(ref)][REF_FRAME(ref)] = CART_FRAME_SHARED;
+	}
+	clone_frames_shared += f->nframes;
+	pthread_mutex_unlock(&alloc_lock);
+	c->nframes = f->nframes;
+
+	pthread_mutex_lock(&f->lock);
+	c->length = f->length;
+	pthread_mutex_unlock(&f->lock);
+	c->hot = f->hot;
+	c->readonly = readonly;
+	c->stripe_width = f->stripe_width;
+	c->stripe_unit = f->stripe_unit;
+	c->stripe_base = f->stripe_base;
+	pthread_rwlock_unlock(&f->layout);
+
+	return (fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_clone
+// Description  : Copy a file by sharing its frames, each frame is only
+//                copied when one of the files writes it
+//
+// Inputs       : src - the file to copy, path - the name of the copy
+// Outputs      : file handle of the copy, -1 if failure
+
+int16_t cart_clone(int16_t src, char *path) {
+	return (clone_file(src, path, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_snapshot
+// Description  : Take a read-only point-in-time copy of a file, sharing its
+//                frames like cart_clone
+//
+// Inputs       : src - the file, path - the name of the snapshot
+// Outputs      : file handle of the snapshot, -1 if failure
+
+int16_t cart_snapshot(int16_t src, char *path) {
+	return (clone_file(src, path, 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writing
+// Description  : write the data in cache and the io bus
 //
-// Inputs       : file id and buf for the data
+// Inputs       : cart, frm - the frame to write
+//                buf - pointer to buffer to write from
 // Outputs      : none
 
-void reading(int16_t fd, char *buf){
-	
-	char *b = (char *) get_cart_cache(FileList[fd].Cartridge,FileList[fd].Frame);
-	memcpy(buf, b, 1024);
+void writing(uint16_t cart, uint16_t frm, char *buf){
+	//buffered mode, the frame goes to the bus at the next sync or eviction
+	if (!write_through && dirty_cart_cache(cart, frm, buf) == 0){
+		return;
+	}
+
+	writes(cart, frm, buf);
+
+	put_cart_cache(cart, frm, buf);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_read
-// Description  : Reads "count" bytes from the file handle "fd" into the 
-//                buffer "buf"
+// Function     : free_frame
+// Description  : give a frame back, the caller holds alloc_lock.  A shared
+//                frame only loses a holder.
 //
-// Inputs       : fd - filename of the file to read from
-//                buf - pointer to buffer to read into
-//                count - number of bytes to read
-// Outputs      : bytes read
+// Inputs       : ref - the frame (see FRAME_REF)
+// Outputs      : 1 if the frame is free now, 0 if others still hold it
 
-int32_t cart_read(int16_t fd, void *buf, int32_t count) {
-	int32_t bits_read = 0;
-	int32_t temp;
+int free_frame(uint32_t ref){
+	if (FrameShares[REF_CART(ref)][REF_FRAME(ref)] > 0){
+		FrameShares[REF_CART(ref)][REF_FRAME(ref)] -= 1;
+		return (0);
+	}
 
-	if (FileList[fd].fileName[0] == '\0'){
-		return (-1);
+	CartridgeMap[REF_CART(ref)][REF_FRAME(ref)] = 0;
+	if (log_structured){
+		seg_live[REF_SEGMENT(ref)] -= 1;
 	}
+	return (1);
+}
 
-	//loop through the file
-	while(bits_read != count){
-		temp = count - bits_read;
-
-		//not enough bit in the file to read
-		if (FileList[fd].Cartridge == FileList[fd].ending_cartridge 
-		&& FileList[fd].Frame == FileList[fd].ending_frame 
-		&& temp > (FileList[fd].ending_position - FileList[fd].position)){
-			temp = FileList[fd].ending_position - FileList[fd].position;
-			reading(fd, buffer);
-			memcpy(&((char *)buf)[bits_read], &buffer[FileList[fd].position], temp);
-			bits_read += temp;
-			FileList[fd].position += temp;
-			return (bits_read);
-		}
-
-		//read from the middle of the file
-		if (FileList[fd].position != 0){
-			temp = 1024 - FileList[fd].position;
-
-			//on the first time, it does not read to the end of frame
-			if (count < (1024 - FileList[fd].position)){
-				temp = count;
-			}
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clean_segment
+// Description  : find a clean segment, looking from the first one of a
+//                cartridge on, called with alloc_lock held
+//
+// Inputs       : cart - the cartridge to start at (0 if out of range)
+//                span - the number of segments to look at
+// Outputs      : the segment, -1 if there is none
 
-		//keep it within a frame
-		if (temp > 1024){			
-			temp = 1024;
+int32_t clean_segment(int16_t cart, int span){
+	uint32_t first = (cart >= 0 && cart < cart_bus_cartridges) ? cart * CART_LFS_SEGS_PER_CART : 0;
+
+	for (int n = 0; n < span; n++){
+		int s = (first + n) % CART_LFS_SEGMENTS;
+		if (seg_state[s] == CART_SEG_CLEAN){
+			return (s);
 		}
+	}
+	return (-1);
+}
 
-		reading(fd, buffer);
-		memcpy(&((char *)buf)[bits_read], &buffer[FileList[fd].position], temp);
-		bits_read += temp;
-		FileList[fd].position += temp;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_append
+// Description  : take the next frame at the head of the log, opening a new
+//                segment when the current one is full.  New segments come
+//                from a cartridge one of the servers has loaded whenever
+//                there is a clean one.
+//
+// Inputs       : fd, idx - the file and the frame of the file to be stored
+//                cleaner - the cleaner may dig into the reserved segments
+// Outputs      : the frame (see FRAME_REF), CART_NO_FRAME if the log is full
+
+uint32_t log_append(int16_t fd, uint32_t idx, int cleaner){
+	uint32_t ref;
 
-		//if the frame is full, find a new frame in this file
-		if (FileList[fd].position == 1024){
-			if (find_next_frame(fd)==1){
-				return (bits_read);
+	pthread_mutex_lock(&alloc_lock);
+	if (log_seg < 0 || log_next == CART_LFS_SEGMENT_FRAMES){
+		int32_t seg = -1;
+
+		if (clean_segments > CART_LFS_RESERVE || (cleaner && clean_segments > 0)){
+			//the loaded cartridges first, then the ones after the first
+			for (int i = 0; i < cart_bus_servers && seg < 0; i++){
+				seg = clean_segment(current_Cartridge[i], CART_LFS_SEGS_PER_CART);
+			}
+			if (seg < 0){
+				seg = clean_segment(current_Cartridge[0], CART_LFS_SEGMENTS);
 			}
-		}		
+		}
+		if (seg < 0){
+			pthread_mutex_unlock(&alloc_lock);
+			pthread_cond_signal(&cleaner_wake);
+			return (CART_NO_FRAME);
+		}
+
+		if (log_seg >= 0){
+			seg_state[log_seg] = CART_SEG_USED;
+		}
+		seg_state[seg] = CART_SEG_OPEN;
+		clean_segments -= 1;
+		log_seg = seg;
+		log_next = 0;
 	}
 
-	// Return bits read
-	return (bits_read);
+	ref = FRAME_REF(log_seg / CART_LFS_SEGS_PER_CART,
+		(log_seg % CART_LFS_SEGS_PER_CART) * CART_LFS_SEGMENT_FRAMES + log_next);
+	log_next += 1;
+	CartridgeMap[REF_CART(ref)][REF_FRAME(ref)] = fd;
+	FrameIndex[REF_CART(ref)][REF_FRAME(ref)] = idx;
+	seg_live[log_seg] += 1;
+	if (clean_segments < CART_LFS_LOW_WATER){
+		pthread_cond_signal(&cleaner_wake);
+	}
+	pthread_mutex_unlock(&alloc_lock);
+
+	return (ref);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : writing
-// Description  : write the data in cache and the io bus
+// Function     : log_flush_segment
+// Description  : write the frames of a segment still held in the cache to
+//                the bus, in one pass over its cartridge
 //
-// Inputs       : fd - filename of the file to write to
-//                buf - pointer to buffer to write from
+// Inputs       : seg - the segment
 // Outputs      : none
 
-void writing(int16_t fd, char *buf){	
-	CartXferRegister c;
-	//check to make sure that the correct cartridge is loaded
-	if (FileList[fd].Cartridge != current_Cartridge){	
-		c = make_cart(CART_OP_LDCART, 0, FileList[fd].Cartridge,FileList[fd].Frame);
-		client_cart_bus_request(c, buf);
-		current_Cartridge = FileList[fd].Cartridge;
+void log_flush_segment(int32_t seg){
+	CartridgeIndex carts[CART_LFS_SEGMENT_FRAMES];
+	CartFrameIndex frms[CART_LFS_SEGMENT_FRAMES];
+
+	for (uint32_t k = 0; k < CART_LFS_SEGMENT_FRAMES; k++){
+		carts[k] = seg / CART_LFS_SEGS_PER_CART;
+		frms[k] = (seg % CART_LFS_SEGS_PER_CART) * CART_LFS_SEGMENT_FRAMES + k;
+	}
+	flush_list_cart_cache(carts, frms, CART_LFS_SEGMENT_FRAMES);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_store
+// Description  : write one frame of a file at the head of the log and point
+//                the file at it, the old copy (if any) becomes dead.  The
+//                caller holds the layout lock of the file for writing.
+//
+// Inputs       : fd, idx - the file and the frame of the file
+//                data - the new contents of the frame
+//                cleaner - called by the cleaner
+// Outputs      : 0 if successful, -1 if the log is full
+
+int log_store(int16_t fd, uint32_t idx, char *data, int cleaner){
+	struct File *f = &FileList[fd];
+	uint32_t ref = log_append(fd, idx, cleaner);
+
+	//out of clean segments, clean one ourselves and try again
+	for (int tries = 0; ref == CART_NO_FRAME && !cleaner && tries < CART_LFS_SEGMENTS; tries++){
+		if (log_clean(fd) == 0){
+			break;
+		}
+		ref = log_append(fd, idx, cleaner);
+	}
+	if (ref == CART_NO_FRAME){
+		return (-1);
+	}
+
+	//in write-through mode the head is held back in the cache and written a
+	//segment at a time, so the writes do not load the head's cartridge
+	//between every read of an old frame
+	if (!write_through || dirty_cart_cache(REF_CART(ref), REF_FRAME(ref), data) != 0){
+		writing(REF_CART(ref), REF_FRAME(ref), data);
+	} else if (REF_FRAME(ref) % CART_LFS_SEGMENT_FRAMES == CART_LFS_SEGMENT_FRAMES - 1){
+		log_flush_segment(REF_SEGMENT(ref));
 	}
 
-	c = make_cart(CART_OP_WRFRME,0,FileList[fd].Cartridge,FileList[fd].Frame);
-	client_cart_bus_request(c, buf);
+	if (idx < f->nframes){
+		uint32_t old = f->frames[idx];
+
+		//forget the cached copy while the frame is still ours, see relocate_frames
+		pthread_mutex_lock(&alloc_lock);
+		if (FrameShares[REF_CART(old)][REF_FRAME(old)] == 0){
+			drop_cart_cache(REF_CART(old), REF_FRAME(old));
+		} else {
+			clone_frames_copied += 1;	//the old copy stays with a clone
+		}
+		free_frame(old);
+		pthread_mutex_unlock(&alloc_lock);
+		f->frames[idx] = ref;
+	} else {
+		if (f->nframes == f->capacity){
+			uint32_t cap = (f->capacity == 0) ? 16 : f->capacity * 2;
+			uint32_t *frames = realloc(f->frames, cap * sizeof(uint32_t));
+			if (frames == NULL){
+				return (-1);
+			}
+			f->frames = frames;
+			f->capacity = cap;
+		}
+		f->frames[f->nframes++] = ref;
+	}
 
-	put_cart_cache(FileList[fd].Cartridge, FileList[fd].Frame, buf);
+	pthread_mutex_lock(&alloc_lock);
+	if (cleaner){
+		lfs_cleaner_frames += 1;
+	} else {
+		lfs_user_frames += 1;
+	}
+	pthread_mutex_unlock(&alloc_lock);
+	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_write
-// Description  : Writes "count" bytes to the file handle "fh" from the 
-//                buffer  "buf"
+// Function     : frame_holder
+// Description  : find the file holding a frame whose owner was lost when it
+//                stopped being shared, and take its layout lock for writing
+//                (try-locked, like the rest of the cleaner)
 //
-// Inputs       : fd - filename of the file to write to
-//                buf - pointer to buffer to write from
-//                count - number of bytes to write
-// Outputs      : bytes written
+// Inputs       : ref - the frame, held - a file the caller already holds
+//                idx - receives where the frame sits in the file
+// Outputs      : the file, 0 if it could not be found or locked
 
-int32_t cart_write(int16_t fd, void *buf, int32_t count) {	
-	int32_t bits_written = 0;
-	int32_t temp;
+int16_t frame_holder(uint32_t ref, int16_t held, uint32_t *idx){
 
-	if (FileList[fd].fileName[0] == '\0'){
-		return (-1);
+	for (int16_t fd = 1; fd < CART_MAX_TOTAL_FILES; fd++){
+		if (!file_ok(fd) || (fd != held && pthread_rwlock_trywrlock(&FileList[fd].layout) != 0)){
+			continue;
+		}
+		for (uint32_t i = 0; i < FileList[fd].nframes; i++){
+			if (FileList[fd].frames[i] == ref){
+				*idx = i;
+				return (fd);
+			}
+		}
+		if (fd != held){
+			pthread_rwlock_unlock(&FileList[fd].layout);
+		}
 	}
+	return (0);
+}
 
-	//loop through the rest of the file
-	while(bits_written != count){
-		//get the data for this position
-		reading(fd, buffer);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : seg_shared
+// Description  : check a segment for frames still shared between files,
+//                they cannot be moved so the segment cannot be cleaned.
+//                The caller holds alloc_lock.
+//
+// Inputs       : seg - the segment
+// Outputs      : 1 if the segment holds a shared frame, 0 otherwise
+
+int seg_shared(int32_t seg){
+	uint16_t cart = seg / CART_LFS_SEGS_PER_CART;
+	uint16_t first = (seg % CART_LFS_SEGS_PER_CART) * CART_LFS_SEGMENT_FRAMES;
+
+	for (int n = 0; n < CART_LFS_SEGMENT_FRAMES; n++){
+		if (FrameShares[cart][first + n] > 0){
+			return (1);
+		}
+	}
+	return (0);
+}
 
-		//set up value for writing
-		temp = count - bits_written;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_clean
+// Description  : clean the used segment with the fewest live frames by
+//                moving them to the head of the log.  Files are only ever
+//                try-locked so a writer waiting on the cleaner cannot
+//                deadlock with it.
+//
+// Inputs       : held - a file whose layout lock the caller already holds
+//                       for writing, -1 for none
+// Outputs      : number of segments cleaned (0 or 1)
+
+int log_clean(int16_t held){
+	char frame[CART_FRAME_SIZE];
+	int32_t victim = -1;
+	int cleaned = 0;
+	struct timespec start, end;
+
+	pthread_mutex_lock(&clean_lock);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	//greedy choice, the segment that costs the least to clean
+	pthread_mutex_lock(&alloc_lock);
+	for (int s = 0; s < CART_LFS_SEGMENTS; s++){
+		if (seg_state[s] == CART_SEG_USED && seg_live[s] < CART_LFS_SEGMENT_FRAMES &&
+				(victim < 0 || seg_live[s] < seg_live[victim]) && !seg_shared(s)){
+			victim = s;
+		}
+	}
+	pthread_mutex_unlock(&alloc_lock);
+	if (victim < 0){
+		pthread_mutex_unlock(&clean_lock);
+		return (0);
+	}
 
-		//check the position of the file
-		if (FileList[fd].position != 0){
-			temp = 1024 - FileList[fd].position;
-			if (count < temp){
-				temp = count;
+	//move every live frame out of the victim
+	for (int n = 0; n < CART_LFS_SEGMENT_FRAMES; n++){
+		uint16_t cart = victim / CART_LFS_SEGS_PER_CART;
+		uint16_t frm = (victim % CART_LFS_SEGS_PER_CART) * CART_LFS_SEGMENT_FRAMES + n;
+		uint32_t ref = FRAME_REF(cart, frm);
+
+		pthread_mutex_lock(&alloc_lock);
+		int16_t fd = CartridgeMap[cart][frm];
+		uint32_t idx = FrameIndex[cart][frm];
+		int shared = FrameShares[cart][frm] > 0;
+		pthread_mutex_unlock(&alloc_lock);
+		if (fd == 0 || shared){
+			continue;
+		}
+		if (fd == CART_FRAME_SHARED){
+			if ((fd = frame_holder(ref, held, &idx)) == 0){
+				continue;
 			}
+			pthread_mutex_lock(&alloc_lock);
+			if (CartridgeMap[cart][frm] == CART_FRAME_SHARED && FrameShares[cart][frm] == 0){
+				CartridgeMap[cart][frm] = fd;
+				FrameIndex[cart][frm] = idx;
+			}
+			pthread_mutex_unlock(&alloc_lock);
+		} else if (fd != held && pthread_rwlock_trywrlock(&FileList[fd].layout) != 0){
+			continue;
+		}
+
+		//the frame may have died while we were getting the lock
+		if (CartridgeMap[cart][frm] == fd && idx < FileList[fd].nframes && FileList[fd].frames[idx] == ref){
+			read_cart_cache(cart, frm, frame);
+			log_store(fd, idx, frame, 1);
+		}
+		if (fd != held){
+			pthread_rwlock_unlock(&FileList[fd].layout);
+		}
+	}
+
+	//hand the segment back if it really is empty now
+	pthread_mutex_lock(&alloc_lock);
+	if (seg_live[victim] == 0){
+		seg_state[victim] = CART_SEG_CLEAN;
+		clean_segments += 1;
+		lfs_segments_cleaned += 1;
+		cleaned = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	lfs_cleaner_ns += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+	pthread_mutex_unlock(&alloc_lock);
+
+	pthread_mutex_unlock(&clean_lock);
+	return (cleaned);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_cleaner
+// Description  : the background cleaner, keeps CART_LFS_LOW_WATER clean
+//                segments in hand
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *log_cleaner(void *arg){
+	struct timespec wake;
+
+	pthread_mutex_lock(&alloc_lock);
+	while (cleaner_running){
+		if (clean_segments >= CART_LFS_LOW_WATER){
+			clock_gettime(CLOCK_REALTIME, &wake);
+			wake.tv_sec += 1;
+			pthread_cond_timedwait(&cleaner_wake, &alloc_lock, &wake);
+			continue;
 		}
 
-		if (temp > 1024){
-			temp = 1024;
+		pthread_mutex_unlock(&alloc_lock);
+		int progress = log_clean(-1);
+		pthread_mutex_lock(&alloc_lock);
+
+		//nothing left worth cleaning, wait to be asked again
+		if (!progress && cleaner_running){
+			clock_gettime(CLOCK_REALTIME, &wake);
+			wake.tv_sec += 1;
+			pthread_cond_timedwait(&cleaner_wake, &alloc_lock, &wake);
+		}
+	}
+	pthread_mutex_unlock(&alloc_lock);
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_pwrite
+// Description  : cart_pwrite for the log-structured layout, every frame
+//                written goes to the head of the log
+//
+// Inputs       : fd, buf, count, off - as for cart_pwrite
+// Outputs      : bytes written, -1 if failure
+
+int32_t log_pwrite(int16_t fd, void *buf, int32_t count, uint32_t off) {
+	struct File *f = &FileList[fd];
+	char frame[CART_FRAME_SIZE];
+	int32_t bits_written = 0;
+
+	//the frame list changes under every write
+	pthread_rwlock_wrlock(&f->layout);
+	while(bits_written != count){
+		uint32_t idx = (off + bits_written) / CART_FRAME_SIZE;
+		uint32_t pos = (off + bits_written) % CART_FRAME_SIZE;
+		int32_t temp = CART_FRAME_SIZE - pos;
+		if (temp > count - bits_written){
+			temp = count - bits_written;
+		}
+
+		//keep the rest of a partly written frame
+		if (temp != CART_FRAME_SIZE && idx < f->nframes){
+			read_cart_cache(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), frame);
 		}
-		memcpy(&buffer[FileList[fd].position], &((char *)buf)[bits_written], temp);
+		memcpy(&frame[pos], &((char *)buf)[bits_written], temp);
 
-		writing(fd, buffer);
+		if (log_store(fd, idx, frame, 0)){
+			logMessage(LOG_ERROR_LEVEL, "CART driver: log full writing [%s].", f->fileName);
+			break;
+		}
 		bits_written += temp;
-		FileList[fd].position += temp;
-		
-		//change the length if nesserary 
-		if (FileList[fd].Cartridge == FileList[fd].ending_cartridge 
-		&& FileList[fd].Frame == FileList[fd].ending_frame){
-			//if the frame is full, give a new frame to this file
-			if (FileList[fd].position == 1024){
-				locate_empty_frame(fd);
-			}		
-			else if ( (temp + FileList[fd].position) > FileList[fd].ending_position){
-				FileList[fd].ending_position = temp + FileList[fd].position;
-			}
+	}
+	pthread_rwlock_unlock(&f->layout);
+
+	//change the length if nesserary
+	pthread_mutex_lock(&f->lock);
+	if (off + bits_written > f->length){
+		f->length = off + bits_written;
+	}
+	pthread_mutex_unlock(&f->lock);
+
+	return (bits_written == count) ? bits_written : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_log_structured
+// Description  : Switch the layout to log-structured writes, with a
+//                background cleaner.  Only allowed while no file has any
+//                frames, i.e. right after cart_poweron.
+//
+// Inputs       : enable - 1 to turn the log on, 0 to turn it off
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_log_structured(int enable) {
+
+	if (enable == log_structured){
+		return (0);
+	}
+	if (hot_cartridges > 0){
+		return (-1);
+	}
+	for (int i = 1; i < CART_MAX_TOTAL_FILES; i++){
+		if (FileList[i].nframes != 0){
+			return (-1);
 		}
+	}
 
-		//if the frame is full, give a new frame to this file
-		else if (FileList[fd].position == 1024){
-			find_next_frame(fd);
+	if (enable){
+		memset(seg_state, CART_SEG_CLEAN, sizeof(seg_state));
+		memset(seg_live, 0, sizeof(seg_live));
+		clean_segments = CART_LFS_SEGMENTS;
+		log_seg = -1;
+		log_next = 0;
+		lfs_user_frames = lfs_cleaner_frames = lfs_segments_cleaned = lfs_cleaner_ns = 0;
+		log_structured = 1;
+		cleaner_running = 1;
+		if (pthread_create(&cleaner_thread, NULL, log_cleaner, NULL) != 0){
+			logMessage(LOG_ERROR_LEVEL, "CART driver: failed to start the log cleaner.");
+			cleaner_running = 0;
+			log_structured = 0;
+			return (-1);
 		}
+	} else {
+		pthread_mutex_lock(&alloc_lock);
+		cleaner_running = 0;
+		pthread_cond_signal(&cleaner_wake);
+		pthread_mutex_unlock(&alloc_lock);
+		pthread_join(cleaner_thread, NULL);
+		log_structured = 0;
 	}
-	
+
 	// Return successfully
-	return (bits_written);
+	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_read
-// Description  : Seek to specific point in the file
+// Function     : prefetch
+// Description  : read the frames of a multi-frame read ahead of time in one
+//                pipelined batch, the caller holds the layout lock
 //
-// Inputs       : fd - filename of the file to write to
-//                loc - offfset of file in relation to beginning of file
-// Outputs      : 0 if successful
+// Inputs       : fd - the file, first, last - the frames (in file order)
+// Outputs      : the number of frames looked at, from first on
+
+uint32_t prefetch(int16_t fd, uint32_t first, uint32_t last){
+	CartridgeIndex carts[CART_PREFETCH_MAX_FRAMES];
+	CartFrameIndex frms[CART_PREFETCH_MAX_FRAMES];
+	uint32_t n = 0, window = CART_PREFETCH_FRAMES;
+
+	//a whole stripe, so every server gets a unit to read at once
+	if (FileList[fd].stripe_width > 1){
+		window = FileList[fd].stripe_width * FileList[fd].stripe_unit;
+		if (window > CART_PREFETCH_MAX_FRAMES){
+			window = CART_PREFETCH_MAX_FRAMES;
+		}
+	}
 
-int32_t cart_seek(int16_t fd, uint32_t loc) {
+	//no more than half the cache, the rest is still in use
+	while (first + n <= last && n < window && n < get_cart_cache_size() / 2){
+		carts[n] = REF_CART(FileList[fd].frames[first + n]);
+		frms[n] = REF_FRAME(FileList[fd].frames[first + n]);
+		n++;
+	}
+	if (n > 1){
+		prefetch_cart_cache(carts, frms, n);
+	}
+	return (n);
+}
 
-	int num_frame = (loc/1024) + 1;
-	for (int i = 0; i < CART_MAX_CARTRIDGES; i++){
-		for (int j = 0; j < CART_CARTRIDGE_SIZE; j++){
-			if (CartridgeMap[i][j] == fd){
-				num_frame -= 1;
-				if (num_frame == 0){
-					FileList[fd].position = loc;
-					FileList[fd].Cartridge = i;
-					FileList[fd].Frame = j;
-				}
-				else{
-					loc -= 1024;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_pread
+// Description  : Reads "count" bytes starting at offset "off" of the file
+//                into "buf", leaving the file position alone
+//
+// Inputs       : fd - the file to read from
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+//                off - where in the file to start
+// Outputs      : bytes read, -1 if failure
+
+int32_t cart_pread(int16_t fd, void *buf, int32_t count, uint32_t off) {
+	struct File *f = &FileList[fd];
+	char frame[CART_FRAME_SIZE];
+	int32_t bits_read = 0;
+	uint32_t length, last, fetched;
+	range r;
+
+	if (!file_ok(fd) || count < 0){
+		return (-1);
+	}
+	atomic_fetch_add(&foreground_ops, 1);
+
+	//not enough bit in the file to read
+	pthread_mutex_lock(&f->lock);
+	f->heat += 1;
+	length = f->length;
+	pthread_mutex_unlock(&f->lock);
+	if (off >= length || count == 0){
+		return (0);
+	}
+	if ((uint32_t)count > length - off){
+		count = length - off;
+	}
+
+	pthread_rwlock_rdlock(&f->layout);
+	last = (off + count - 1) / CART_FRAME_SIZE;
+	range_lock(fd, &r, off / CART_FRAME_SIZE, last, 0);
+	fetched = off / CART_FRAME_SIZE;
+
+	//loop through the file a frame at a time
+	while(bits_read != count){
+		uint32_t idx = (off + bits_read) / CART_FRAME_SIZE;
+		uint32_t pos = (off + bits_read) % CART_FRAME_SIZE;
+		int32_t temp = CART_FRAME_SIZE - pos;
+		if (temp > count - bits_read){
+			temp = count - bits_read;
+		}
+
+		//read ahead a window at a time
+		if (idx == fetched && idx < last){
+			fetched += prefetch(fd, idx, last);
+		}
+
+		//whole frames go straight to the caller
+		if (temp == CART_FRAME_SIZE){
+			read_cart_cache(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), &((char *)buf)[bits_read]);
+		} else {
+			read_cart_cache(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), frame);
+			memcpy(&((char *)buf)[bits_read], &frame[pos], temp);
+		}
+		bits_read += temp;
+	}
+
+	range_unlock(fd, &r);
+	pthread_rwlock_unlock(&f->layout);
+
+	// Return bits read
+	return (bits_read);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unshare_frame
+// Description  : give a file its own frame in place of one it shares, the
+//                caller holds the layout lock and the frame's range
+//                exclusively.  The new frame is written by the caller.
+//
+// Inputs       : fd - the file, idx - the frame in file order
+//                buf - receives the old contents, NULL if not needed
+// Outputs      : 1 if the frame was replaced, 0 if it was not shared,
+//                -1 if there is no free frame
+
+int unshare_frame(int16_t fd, uint32_t idx, char *buf){
+	struct File *f = &FileList[fd];
+	uint32_t old = f->frames[idx], ref = CART_NO_FRAME;
+
+	pthread_mutex_lock(&alloc_lock);
+	if (FrameShares[REF_CART(old)][REF_FRAME(old)] == 0){
+		pthread_mutex_unlock(&alloc_lock);
+		return (0);
+	}
+	if (hot_cartridges > 0 && f->hot){
+		ref = reserve_frame(fd, f->hot - 1, f->hot - 1);
+	} else if (hot_cartridges > 0){
+		ref = reserve_frame(fd, hot_cartridges, cart_bus_cartridges - 1);
+	}
+	if (ref == CART_NO_FRAME){
+		ref = reserve_frame(fd, 0, cart_bus_cartridges - 1);
+	}
+	if (ref == CART_NO_FRAME){
+		pthread_mutex_unlock(&alloc_lock);
+		return (-1);
+	}
+	FrameIndex[REF_CART(ref)][REF_FRAME(ref)] = idx;
+	pthread_mutex_unlock(&alloc_lock);
+
+	//read the old contents while we still hold the frame
+	if (buf != NULL){
+		read_cart_cache(REF_CART(old), REF_FRAME(old), buf);
+	}
+
+	pthread_mutex_lock(&alloc_lock);
+	free_frame(old);
+	clone_frames_copied += 1;
+	pthread_mutex_unlock(&alloc_lock);
+	f->frames[idx] = ref;
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_pwrite
+// Description  : Writes "count" bytes from "buf" at offset "off" of the
+//                file, leaving the file position alone
+//
+// Inputs       : fd - the file to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+//                off - where in the file to start, at most the file length
+// Outputs      : bytes written, -1 if failure
+
+int32_t cart_pwrite(int16_t fd, void *buf, int32_t count, uint32_t off) {
+	struct File *f = &FileList[fd];
+	char frame[CART_FRAME_SIZE];
+	int32_t bits_written = 0;
+	uint32_t need, run;
+	int striped = write_through && f->stripe_width > 1;
+	range r;
+
+	if (!file_ok(fd) || count < 0){
+		return (-1);
+	}
+	if (f->readonly){
+		return (-1);
+	}
+	atomic_fetch_add(&foreground_ops, 1);
+	pthread_mutex_lock(&f->lock);
+	f->heat += 1;
+	if (off > f->length){
+		pthread_mutex_unlock(&f->lock);
+		return (-1);
+	}
+	pthread_mutex_unlock(&f->lock);
+	if (count == 0){
+		return (0);
+	}
+	if (log_structured){
+		return (log_pwrite(fd, buf, count, off));
+	}
+
+	//give the file the frames it grows into
+	need = (off + count + CART_FRAME_SIZE - 1) / CART_FRAME_SIZE;
+	pthread_rwlock_rdlock(&f->layout);
+	if (f->nframes < need){
+		pthread_rwlock_unlock(&f->layout);
+		pthread_rwlock_wrlock(&f->layout);
+		while (f->nframes < need){
+			if (locate_empty_frame(fd)){
+				pthread_rwlock_unlock(&f->layout);
+				logMessage(LOG_ERROR_LEVEL, "CART driver: out of frames writing [%s].", f->fileName);
+				return (-1);
+			}
+		}
+		pthread_rwlock_unlock(&f->layout);
+		pthread_rwlock_rdlock(&f->layout);
+	}
+	range_lock(fd, &r, off / CART_FRAME_SIZE, need - 1, 1);
+
+	//loop through the file a frame at a time
+	while(bits_written != count){
+		uint32_t idx = (off + bits_written) / CART_FRAME_SIZE;
+		uint32_t pos = (off + bits_written) % CART_FRAME_SIZE;
+		int32_t temp = CART_FRAME_SIZE - pos;
+		if (temp > count - bits_written){
+			temp = count - bits_written;
+		}
+
+		//a frame shared with a clone gets a copy of its own first
+		int copied = unshare_frame(fd, idx, (temp == CART_FRAME_SIZE) ? NULL : frame);
+		if (copied < 0){
+			logMessage(LOG_ERROR_LEVEL, "CART driver: out of frames writing [%s].", f->fileName);
+			break;
+		}
+
+		//a striped file sends its whole frames a unit per request without
+		//waiting, so the servers write in parallel (answered below)
+		if (temp == CART_FRAME_SIZE && striped){
+			run = 1;
+			while ((cart_bus_features & CART_FEATURE_BATCH) && run < CART_BATCH_MAX_FRAMES &&
+					bits_written + (int32_t)(run + 1) * CART_FRAME_SIZE <= count){
+				//a frame that was shared (or could not be copied) ends the
+				//run, the next pass writes it on its own
+				if (unshare_frame(fd, idx + run, NULL) != 0 ||
+						f->frames[idx + run] != f->frames[idx] + run){
+					break;
+				}
+				run++;
+			}
+			if (run > 1){
+				writes_batch(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), run, &((char *)buf)[bits_written]);
+			} else {
+				writes_pipelined(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), &((char *)buf)[bits_written]);
+			}
+			for (uint32_t k = 0; k < run; k++){
+				put_cart_cache(REF_CART(f->frames[idx + k]), REF_FRAME(f->frames[idx + k]),
+					&((char *)buf)[bits_written + k * CART_FRAME_SIZE]);
+			}
+			bits_written += run * CART_FRAME_SIZE;
+			continue;
+		}
+
+		//a whole frame is replaced, no need to read it first
+		if (temp == CART_FRAME_SIZE){
+			writing(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), &((char *)buf)[bits_written]);
+		} else if (!copied && write_through && (cart_bus_features & CART_FEATURE_PARTIAL)){
+			//only the changed bytes go to the server, the frame is not read
+			patch_cart_cache(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), pos, temp,
+				&((char *)buf)[bits_written]);
+			writes_partial(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), pos, temp,
+				&((char *)buf)[bits_written]);
+		} else {
+			if (!copied){
+				read_cart_cache(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), frame);
+			}
+			memcpy(&frame[pos], &((char *)buf)[bits_written], temp);
+			writing(REF_CART(f->frames[idx]), REF_FRAME(f->frames[idx]), frame);
+		}
+		bits_written += temp;
+	}
+	//a run the server failed fails the write
+	if (striped && flush_bus() != 0){
+		bits_written = -1;
+	}
+
+	range_unlock(fd, &r);
+	pthread_rwlock_unlock(&f->layout);
+
+	//change the length if nesserary
+	pthread_mutex_lock(&f->lock);
+	if (off + bits_written > f->length){
+		f->length = off + bits_written;
+	}
+	pthread_mutex_unlock(&f->lock);
+
+	// Return successfully
+	return (bits_written == count) ? bits_written : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_read
+// Description  : Reads "count" bytes from the file handle "fd" into the
+//                buffer "buf"
+//
+// Inputs       : fd - filename of the file to read from
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+// Outputs      : bytes read
+
+int32_t cart_read(int16_t fd, void *buf, int32_t count) {
+	int32_t bits_read;
+
+	if (!file_ok(fd)){
+		return (-1);
+	}
+
+	pthread_mutex_lock(&FileList[fd].cursor);
+	bits_read = cart_pread(fd, buf, count, FileList[fd].position);
+	if (bits_read > 0){
+		FileList[fd].position += bits_read;
+	}
+	pthread_mutex_unlock(&FileList[fd].cursor);
+
+	// Return bits read
+	return (bits_read);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_write
+// Description  : Writes "count" bytes to the file handle "fh" from the
+//                buffer  "buf"
+//
+// Inputs       : fd - filename of the file to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+// Outputs      : bytes written
+
+int32_t cart_write(int16_t fd, void *buf, int32_t count) {
+	int32_t bits_written;
+
+	if (!file_ok(fd)){
+		return (-1);
+	}
+
+	pthread_mutex_lock(&FileList[fd].cursor);
+	bits_written = cart_pwrite(fd, buf, count, FileList[fd].position);
+	if (bits_written > 0){
+		FileList[fd].position += bits_written;
+	}
+	pthread_mutex_unlock(&FileList[fd].cursor);
+
+	// Return successfully
+	return (bits_written);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_seek
+// Description  : Seek to specific point in the file
+//
+// Inputs       : fd - filename of the file to write to
+//                loc - offfset of file in relation to beginning of file
+// Outputs      : 0 if successful, -1 if past the end of the file
+
+int32_t cart_seek(int16_t fd, uint32_t loc) {
+	int32_t ret = 0;
+
+	if (!file_ok(fd)){
+		return (-1);
+	}
+
+	pthread_mutex_lock(&FileList[fd].cursor);
+	pthread_mutex_lock(&FileList[fd].lock);
+	if (loc <= FileList[fd].length){
+		FileList[fd].position = loc;
+	} else {
+		ret = -1;
+	}
+	pthread_mutex_unlock(&FileList[fd].lock);
+	pthread_mutex_unlock(&FileList[fd].cursor);
+
+	// Return successfully
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_flush
+// Description  : order dirty frames for a flush, starting from the loaded
+//                cartridge so the batch loads each cartridge at most once
+//
+// Inputs       : a, b - the packed cartridge/frame values to compare
+// Outputs      : <0, 0, >0 as for qsort
+
+int compare_flush(const void *a, const void *b){
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	uint32_t locals = cart_bus_cartridges / cart_bus_servers;
+	uint32_t cx = (CART_BUS_LOCAL(x >> 16) + locals - flush_base[CART_BUS_SERVER(x >> 16)]) % locals;
+	uint32_t cy = (CART_BUS_LOCAL(y >> 16) + locals - flush_base[CART_BUS_SERVER(y >> 16)]) % locals;
+
+	if (cx != cy){
+		return (cx < cy) ? -1 : 1;
+	}
+	return (int)(x & 0xffff) - (int)(y & 0xffff);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : group_commit
+// Description  : write back the dirty frames of every file in the group as
+//                one batch ordered by cartridge
+//
+// Inputs       : group - the files to flush, indexed by file handle
+//                all - flush every dirty frame regardless of the owner
+// Outputs      : number of frames written, -1 if the bus failed any write
+//                since the last flush
+
+int32_t group_commit(uint8_t *group, int all){
+	CartridgeIndex *carts = malloc(get_cart_cache_size() * sizeof(CartridgeIndex));
+	CartFrameIndex *frms = malloc(get_cart_cache_size() * sizeof(CartFrameIndex));
+	uint32_t *batch = malloc(get_cart_cache_size() * sizeof(uint32_t));
+	uint32_t n, count = 0, written = 0;
+	int failed;
+
+	//pick out the frames belonging to the files in this group
+	n = dirty_list_cart_cache(carts, frms, get_cart_cache_size());
+	for (uint32_t i = 0; i < n; i++){
+		int16_t owner = CartridgeMap[carts[i]][frms[i]];
+
+		//a shared frame belongs to every file holding it
+		if (all || owner == CART_FRAME_SHARED || group[owner]){
+			batch[count++] = FRAME_REF(carts[i], frms[i]);
+		}
+	}
+
+	//one pass over the cartridges of each server, starting with the one it
+	//has loaded already
+	for (int i = 0; i < cart_bus_servers; i++){
+		int16_t loaded = current_Cartridge[i];
+		flush_base[i] = (loaded >= 0 && loaded < cart_bus_cartridges) ? CART_BUS_LOCAL(loaded) : 0;
+	}
+	qsort(batch, count, sizeof(uint32_t), compare_flush);
+	for (uint32_t i = 0; i < count; i++){
+		carts[i] = REF_CART(batch[i]);
+		frms[i] = REF_FRAME(batch[i]);
+	}
+	written = flush_list_cart_cache(carts, frms, count);
+	failed = (flush_bus() != 0);
+	if (failed){
+		logMessage(LOG_ERROR_LEVEL, "CART driver: group commit failed.");
+	}
+
+	free(carts);
+	free(frms);
+	free(batch);
+	return (failed ? -1 : (int32_t)written);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sync_wait
+// Description  : wait for a commit that started after our request was
+//                queued, leading one ourselves if nobody else is
+//
+// Inputs       : none, the caller holds sync_lock
+// Outputs      : 0 if the commit went through, -1 if it failed
+
+int32_t sync_wait(void){
+	sync_waiter me = { sync_started + 1, 0, sync_waiters };	//the next commit to start picks us up
+	sync_waiter **w;
+	uint8_t *group = malloc(CART_MAX_TOTAL_FILES);
+	int32_t ret;
+
+	sync_waiters = &me;
+	while (sync_finished < me.target){
+		if (sync_running){
+			pthread_cond_wait(&sync_done, &sync_lock);
+			continue;
+		}
+
+		//lead a commit for everybody queued so far
+		int all = sync_all_pending;
+		uint64_t gen = ++sync_started;
+		memcpy(group, sync_pending, CART_MAX_TOTAL_FILES);
+		memset(sync_pending, 0, CART_MAX_TOTAL_FILES);
+		sync_all_pending = 0;
+		sync_running = 1;
+		pthread_mutex_unlock(&sync_lock);
+
+		ret = group_commit(group, all);
+
+		pthread_mutex_lock(&sync_lock);
+		//everybody the commit was for hears it failed
+		for (sync_waiter *o = sync_waiters; o != NULL && ret < 0; o = o->next){
+			if (o->target == gen){
+				o->failed = 1;
+			}
+		}
+		sync_running = 0;
+		sync_finished = gen;
+		pthread_cond_broadcast(&sync_done);
+	}
+	free(group);
+
+	for (w = &sync_waiters; *w != &me; w = &(*w)->next);
+	*w = me.next;
+	return (me.failed ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_write_through
+// Description  : Choose between writing each frame to the bus as it changes
+//                and buffering changes in the cache until a sync
+//
+// Inputs       : enable - 1 for write-through, 0 for buffered writes
+// Outputs      : 0 if successful
+
+int32_t cart_set_write_through(int enable) {
+
+	//switching back on must not leave anything behind in the cache
+	if (enable && !write_through){
+		cart_sync();
+	}
+	write_through = enable;
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_fsync
+// Description  : Write the dirty frames of a file to the bus, together with
+//                those of any other file waiting on a sync
+//
+// Inputs       : fd - the file descriptor
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_fsync(int16_t fd) {
+	int32_t ret;
+
+	if (!file_ok(fd)){
+		return (-1);
+	}
+
+	//join the group and wait for it to be committed
+	pthread_mutex_lock(&sync_lock);
+	sync_pending[fd] = 1;
+	ret = sync_wait();
+	pthread_mutex_unlock(&sync_lock);
+
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_sync
+// Description  : Write every dirty frame in the cache to the bus
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_sync(void) {
+	int32_t ret;
+
+	pthread_mutex_lock(&sync_lock);
+	sync_all_pending = 1;
+	ret = sync_wait();
+	pthread_mutex_unlock(&sync_lock);
+
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_layout
+// Description  : measure how scattered a file is, the caller holds the
+//                layout lock of the file
+//
+// Inputs       : fd - the file
+//                extents - receives the number of runs of adjacent frames
+//                cartridges - receives the number of cartridges used
+// Outputs      : none
+
+void file_layout(int16_t fd, uint32_t *extents, uint32_t *cartridges){
+	struct File *f = &FileList[fd];
+	uint8_t used[CART_BUS_MAX_CARTRIDGES];
+
+	memset(used, 0, sizeof(used));
+	*extents = 0;
+	*cartridges = 0;
+	for (uint32_t i = 0; i < f->nframes; i++){
+		if (i == 0 || f->frames[i] != f->frames[i - 1] + 1){
+			*extents += 1;
+		}
+		if (!used[REF_CART(f->frames[i])]){
+			used[REF_CART(f->frames[i])] = 1;
+			*cartridges += 1;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_shares
+// Description  : check whether a file shares frames with a clone, moving
+//                them would undo the sharing.  The caller holds the layout
+//                lock of the file.
+//
+// Inputs       : fd - the file
+// Outputs      : 1 if any frame is shared, 0 otherwise
+
+int file_shares(int16_t fd){
+	struct File *f = &FileList[fd];
+	int shared = 0;
+
+	pthread_mutex_lock(&alloc_lock);
+	for (uint32_t i = 0; i < f->nframes && !shared; i++){
+		shared = FrameShares[REF_CART(f->frames[i])][REF_FRAME(f->frames[i])] > 0;
+	}
+	pthread_mutex_unlock(&alloc_lock);
+
+	return (shared);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : plan_extents
+// Description  : reserve free frames for a file in as few runs as possible,
+//                longest free runs first, the caller holds alloc_lock
+//
+// Inputs       : fd - the file the frames are reserved for
+//                need - frames needed, targets - receives the frames
+// Outputs      : the number of runs used, 0 if there is not enough room
+
+uint32_t plan_extents(int16_t fd, uint32_t need, uint32_t *targets){
+	uint32_t got = 0, runs = 0;
+
+	while (got < need){
+		uint32_t best = 0, best_len = 0;
+
+		//the longest free run left, it only has to be as long as what is missing
+		for (int i = 0; i < cart_bus_cartridges && best_len < need - got; i++){
+			for (int j = 0; j < CART_CARTRIDGE_SIZE; j++){
+				int k = j;
+				while (k < CART_CARTRIDGE_SIZE && CartridgeMap[i][k] == 0){
+					k++;
 				}
+				if (k - j > (int)best_len){
+					best = FRAME_REF(i, j);
+					best_len = k - j;
+				}
+				j = k;
 			}
 		}
+		if (best_len == 0){
+			break;
+		}
+
+		for (uint32_t n = 0; n < best_len && got < need; n++){
+			targets[got++] = best + n;
+			CartridgeMap[REF_CART(best)][REF_FRAME(best) + n] = fd;
+		}
+		runs++;
+	}
+
+	//not enough room, give back what we took
+	if (got < need){
+		for (uint32_t n = 0; n < got; n++){
+			CartridgeMap[REF_CART(targets[n])][REF_FRAME(targets[n])] = 0;
+		}
+		return (0);
+	}
+	return (runs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_pause
+// Description  : get out of the way of foreground I/O, sleeping whenever any
+//                happened since the last call
+//
+// Inputs       : seen - the foreground count at the last call (updated)
+// Outputs      : none
+
+void defrag_pause(uint64_t *seen){
+	uint64_t now = atomic_load(&foreground_ops);
+
+	if (now != *seen){
+		struct timespec pause = { 0, CART_DEFRAG_PAUSE_US * 1000 };
+		nanosleep(&pause, NULL);
+	}
+	*seen = atomic_load(&foreground_ops);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : relocate_frames
+// Description  : copy a batch of frames of a file to frames reserved for
+//                them and give the old ones back, reading in cartridge order
+//                so a cartridge is loaded once per batch.  The caller holds
+//                the layout lock for writing.
+//
+// Inputs       : fd - the file, idx - the frames in file order
+//                targets - the new frames, already taken in CartridgeMap
+//                n - the number of frames, at most CART_DEFRAG_BATCH
+// Outputs      : none
+
+void relocate_frames(int16_t fd, uint32_t *idx, uint32_t *targets, uint32_t n){
+	struct File *f = &FileList[fd];
+	char frames[CART_DEFRAG_BATCH][CART_FRAME_SIZE];
+	uint32_t order[CART_DEFRAG_BATCH];
+
+	//sort the old frames by where they are
+	for (uint32_t k = 0; k < n; k++){
+		uint32_t m = k;
+		while (m > 0 && f->frames[idx[order[m - 1]]] > f->frames[idx[k]]){
+			order[m] = order[m - 1];
+			m--;
+		}
+		order[m] = k;
+	}
+
+	for (uint32_t k = 0; k < n; k++){
+		uint32_t old = f->frames[idx[order[k]]];
+		read_cart_cache(REF_CART(old), REF_FRAME(old), frames[order[k]]);
+	}
+	for (uint32_t k = 0; k < n; k++){
+		writing(REF_CART(targets[k]), REF_FRAME(targets[k]), frames[k]);
+	}
+
+	//the cached copy of an old frame goes before the frame is given back,
+	//once it is free another file may take it and dirty it in the cache
+	pthread_mutex_lock(&alloc_lock);
+	for (uint32_t k = 0; k < n; k++){
+		uint32_t old = f->frames[idx[k]];
+
+		FrameIndex[REF_CART(targets[k])][REF_FRAME(targets[k])] = idx[k];
+		if (FrameShares[REF_CART(old)][REF_FRAME(old)] == 0){
+			drop_cart_cache(REF_CART(old), REF_FRAME(old));
+		}
+		free_frame(old);
+	}
+	pthread_mutex_unlock(&alloc_lock);
+	for (uint32_t k = 0; k < n; k++){
+		f->frames[idx[k]] = targets[k];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_file
+// Description  : move the frames of a file into as few runs as possible, a
+//                batch of frames at a time so the file stays usable
+//
+// Inputs       : fd - the file
+//                seen - the foreground count for throttling
+// Outputs      : number of frames moved
+
+uint32_t defrag_file(int16_t fd, uint64_t *seen){
+	struct File *f = &FileList[fd];
+	char frame[CART_FRAME_SIZE];
+	uint32_t extents, cartridges, need, runs, moved = 0, *targets;
+
+	pthread_rwlock_wrlock(&f->layout);
+	file_layout(fd, &extents, &cartridges);
+	need = f->nframes;
+	if (extents <= 1 || !file_ok(fd) || file_shares(fd) || f->stripe_width > 1){
+		pthread_rwlock_unlock(&f->layout);
+		return (0);
+	}
+
+	//the log puts frames written in order next to each other
+	if (log_structured){
+		for (uint32_t i = 0; i < need; i++){
+			//the reserved segments are the cleaner's alone
+			read_cart_cache(REF_CART(f->frames[i]), REF_FRAME(f->frames[i]), frame);
+			if (log_store(fd, i, frame, 0)){
+				break;
+			}
+			moved++;
+			if ((moved % CART_DEFRAG_BATCH) == 0){
+				pthread_rwlock_unlock(&f->layout);
+				defrag_pause(seen);
+				pthread_rwlock_wrlock(&f->layout);
+				if (f->nframes < need){
+					break;
+				}
+			}
+		}
+		pthread_rwlock_unlock(&f->layout);
+		return (moved);
+	}
+
+	//find a better home, and only move if it really is better
+	targets = malloc(need * sizeof(uint32_t));
+	pthread_mutex_lock(&alloc_lock);
+	runs = plan_extents(fd, need, targets);
+	if (runs == 0 || runs >= extents){
+		for (uint32_t n = 0; runs != 0 && n < need; n++){
+			CartridgeMap[REF_CART(targets[n])][REF_FRAME(targets[n])] = 0;
+		}
+		pthread_mutex_unlock(&alloc_lock);
+		pthread_rwlock_unlock(&f->layout);
+		free(targets);
+		return (0);
+	}
+	pthread_mutex_unlock(&alloc_lock);
+
+	for (uint32_t i = 0; i < need; i += CART_DEFRAG_BATCH){
+		uint32_t idx[CART_DEFRAG_BATCH], count = 0;
+
+		while (count < CART_DEFRAG_BATCH && i + count < need){
+			idx[count] = i + count;
+			count++;
+		}
+		relocate_frames(fd, idx, &targets[i], count);
+		moved += count;
+
+		//let the foreground in between batches
+		if (i + count < need){
+			pthread_rwlock_unlock(&f->layout);
+			defrag_pause(seen);
+			pthread_rwlock_wrlock(&f->layout);
+
+			//closed meanwhile, return the frames we still hold
+			if (f->nframes < need){
+				pthread_mutex_lock(&alloc_lock);
+				for (uint32_t n = i + count; n < need; n++){
+					CartridgeMap[REF_CART(targets[n])][REF_FRAME(targets[n])] = 0;
+				}
+				pthread_mutex_unlock(&alloc_lock);
+				break;
+			}
+		}
+	}
+	pthread_rwlock_unlock(&f->layout);
+	free(targets);
+
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_file_layout
+// Description  : Measure the fragmentation of a file
+//
+// Inputs       : fd - the file
+//                extents - receives the number of runs of adjacent frames
+//                cartridges - receives the number of cartridges spanned
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_file_layout(int16_t fd, uint32_t *extents, uint32_t *cartridges) {
+
+	if (!file_ok(fd)){
+		return (-1);
+	}
+
+	pthread_rwlock_rdlock(&FileList[fd].layout);
+	file_layout(fd, extents, cartridges);
+	pthread_rwlock_unlock(&FileList[fd].layout);
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_defrag
+// Description  : Relocate the frames of every open file so each file is as
+//                contiguous as possible.  Safe while the files are in use,
+//                it works a batch at a time and backs off from foreground I/O.
+//
+// Inputs       : none
+// Outputs      : number of frames moved
+
+int32_t cart_defrag(void) {
+	uint64_t seen = atomic_load(&foreground_ops);
+	uint32_t moved = 0;
+
+	for (int16_t fd = 1; fd < CART_MAX_TOTAL_FILES; fd++){
+		if (file_ok(fd)){
+			moved += defrag_file(fd, &seen);
+		}
+	}
+
+	pthread_mutex_lock(&alloc_lock);
+	defrag_frames_moved += moved;
+	defrag_runs += 1;
+	pthread_mutex_unlock(&alloc_lock);
+
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserve_frame
+// Description  : take a free frame on a range of cartridges for a file, the
+//                caller holds alloc_lock
+//
+// Inputs       : fd - the file, first, last - the cartridges to look on
+// Outputs      : the frame (see FRAME_REF), CART_NO_FRAME if they are full
+
+uint32_t reserve_frame(int16_t fd, int first, int last){
+	for (int i = first; i <= last; i++){
+		for (int j = 0; j < CART_CARTRIDGE_SIZE; j++){
+			if (CartridgeMap[i][j] == 0){
+				CartridgeMap[i][j] = fd;
+				return (FRAME_REF(i, j));
+			}
+		}
+	}
+	return (CART_NO_FRAME);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : migrate_file
+// Description  : move the frames of a file onto its hot cartridge or off
+//                the hot cartridges (cold), a batch at a time
+//
+// Inputs       : fd - the file, hot - where the file belongs (see
+//                File.hot), seen - the foreground count for throttling
+// Outputs      : number of frames moved
+
+uint32_t migrate_file(int16_t fd, int hot, uint64_t *seen){
+	struct File *f = &FileList[fd];
+	uint32_t moved = 0, i = 0;
+	int full = 0;
+
+	pthread_rwlock_wrlock(&f->layout);
+	f->hot = hot;
+	while (i < f->nframes && file_ok(fd)){
+		uint32_t idx[CART_DEFRAG_BATCH], targets[CART_DEFRAG_BATCH], count = 0;
+
+		//the next batch of frames on the wrong side, with somewhere to go
+		pthread_mutex_lock(&alloc_lock);
+		for (; i < f->nframes && count < CART_DEFRAG_BATCH; i++){
+			uint16_t cart = REF_CART(f->frames[i]);
+			if (((cart < hot_cartridges) ? cart + 1 : 0) == hot ||
+					FrameShares[cart][REF_FRAME(f->frames[i])] > 0){
+				continue;
+			}
+			if (hot){
+				targets[count] = reserve_frame(fd, hot - 1, hot - 1);
+			} else {
+				targets[count] = reserve_frame(fd, hot_cartridges, cart_bus_cartridges - 1);
+			}
+			if (targets[count] == CART_NO_FRAME){
+				full = 1;
+				break;
+			}
+			idx[count++] = i;
+		}
+		pthread_mutex_unlock(&alloc_lock);
+
+		if (count > 0){
+			relocate_frames(fd, idx, targets, count);
+			moved += count;
+		}
+		if (full || i >= f->nframes){
+			break;
+		}
+
+		//let the foreground in between batches
+		pthread_rwlock_unlock(&f->layout);
+		defrag_pause(seen);
+		pthread_rwlock_wrlock(&f->layout);
+	}
+	pthread_rwlock_unlock(&f->layout);
+
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_heat
+// Description  : order files hottest first, by the heat per frame the round
+//                saw
+//
+// Inputs       : a, b - the file handles to compare
+// Outputs      : <0, 0, >0 as for qsort
+
+int compare_heat(const void *a, const void *b){
+	uint32_t x = migrate_heat[*(const int16_t *)a];
+	uint32_t y = migrate_heat[*(const int16_t *)b];
+
+	return (x > y) ? -1 : (x < y);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : migrate_round
+// Description  : pick the files that fit on the hot cartridges, those
+//                with the most calls per frame first, push the rest off
+//                them and pull the hot ones on.  The hottest go on the
+//                first hot cartridge, so the calls keep to as few
+//                cartridges as possible.
+//
+// Inputs       : seen - the foreground count for throttling
+// Outputs      : number of frames moved
+
+uint32_t migrate_round(uint64_t *seen){
+	int16_t order[CART_MAX_TOTAL_FILES];
+	uint16_t hot[CART_MAX_TOTAL_FILES];
+	uint32_t room[CART_BUS_MAX_CARTRIDGES];
+	uint32_t n = 0, moved = 0;
+
+	for (int16_t fd = 1; fd < CART_MAX_TOTAL_FILES; fd++){
+		//a striped file stays spread over its servers
+		if (file_ok(fd) && FileList[fd].stripe_width <= 1){
+			//a file holding few frames for its calls is worth more of the
+			//hot room, files already hot count double so files of about
+			//the same heat do not trade places every round
+			uint32_t frames = (FileList[fd].nframes > 0) ? FileList[fd].nframes : 1;
+			pthread_mutex_lock(&FileList[fd].lock);
+			migrate_heat[fd] = (uint32_t)(((uint64_t)FileList[fd].heat * 1024 *
+				(FileList[fd].hot ? 2 : 1)) / frames);
+			pthread_mutex_unlock(&FileList[fd].lock);
+			order[n++] = fd;
+		}
+	}
+	qsort(order, n, sizeof(int16_t), compare_heat);
+
+	//fill the hot cartridges in turn with the hottest files that fit, a
+	//hot file stays on its cartridge while it fits there, files only go
+	//cold when something hotter needs the room
+	for (uint16_t c = 0; c < hot_cartridges; c++){
+		room[c] = CART_CARTRIDGE_SIZE;
+	}
+	memset(hot, 0, sizeof(hot));
+	for (uint32_t i = 0; i < n; i++){
+		uint32_t frames = FileList[order[i]].nframes;
+		uint16_t c = FileList[order[i]].hot;
+
+		if (c == 0 || c > hot_cartridges || frames > room[c - 1]){
+			for (c = 1; c <= hot_cartridges && frames > room[c - 1]; c++);
+		}
+		if (c <= hot_cartridges){
+			hot[order[i]] = c;
+			room[c - 1] -= frames;
+		}
+	}
+
+	//make room first, then move in
+	for (uint32_t i = 0; i < n && hot_cartridges > 0; i++){
+		if (!hot[order[i]]){
+			moved += migrate_file(order[i], 0, seen);
+		}
+	}
+	for (uint32_t i = 0; i < n && hot_cartridges > 0; i++){
+		if (hot[order[i]]){
+			moved += migrate_file(order[i], hot[order[i]], seen);
+		}
+	}
+
+	//age the heat so the picture follows the workload
+	for (uint32_t i = 0; i < n; i++){
+		pthread_mutex_lock(&FileList[order[i]].lock);
+		FileList[order[i]].heat /= 2;
+		pthread_mutex_unlock(&FileList[order[i]].lock);
+	}
+
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : migrator
+// Description  : the background migrator, runs a round whenever enough
+//                foreground I/O happened since the last one
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *migrator(void *arg){
+	uint64_t seen = atomic_load(&foreground_ops);
+	uint64_t last = seen;
+	struct timespec wake;
+
+	pthread_mutex_lock(&migrate_lock);
+	while (migrator_running){
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_nsec += CART_MIGRATE_INTERVAL_MS * 1000000L;
+		if (wake.tv_nsec >= 1000000000L){
+			wake.tv_sec += 1;
+			wake.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&migrate_wake, &migrate_lock, &wake);
+
+		uint64_t now = atomic_load(&foreground_ops);
+		if (!migrator_running || now - last < CART_MIGRATE_MIN_OPS){
+			continue;
+		}
+		last = now;
+
+		pthread_mutex_unlock(&migrate_lock);
+		uint32_t moved = migrate_round(&seen);
+		pthread_mutex_lock(&migrate_lock);
+		migrate_frames_moved += moved;
+		migrate_rounds += 1;
+	}
+	pthread_mutex_unlock(&migrate_lock);
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stop_migrator
+// Description  : stop the background migrator if it is running
+//
+// Inputs       : none
+// Outputs      : none
+
+void stop_migrator(void){
+	pthread_mutex_lock(&migrate_lock);
+	if (!migrator_running){
+		pthread_mutex_unlock(&migrate_lock);
+		return;
+	}
+	migrator_running = 0;
+	pthread_cond_signal(&migrate_wake);
+	pthread_mutex_unlock(&migrate_lock);
+	pthread_join(migrator_thread, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_hot_cold
+// Description  : Keep the most used files on the first "hot" cartridges,
+//                with a background migrator moving frames as the heat
+//                changes.  Not available with the log-structured layout.
+//
+// Inputs       : hot - the number of hot cartridges, 0 turns placement off
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_hot_cold(uint16_t hot) {
+
+	if (hot >= cart_bus_cartridges || (hot > 0 && log_structured)){
+		return (-1);
+	}
+
+	stop_migrator();
+	hot_cartridges = hot;
+	for (int i = 1; i < CART_MAX_TOTAL_FILES; i++){
+		FileList[i].hot = 0;
+	}
+	if (hot == 0){
+		return (0);
+	}
+
+	migrator_running = 1;
+	if (pthread_create(&migrator_thread, NULL, migrator, NULL) != 0){
+		logMessage(LOG_ERROR_LEVEL, "CART driver: failed to start the migrator.");
+		migrator_running = 0;
+		hot_cartridges = 0;
+		return (-1);
+	}
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_striping
+// Description  : Stripe a file over several servers (RAID-0): stripe unit
+//                k, a run of "unit" frames, goes to the k-th of "width"
+//                servers in turn, so a large read or write keeps all of
+//                them busy at once.  Only for a file with no frames yet,
+//                not with the log-structured layout.
+//
+// Inputs       : fd - the file, width - servers to stripe over (0 or 1
+//                turns it off), unit - frames in a stripe unit
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_striping(int16_t fd, uint16_t width, uint16_t unit) {
+	struct File *f = &FileList[fd];
+
+	if (!file_ok(fd) || width > cart_bus_servers || (width > 1 && unit == 0) || log_structured){
+		return (-1);
+	}
+
+	pthread_rwlock_wrlock(&f->layout);
+	if (f->nframes > 0){
+		pthread_rwlock_unlock(&f->layout);
+		return (-1);
+	}
+	f->stripe_width = (width > 1) ? width : 0;
+	f->stripe_unit = unit;
+	f->stripe_base = fd % cart_bus_servers;	//files start on different servers
+	pthread_rwlock_unlock(&f->layout);
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_report_stats
+// Description  : Log the driver statistics
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int32_t cart_report_stats(void) {
+
+	if (lfs_user_frames > 0){
+		pthread_mutex_lock(&alloc_lock);
+		logMessage(LOG_OUTPUT_LEVEL, "CART log: %lu frames written, %lu copied by the cleaner, "
+			"write amplification %.2f", (unsigned long)lfs_user_frames, (unsigned long)lfs_cleaner_frames,
+			(double)(lfs_user_frames + lfs_cleaner_frames) / lfs_user_frames);
+		logMessage(LOG_OUTPUT_LEVEL, "CART log: %lu segments cleaned in %.3f ms, %u of %u segments clean",
+			(unsigned long)lfs_segments_cleaned, lfs_cleaner_ns / 1e6, clean_segments, CART_LFS_SEGMENTS);
+		pthread_mutex_unlock(&alloc_lock);
+	}
+	if (defrag_runs > 0){
+		logMessage(LOG_OUTPUT_LEVEL, "CART defrag: %lu frames moved in %lu passes",
+			(unsigned long)defrag_frames_moved, (unsigned long)defrag_runs);
+	}
+	if (clone_frames_shared > 0){
+		logMessage(LOG_OUTPUT_LEVEL, "CART clones: %lu frames shared, %lu copied on write",
+			(unsigned long)clone_frames_shared, (unsigned long)clone_frames_copied);
+	}
+	if (migrate_rounds > 0){
+		logMessage(LOG_OUTPUT_LEVEL, "CART hot/cold: %lu frames migrated in %lu rounds, %u hot cartridges",
+			(unsigned long)migrate_frames_moved, (unsigned long)migrate_rounds, hot_cartridges);
+	}
+
+	//cartridge loads are what placement is there to save
+	uint64_t ops = atomic_load(&foreground_ops) - foreground_base;
+	uint64_t loads = cart_bus_ops[CART_OP_LDCART] - bus_ops_base[CART_OP_LDCART];
+	if (ops > 0){
+		logMessage(LOG_OUTPUT_LEVEL, "CART bus: %lu reads, %lu writes, %lu cartridge loads, "
+			"%.2f LDCART per 1000 operations",
+			(unsigned long)(cart_bus_ops[CART_OP_RDFRME] - bus_ops_base[CART_OP_RDFRME]),
+			(unsigned long)(cart_bus_ops[CART_OP_WRFRME] - bus_ops_base[CART_OP_WRFRME]),
+			(unsigned long)loads, loads * 1000.0 / ops);
+	}
+	client_cart_bus_report();
+
+	// Return successfully
+	return (0);
+}
+
+
+// Unit test
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unit_pattern
+// Description  : fill a buffer with bytes that differ from run to run
+//
+// Inputs       : buf, n - the buffer, seed - picks the bytes
+// Outputs      : none
+
+static void unit_pattern(char *buf, int32_t n, uint32_t seed){
+	for (int32_t i = 0; i < n; i++){
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (char)(seed >> 16);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unit_expect
+// Description  : read a whole file and compare it with what it should hold
+//
+// Inputs       : fd - the file, want, n - the contents, what - for the log
+// Outputs      : 0 if they match, -1 if not
+
+static int unit_expect(int16_t fd, char *want, int32_t n, const char *what){
+	char *got = malloc(n);
+	int ret = 0;
+
+	if (cart_pread(fd, got, n, 0) != n || memcmp(got, want, n) != 0){
+		logMessage(LOG_ERROR_LEVEL, "Driver unit test: %s does not hold what was written.", what);
+		ret = -1;
+	}
+	free(got);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unit_clones
+// Description  : a clone shares the frames of its source until either file
+//                writes one, and writes stay in the file written
+//
+// Inputs       : run - numbers the files of this run
+// Outputs      : 0 if successful, -1 if failure
+
+static int unit_clones(int run){
+	char src_name[CART_MAX_PATH_LENGTH], clone_name[CART_MAX_PATH_LENGTH], patch[200];
+	int32_t n = 3 * CART_FRAME_SIZE + 100;
+	char *src_data = malloc(n), *clone_data = malloc(n);
+	int16_t src, clone = -1;
+	int ret = -1;
+
+	snprintf(src_name, sizeof(src_name), "unit_src%d", run);
+	snprintf(clone_name, sizeof(clone_name), "unit_clone%d", run);
+	unit_pattern(src_data, n, run);
+	src = cart_open(src_name);
+	if (src == -1 || cart_write(src, src_data, n) != n){
+		logMessage(LOG_ERROR_LEVEL, "Driver unit test: cannot write the source file.");
+		goto done;
+	}
+
+	//the clone reads the same from the same frames
+	clone = cart_clone(src, clone_name);
+	memcpy(clone_data, src_data, n);
+	if (clone == -1 || unit_expect(clone, clone_data, n, "a fresh clone") != 0){
+		goto done;
+	}
+	for (uint32_t i = 0; i < FileList[src].nframes; i++){
+		uint32_t ref = FileList[src].frames[i];
+		if (FileList[clone].frames[i] != ref || FrameShares[REF_CART(ref)][REF_FRAME(ref)] == 0){
+			logMessage(LOG_ERROR_LEVEL, "Driver unit test: a clone does not share frame %u.", i);
+			goto done;
+		}
+	}
+
+	//a write to either copies only the frames it touches
+	unit_pattern(patch, sizeof(patch), run + 100);
+	memcpy(&clone_data[CART_FRAME_SIZE - 100], patch, sizeof(patch));
+	if (cart_pwrite(clone, patch, sizeof(patch), CART_FRAME_SIZE - 100) != sizeof(patch) ||
+			unit_expect(clone, clone_data, n, "the written clone") != 0 ||
+			unit_expect(src, src_data, n, "the source after a clone write") != 0){
+		goto done;
+	}
+	if (FileList[clone].frames[0] == FileList[src].frames[0] ||
+			FileList[clone].frames[1] == FileList[src].frames[1] ||
+			FileList[clone].frames[2] != FileList[src].frames[2]){
+		logMessage(LOG_ERROR_LEVEL, "Driver unit test: a clone write copied the wrong frames.");
+		goto done;
+	}
+	memcpy(&src_data[2 * CART_FRAME_SIZE + 50], "source", 6);
+	if (cart_pwrite(src, "source", 6, 2 * CART_FRAME_SIZE + 50) != 6 ||
+			unit_expect(src, src_data, n, "the written source") != 0 ||
+			unit_expect(clone, clone_data, n, "the clone after a source write") != 0){
+		goto done;
+	}
+	ret = 0;
+
+done:
+	if (clone != -1){
+		cart_close(clone);
+	}
+	if (src != -1){
+		cart_close(src);
+	}
+	free(src_data);
+	free(clone_data);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unit_partial_writes
+// Description  : writes of part of a frame read back right from the cache
+//                and from the server (sent as partial writes when the
+//                servers take them)
+//
+// Inputs       : run - numbers the files of this run
+// Outputs      : 0 if successful, -1 if failure
+
+static int unit_partial_writes(int run){
+	char name[CART_MAX_PATH_LENGTH], patch[64], frame[CART_FRAME_SIZE];
+	int32_t n = 3 * CART_FRAME_SIZE + 100;
+	char *data = malloc(n);
+	uint64_t partial = cart_bus_partial;
+	int16_t fd;
+	int ret = -1;
+
+	snprintf(name, sizeof(name), "unit_partial%d", run);
+	unit_pattern(data, n, run + 200);
+	fd = cart_open(name);
+	if (fd == -1 || cart_write(fd, data, n) != n){
+		logMessage(LOG_ERROR_LEVEL, "Driver unit test: cannot write the partial write file.");
+		goto done;
+	}
+
+	//small writes at odd places, some across a frame boundary
+	for (int i = 0; i < 8; i++){
+		uint32_t off = (i * 389 + 7) % (n - 40), len = 1 + i * 5;
+		unit_pattern(patch, len, run * 8 + i);
+		memcpy(&data[off], patch, len);
+		if (cart_pwrite(fd, patch, len, off) != (int32_t)len){
+			logMessage(LOG_ERROR_LEVEL, "Driver unit test: a write of part of a frame failed.");
+			goto done;
+		}
+	}
+	if (unit_expect(fd, data, n, "the file after small writes") != 0 || cart_fsync(fd) != 0){
+		goto done;
+	}
+
+	//what the server holds, past the cache
+	for (uint32_t i = 0; i < FileList[fd].nframes; i++){
+		uint32_t ref = FileList[fd].frames[i];
+		int32_t len = (n - (int32_t)(i * CART_FRAME_SIZE) < CART_FRAME_SIZE) ? n - i * CART_FRAME_SIZE : CART_FRAME_SIZE;
+		reads(REF_CART(ref), REF_FRAME(ref), frame);
+		if (memcmp(frame, &data[i * CART_FRAME_SIZE], len) != 0){
+			logMessage(LOG_ERROR_LEVEL, "Driver unit test: the server does not hold the writes to frame %u.", i);
+			goto done;
+		}
+	}
+	if (write_through && (cart_bus_features & CART_FEATURE_PARTIAL) && cart_bus_partial == partial){
+		logMessage(LOG_ERROR_LEVEL, "Driver unit test: the server takes partial writes, none were sent.");
+		goto done;
+	}
+	ret = 0;
+
+done:
+	if (fd != -1){
+		cart_close(fd);
+	}
+	free(data);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartDriverUnitTest
+// Description  : Run a UNIT test of the driver against the server, the
+//                driver has to be powered on
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cartDriverUnitTest(void){
+	static int runs = 0;	// each run its own files, the driver stays on
+	int run = runs++;
+
+	if (unit_clones(run) != 0){
+		return (-1);
+	}
+	logMessage(LOG_INFO_LEVEL, "Driver unit test: clones passed.");
+	if (unit_partial_writes(run) != 0){
+		return (-1);
 	}
+	logMessage(LOG_INFO_LEVEL, "Driver unit test: partial writes passed (%s).",
+		(cart_bus_features & CART_FEATURE_PARTIAL) ? "sent as partial writes" : "the server takes whole frames only");
 
 	// Return successfully
+	logMessage(LOG_OUTPUT_LEVEL, "Driver unit test completed successfully.");
 	return (0);
 }
@@ -14,14 +14,38 @@
 // Include files
 #include <stdint.h>
 #include <cart_controller.h>
+#include <cart_network.h>
 
 // Defines
 #define CART_MAX_TOTAL_FILES 1024 // Maximum number of files ever
 #define CART_MAX_PATH_LENGTH 128 // Maximum length of filename length
 
 
+// Operations accepted by the asynchronous ring
+typedef enum {
+	CART_RING_READ  = 0,  // cart_read into buf
+	CART_RING_WRITE = 1,  // cart_write from buf
+	CART_RING_FSYNC = 2,  // cart_fsync of the file
+} CartRingOps;
+
+// A request on the submission ring
+typedef struct {
+	uint8_t   op;         // one of CartRingOps
+	int16_t   fd;         // file handle
+	void     *buf;        // data buffer, must stay valid until completion
+	int32_t   count;      // number of bytes to read or write
+	int64_t   offset;     // file offset, -1 to use (and move) the file position
+	uint64_t  user_data;  // handed back untouched in the completion
+} CartRingSqe;
+
+// A result on the completion ring
+typedef struct {
+	uint64_t  user_data;  // from the request
+	int32_t   result;     // what the driver call returned
+} CartRingCqe;
+
 //cartridge map with file id for each frame.
-int16_t CartridgeMap[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE];
+int16_t CartridgeMap[CART_BUS_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE];
 //int NewFrameMap[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE];
 
 //
@@ -47,6 +71,65 @@ int32_t cart_write(int16_t fd, void *buf, int32_t count);
 int32_t cart_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int32_t cart_pread(int16_t fd, void *buf, int32_t count, uint32_t off);
+	// Reads "count" bytes at offset "off" without moving the file position
+
+int32_t cart_pwrite(int16_t fd, void *buf, int32_t count, uint32_t off);
+	// Writes "count" bytes at offset "off" without moving the file position
+
+int32_t cart_fsync(int16_t fd);
+	// Write the buffered frames of a file to the bus
+
+int32_t cart_sync(void);
+	// Write all buffered frames to the bus
+
+int32_t cart_set_write_through(int enable);
+	// Write frames to the bus as they change (1) or buffer them until a sync (0)
+
+int32_t cart_set_log_structured(int enable);
+	// Append all writes to a log with a background cleaner (before any writes)
+
+int32_t cart_defrag(void);
+	// Make every open file as contiguous as possible, safe while in use
+
+int16_t cart_clone(int16_t src, char *path);
+	// Copy a file without copying frames, they are copied when written
+
+int16_t cart_snapshot(int16_t src, char *path);
+	// Take a read-only point-in-time copy of a file (shares frames)
+
+int32_t cart_set_hot_cold(uint16_t hot);
+	// Keep the busiest files on the first "hot" cartridges (0 turns it off)
+
+int32_t cart_set_striping(int16_t fd, uint16_t width, uint16_t unit);
+	// Stripe a new file over "width" servers, "unit" frames at a time
+
+int32_t cart_file_layout(int16_t fd, uint32_t *extents, uint32_t *cartridges);
+	// Measure a file's fragmentation (runs of adjacent frames, cartridges)
+
+int32_t cart_report_stats(void);
+	// Log the driver statistics
+
+int cartDriverUnitTest(void);
+	// Check the driver against the server (powered on)
+
+//
+// Asynchronous ring interface (cart_ring.c), requests run at the same time
+// on a pool of I/O threads and may complete out of order, those using the
+// file position run in order on each file
+
+int32_t cart_ring_init(uint32_t entries);
+	// Create the submission/completion rings and start the I/O threads
+
+int32_t cart_ring_submit(CartRingSqe *sqe);
+	// Queue a request, returns -1 if the submission ring is full
+
+int32_t cart_ring_reap(CartRingCqe *cqe, int wait);
+	// Take the next completion, returns 1 if one was reaped, 0 if none
+
+int32_t cart_ring_exit(void);
+	// Drain the queued requests and stop the I/O threads
+
 
 #endif
 
@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_hist.c
+//  Description    : This is the latency histogram.  Values below
+//                   2 * CART_HIST_SUB_BUCKETS have a bucket each; above that
+//                   a value with its top bit at b goes to the bucket of its
+//                   next CART_HIST_SUB_BITS bits within the buckets of b.
+//
+//  Author         : Jason Jincheng Tu
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <string.h>
+
+// Project Include Files
+#include <cart_hist.h>
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hist_index / hist_value
+// Description  : the bucket of a value, and the largest value in a bucket
+//
+// Inputs       : v - the value / i - the bucket
+// Outputs      : the bucket / the value
+
+static uint32_t hist_index(uint64_t v) {
+	uint32_t top;
+
+	if (v < 2 * CART_HIST_SUB_BUCKETS) {
+		return( v );
+	}
+	top = 63 - __builtin_clzll(v);
+	return( (top - CART_HIST_SUB_BITS + 1) * CART_HIST_SUB_BUCKETS +
+		((v >> (top - CART_HIST_SUB_BITS)) - CART_HIST_SUB_BUCKETS) );
+}
+
+static uint64_t hist_value(uint32_t i) {
+	uint32_t shift;
+
+	if (i < 2 * CART_HIST_SUB_BUCKETS) {
+		return( i );
+	}
+	shift = i / CART_HIST_SUB_BUCKETS - 1;
+	return( (((uint64_t)(i % CART_HIST_SUB_BUCKETS + CART_HIST_SUB_BUCKETS) + 1) << shift) - 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_hist_reset
+// Description  : Empty a histogram
+//
+// Inputs       : h - the histogram
+// Outputs      : none
+
+void cart_hist_reset(CartHistogram *h) {
+	memset(h, 0, sizeof(CartHistogram));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_hist_record
+// Description  : Add a value
+//
+// Inputs       : h - the histogram, ns - the value
+// Outputs      : none
+
+void cart_hist_record(CartHistogram *h, uint64_t ns) {
+	uint64_t seen;
+
+	atomic_fetch_add_explicit(&h->buckets[hist_index(ns)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum, ns, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+
+	//both ends only go up, the minimum is kept upside down
+	seen = atomic_load_explicit(&h->low, memory_order_relaxed);
+	while ( (UINT64_MAX - ns > seen) && !atomic_compare_exchange_weak(&h->low, &seen, UINT64_MAX - ns) );
+	seen = atomic_load_explicit(&h->max, memory_order_relaxed);
+	while ( (ns > seen) && !atomic_compare_exchange_weak(&h->max, &seen, ns) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_hist_min
+// Description  : The smallest value
+//
+// Inputs       : h - the histogram
+// Outputs      : the value
+
+uint64_t cart_hist_min(CartHistogram *h) {
+	return( atomic_load(&h->count) ? UINT64_MAX - atomic_load(&h->low) : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_hist_percentile
+// Description  : The value a share of the values are at or below, as the
+//                top of its bucket (never above the largest value)
+//
+// Inputs       : h - the histogram, percentile - 0 to 100
+// Outputs      : the value
+
+uint64_t cart_hist_percentile(CartHistogram *h, double percentile) {
+	uint64_t count = atomic_load(&h->count), max = atomic_load(&h->max), want, seen = 0;
+
+	if (count == 0) {
+		return( 0 );
+	}
+	want = (uint64_t)(percentile / 100.0 * count + 0.5);
+	want = (want < 1) ? 1 : (want > count) ? count : want;
+	for (uint32_t i = 0; i < CART_HIST_BUCKETS; i++) {
+		seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+		if (seen >= want) {
+			return( (hist_value(i) < max) ? hist_value(i) : max );
+		}
+	}
+	return( max );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_hist_mean
+// Description  : The mean of the values
+//
+// Inputs       : h - the histogram
+// Outputs      : the mean
+
+double cart_hist_mean(CartHistogram *h) {
+	uint64_t count = atomic_load(&h->count);
+
+	return( count ? (double)atomic_load(&h->sum) / count : 0.0 );
+}
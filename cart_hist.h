@@ -0,0 +1,53 @@
+#ifndef CART_HIST_INCLUDED
+#define CART_HIST_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_hist.h
+//  Description    : This is the header file for the latency histograms, in
+//                   the style of HdrHistogram: a value lands in a bucket of
+//                   its power of two split CART_HIST_SUB_BUCKETS ways, so any
+//                   percentile is within 1/64 of the true value whatever the
+//                   range, in fixed memory.  Recording is lock-free.
+//
+//  Author         : Jason Jincheng Tu
+//  Last Modified  : 10/18/2026
+//
+
+// Include files
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Defines
+#define CART_HIST_SUB_BITS 6
+#define CART_HIST_SUB_BUCKETS (1 << CART_HIST_SUB_BITS)
+#define CART_HIST_BUCKETS ((64 - CART_HIST_SUB_BITS + 1) * CART_HIST_SUB_BUCKETS)
+
+// A histogram of nanoseconds
+typedef struct {
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum;
+	_Atomic uint64_t low;   // UINT64_MAX - the smallest value, so zeroed is empty
+	_Atomic uint64_t max;
+	_Atomic uint64_t buckets[CART_HIST_BUCKETS];
+} CartHistogram;
+
+//
+// Functional Prototypes
+
+void cart_hist_reset(CartHistogram *h);
+	// Empty a histogram (one that is zeroed is empty too)
+
+void cart_hist_record(CartHistogram *h, uint64_t ns);
+	// Add a value, safe from any thread
+
+uint64_t cart_hist_min(CartHistogram *h);
+	// The smallest value, 0 if empty
+
+uint64_t cart_hist_percentile(CartHistogram *h, double percentile);
+	// The value <percentile> (0-100) of the values are at or below, 0 if empty
+
+double cart_hist_mean(CartHistogram *h);
+	// The mean of the values, 0 if empty
+
+#endif
@@ -14,25 +14,112 @@
 
 // Project Include Files
 #include <cart_controller.h>
+#include <cart_hist.h>
 
 // Defines
 #define CART_MAX_BACKLOG 5
 #define CART_NET_HEADER_SIZE sizeof(CartXferRegister)
 #define CART_DEFAULT_IP "127.0.0.1"
 #define CART_DEFAULT_PORT 21785
+#define CART_PIPELINE_DEPTH 32 // Requests kept in flight on the connection
+#define CART_SOCKET_BUFFER (4 * CART_PIPELINE_DEPTH * (CART_NET_HEADER_SIZE + CART_FRAME_SIZE))
+
+// Protocol extensions, asked for in KY2 of INITMS.  A server that knows
+// them answers with the ones it supports and CART_FEATURE_ASK cleared, the
+// reference server echoes the register and so is left on the classic
+// protocol.
+#define CART_FEATURE_ASK   0x80  // KY2 of INITMS: features are being asked for
+#define CART_FEATURE_BATCH 0x01  // RDFRME/WRFRME of a run of frames
+#define CART_FEATURE_PARTIAL 0x02 // WRFRME of part of a frame, KY2 of the
+                                  // request has it set and the payload is
+                                  // offset, length (16 bits each, network
+                                  // order) then the bytes
+#define CART_FEATURE_COMPRESS 0x04 // Frames go through cart_codec, each with
+                                   // a 2 byte header (length, raw flag)
+#define CART_FEATURE_CARTS 0x08 // The INITMS answer has the cartridges the
+                                // server gives this client in CT1 (a proxy
+                                // splitting its cartridges between clients)
+                                // and in FM1 whose they are, 0 if every
+                                // client of the server sees the same ones
+#define CART_BATCH_MAX_FRAMES 64 // Longest run the client sends
+#define CART_BATCH_MASK 0x7fff   // Frame count of a batch, in the unused low bits
+#define CART_BATCH_FRAMES(r) (((r) & CART_BATCH_MASK) ? ((r) & CART_BATCH_MASK) : 1)
+
+// Scale-out, the cartridges of several servers make one address space.
+// Cartridge c of the driver is cartridge CART_BUS_LOCAL(c) of server
+// CART_BUS_SERVER(c), so neighbouring cartridges sit on different servers.
+// Every cartridge request carries its cartridge in CT1 for the routing.
+#define CART_MAX_SERVERS 8     // Most servers in cart_network_uri
+#define CART_BUS_MAX_CARTRIDGES (CART_MAX_SERVERS * CART_MAX_CARTRIDGES)
+#define CART_BUS_SERVER(c) ((c) % cart_bus_servers)
+#define CART_BUS_LOCAL(c) ((c) / cart_bus_servers)
+#define CART_BUS_CART(s, l) ((l) * cart_bus_servers + (s))
+
+// A request whose answer a thread waits for, see client_cart_bus_send
+typedef struct {
+	int              server;  // where it went, -1 if it was not sent
+	int              done;    // set once answered (or lost)
+	int              status;  // 0 answered, 1 failed by the server (RT1), -1 lost
+	CartXferRegister result;  // the answer
+} CartBusTicket;
 
 // Global data
 extern int            cart_network_shutdown; // Flag indicating shutdown
 extern char	     *cart_network_address;  // Address of CART server
 extern unsigned short cart_network_port;     // Port of CART server
+extern char          *cart_network_uri;      // tcp://, unix:// or shm:// servers (comma
+                                             // separated), if set
+extern int            cart_network_compress; // Ask the server for compressed frames
+extern char          *cart_network_trace;    // Record the bus traffic to this file, if set
+extern uint64_t       cart_bus_ops[CART_OP_MAXVAL]; // Requests sent, by opcode
+extern CartHistogram  cart_bus_latency[CART_OP_MAXVAL]; // Time from a request to its answer, by opcode
+extern uint8_t        cart_bus_features;     // Extensions every server agreed to
+extern uint64_t       cart_bus_partial;      // Partial frame writes sent
+extern int            cart_bus_servers;      // Servers connected (1 before connecting)
+extern uint16_t       cart_bus_cartridges;   // Cartridges on all of them
+
+// Stand-in server configuration (cart_server.c)
+extern char          *cart_server_uri;       // Transport to listen on, TCP if NULL
+extern unsigned short cart_server_port;      // TCP port when there is no URI
+extern char          *cart_server_backing;   // File backing the cartridges, memory if NULL
+extern uint64_t       cart_server_op_ns[CART_OP_MAXVAL]; // Delay added to each opcode
+extern uint64_t       cart_server_byte_ns;   // Delay added per frame byte moved
 
 //
 // Functional Prototypes
 
+int client_cart_bus_connect(void);
+	// Connect to the servers (done at power on, before any request), over
+	// the transports in cart_network_uri or else TCP
+
 CartXferRegister client_cart_bus_request(CartXferRegister reg, void *buf);
 	// This is the implementation of the client operation (cart_client.c)
 
+int client_cart_bus_submit(CartXferRegister reg, void *buf);
+	// Send a request without waiting for the answer (pipelined, in order),
+	// a batch read or write moves CART_BATCH_FRAMES(reg) frames at buf
+
+int client_cart_bus_submit_partial(CartXferRegister reg, uint16_t off, uint16_t len, void *data);
+	// Send a write of len bytes at off in a frame without waiting
+
+int client_cart_bus_send(CartXferRegister reg, void *buf, CartBusTicket *ticket);
+	// Send a request to one server without waiting, the answer goes to
+	// the ticket (the sender must be serialized, the waiter need not be)
+
+CartXferRegister client_cart_bus_wait(CartBusTicket *ticket);
+	// Wait for the answer to a request sent with a ticket
+
+int client_cart_bus_flush(void);
+	// Wait for every request in flight, returns the number that failed
+
+void client_cart_bus_report(void);
+	// Log the request latencies by opcode
+
+uint64_t client_cart_bus_id(void);
+	// A hash of the servers connected and the cartridges they gave us
+
 int cart_server( void );
-	// This is the implementation of the server application (cart_server.c)
+	// This is the implementation of the server application (cart_server.c),
+	// it runs until SIGINT or SIGTERM
 
 #endif
@@ -0,0 +1,1104 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_proxy.c
+//  Description    : This is a local proxy for the CART servers.  Client
+//                   processes on the host connect to it (over a Unix-domain
+//                   socket by default) and speak the CART protocol as if it
+//                   were a server.  It owns the server connection(s) and one
+//                   frame cache for all of them: reads of a frame already on
+//                   its way wait for it instead of going out again, and the
+//                   requests of all clients go to the servers ordered by
+//                   cartridge.
+//
+//                   A client's driver owns every cartridge it sees (it zeroes
+//                   them all at power on and allocates from the first), so
+//                   by default the cartridges are split between the sessions
+//                   (-n of them at a time, the INITMS answer tells a client
+//                   how many it has) and a client beyond that is refused.
+//                   Split sessions never ask for the same frame, the cache
+//                   and the coalescing only serve each client's own reads.
+//                   With -a every session sees all the cartridges and only
+//                   the first to power on zeroes them: for clients reading
+//                   the same data, whose reads coalesce.  The proxy does not
+//                   share out the frames, clients writing in that mode have
+//                   to keep to their own.
+//
+//                   A client's LDCART only selects the cartridge of its
+//                   session, the servers see a load when a round of
+//                   requests needs one.
+//
+//   Author        : Jason Jincheng Tu
+//   Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <cart_network.h>
+#include <cart_transport.h>
+#include <cart_controller.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CART_PROXY_ARGUMENTS "hval:t:s:c:n:"
+#define CART_PROXY_DEFAULT_URI "unix:///tmp/cart_proxy.sock"
+#define CART_PROXY_CACHE_FRAMES 4096 // Default frames in the shared cache
+#define CART_PROXY_SESSIONS 4        // Default sessions the cartridges are split between
+#define CART_PROXY_MAX_SESSIONS 64   // Most clients at a time
+#define USAGE \
+	"USAGE: cart_proxy [-h] [-v] [-a] [-l <logfile>] [-t <uri>] [-s <uri>[,<uri>...]] [-c <frames>]\n" \
+	"                  [-n <sessions>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -t - where the clients connect: unix:///path (default " CART_PROXY_DEFAULT_URI ")\n" \
+	"         or tcp://ip:port\n" \
+	"    -s - the CART server(s), as for cart_sim -t (default tcp on the default port)\n" \
+	"    -c - frames in the shared cache (default 4096)\n" \
+	"    -n - clients at a time (default 4), each gets its share of the\n" \
+	"         cartridges unless -a, a client beyond that is refused\n" \
+	"    -a - every client sees all the cartridges (only the first to power\n" \
+	"         on zeroes them), for clients reading the same data; writers\n" \
+	"         must keep to frames of their own (default 64 clients)\n" \
+	"\n"
+
+// The states of a cached frame
+typedef enum {
+	PROXY_FRAME_VALID   = 0,  // the data is the frame
+	PROXY_FRAME_LOADING = 1,  // a read is on its way, wait for it
+} ProxyFrameState;
+
+// A frame in the shared cache
+typedef struct proxy_frame {
+	struct proxy_frame *hash_next;  // chain of the hash bucket
+	struct proxy_frame *lru_prev;   // towards the most recently used
+	struct proxy_frame *lru_next;   // towards the least recently used
+	CartridgeIndex cart;
+	CartFrameIndex frm;
+	ProxyFrameState state;
+	int cached;                     // in the cache, not on the free list
+	int stale;                      // zeroed while loading, drop it when it arrives
+	char data[CART_FRAME_SIZE];
+} proxy_frame;
+
+// A request of a client waiting for the servers
+typedef struct proxy_op {
+	struct proxy_op *next;
+	int op;                         // CART_OP_RDFRME, CART_OP_WRFRME or CART_OP_BZERO
+	CartridgeIndex cart;
+	CartFrameIndex frm;
+	uint32_t n;                     // frames, from frm on
+	char *buf;                      // where a read goes or a write comes from
+	uint64_t seq;                   // order of arrival
+	int done, failed;
+} proxy_op;
+
+//
+// Global data
+volatile sig_atomic_t proxy_stop = 0;  // set by SIGINT/SIGTERM
+uint32_t        cache_frames = CART_PROXY_CACHE_FRAMES;
+
+//the shared cache, everything under cache_lock
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  frame_ready = PTHREAD_COND_INITIALIZER; // a frame stopped loading
+proxy_frame    *frame_pool = NULL;
+proxy_frame   **hash_table = NULL;
+uint32_t        hash_mask;
+proxy_frame    *free_frames = NULL;
+proxy_frame    *lru_head = NULL, *lru_tail = NULL;
+
+//requests for the servers, and the thread that sends them
+pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  queue_wake = PTHREAD_COND_INITIALIZER;  // something was queued
+pthread_cond_t  op_done = PTHREAD_COND_INITIALIZER;     // a round was answered
+proxy_op       *queue_head = NULL, **queue_tail = &queue_head;
+uint64_t        queue_seq = 0;
+pthread_t       scheduler_thread;
+int             server_cart = -1;                       // loaded by the last round, -1 for none
+
+//the sessions, each owns session_carts cartridges from slot * session_carts on
+//unless they all see the same ones
+pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  zero_done = PTHREAD_COND_INITIALIZER;   // a cartridge finished zeroing
+int             session_used[CART_PROXY_MAX_SESSIONS];
+int             sessions_open = 0;
+int             max_sessions = 0;                       // -n, 0 for the default
+uint32_t        session_carts;                          // cartridges a session sees
+int             shared_carts = 0;                       // -a, the sessions share the cartridges
+uint8_t         carts_zeroed[CART_BUS_MAX_CARTRIDGES];  // -a: 1 zeroing, 2 zeroed since the sessions began
+
+//statistics, under cache_lock (reads) or queue_lock (the rest)
+uint64_t proxy_clients, proxy_reads, proxy_hits, proxy_coalesced, proxy_fetched;
+uint64_t proxy_writes, proxy_rounds, proxy_ops, proxy_loads, proxy_client_loads, proxy_refused;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stop_proxy
+// Description  : signal handler, stop taking clients
+//
+// Inputs       : sig - the signal
+// Outputs      : none
+
+static void stop_proxy(int sig) {
+	proxy_stop = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_register
+// Description  : pack the fields of a request to the servers
+//
+// Inputs       : op - the opcode, cart, frm - the frame, n - batch count
+// Outputs      : the register
+
+static CartXferRegister cart_register(int op, CartridgeIndex cart, CartFrameIndex frm, uint32_t n) {
+	return( ((uint64_t)op << 56) | ((uint64_t)cart << 31) | ((uint64_t)frm << 15) | n );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_of
+// Description  : the bucket of a frame
+//
+// Inputs       : cart, frm - the frame
+// Outputs      : the bucket
+
+static uint32_t hash_of(CartridgeIndex cart, CartFrameIndex frm) {
+	return( ((uint32_t)cart * 2654435761U ^ frm * 40503U) & hash_mask );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookup_frame
+// Description  : find a frame in the cache, the caller holds cache_lock
+//
+// Inputs       : cart, frm - the frame
+// Outputs      : the frame, NULL if it is not cached
+
+static proxy_frame *lookup_frame(CartridgeIndex cart, CartFrameIndex frm) {
+	proxy_frame *f;
+
+	for (f = hash_table[hash_of(cart, frm)]; f != NULL; f = f->hash_next) {
+		if ( (f->cart == cart) && (f->frm == frm) ) {
+			return( f );
+		}
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lru_unlink
+// Description  : take a frame off the LRU list, the caller holds cache_lock
+//
+// Inputs       : f - the frame
+// Outputs      : none
+
+static void lru_unlink(proxy_frame *f) {
+	if (f->lru_prev != NULL) {
+		f->lru_prev->lru_next = f->lru_next;
+	} else {
+		lru_head = f->lru_next;
+	}
+	if (f->lru_next != NULL) {
+		f->lru_next->lru_prev = f->lru_prev;
+	} else {
+		lru_tail = f->lru_prev;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : touch_frame
+// Description  : make a frame the most recently used, the caller holds
+//                cache_lock
+//
+// Inputs       : f - the frame
+// Outputs      : none
+
+static void touch_frame(proxy_frame *f) {
+	lru_unlink(f);
+	f->lru_prev = NULL;
+	f->lru_next = lru_head;
+	if (lru_head != NULL) {
+		lru_head->lru_prev = f;
+	}
+	lru_head = f;
+	if (lru_tail == NULL) {
+		lru_tail = f;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_frame
+// Description  : remove a frame from the cache, the caller holds cache_lock
+//
+// Inputs       : f - the frame
+// Outputs      : none
+
+static void drop_frame(proxy_frame *f) {
+	proxy_frame **link = &hash_table[hash_of(f->cart, f->frm)];
+
+	while (*link != f) {
+		link = &(*link)->hash_next;
+	}
+	*link = f->hash_next;
+	lru_unlink(f);
+	f->cached = 0;
+	f->hash_next = free_frames;
+	free_frames = f;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : new_frame
+// Description  : add a frame to the cache, evicting the least recently used
+//                frame that is not loading if the cache is full.  The
+//                caller holds cache_lock.
+//
+// Inputs       : cart, frm - the frame, state - what it starts out as
+// Outputs      : the frame, NULL if every frame is loading
+
+static proxy_frame *new_frame(CartridgeIndex cart, CartFrameIndex frm, ProxyFrameState state) {
+	proxy_frame *f, **bucket;
+
+	if (free_frames == NULL) {
+		for (f = lru_tail; (f != NULL) && (f->state != PROXY_FRAME_VALID); f = f->lru_prev);
+		if (f == NULL) {
+			return( NULL );
+		}
+		drop_frame(f);
+	}
+	f = free_frames;
+	free_frames = f->hash_next;
+
+	f->cart = cart;
+	f->frm = frm;
+	f->state = state;
+	f->cached = 1;
+	f->stale = 0;
+	bucket = &hash_table[hash_of(cart, frm)];
+	f->hash_next = *bucket;
+	*bucket = f;
+	f->lru_prev = f->lru_next = NULL;
+	if (lru_head == NULL) {
+		lru_head = lru_tail = f;
+	} else {
+		touch_frame(f);
+	}
+	return( f );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_cache
+// Description  : allocate the shared cache
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int init_cache(void) {
+	uint32_t buckets = 1;
+
+	while (buckets < cache_frames) {
+		buckets <<= 1;
+	}
+	hash_mask = buckets - 1;
+	frame_pool = calloc(cache_frames, sizeof(proxy_frame));
+	hash_table = calloc(buckets, sizeof(proxy_frame *));
+	if ( (frame_pool == NULL) || (hash_table == NULL) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART proxy: cannot allocate a cache of %u frames.", cache_frames);
+		return( -1 );
+	}
+	for (uint32_t i = 0; i < cache_frames; i++) {
+		frame_pool[i].hash_next = free_frames;
+		free_frames = &frame_pool[i];
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : run_ops
+// Description  : queue requests for the servers and wait until they are
+//                answered
+//
+// Inputs       : ops - the requests, n - how many
+// Outputs      : 0 if successful, -1 if any of them failed
+
+static int run_ops(proxy_op *ops, uint32_t n) {
+	int failed = 0;
+
+	pthread_mutex_lock(&queue_lock);
+	for (uint32_t i = 0; i < n; i++) {
+		ops[i].next = NULL;
+		ops[i].seq = queue_seq++;
+		ops[i].done = ops[i].failed = 0;
+		*queue_tail = &ops[i];
+		queue_tail = &ops[i].next;
+	}
+	pthread_cond_signal(&queue_wake);
+	for (uint32_t i = 0; i < n; i++) {
+		while (!ops[i].done) {
+			pthread_cond_wait(&op_done, &queue_lock);
+		}
+		failed |= ops[i].failed;
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	return( failed ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_read
+// Description  : read frames for a client, from the cache where they are,
+//                by waiting where another client's read is on its way, and
+//                from the servers for the rest
+//
+// Inputs       : cart, frm - the first frame, n - how many
+//                out - where the frames go
+// Outputs      : 0 if successful, -1 if failure
+
+static int proxy_read(CartridgeIndex cart, CartFrameIndex frm, uint32_t n, char *out) {
+	proxy_op ops[CART_BATCH_MAX_FRAMES];
+	uint8_t have[CART_CARTRIDGE_SIZE], wait[CART_CARTRIDGE_SIZE];
+	uint32_t left = n, count, i;
+	proxy_frame *f;
+
+	memset(have, 0, n);
+	pthread_mutex_lock(&cache_lock);
+	proxy_reads += n;
+	while (left > 0) {
+		memset(wait, 0, n);
+		count = 0;
+
+		for (i = 0; i < n; i++) {
+			if (have[i]) {
+				continue;
+			}
+			f = lookup_frame(cart, frm + i);
+			if ( (f != NULL) && (f->state == PROXY_FRAME_VALID) ) {
+				memcpy(&out[i * CART_FRAME_SIZE], f->data, CART_FRAME_SIZE);
+				touch_frame(f);
+				proxy_hits += 1;
+				have[i] = 1;
+				left--;
+			} else if (f != NULL) {
+				//somebody is reading it already
+				proxy_coalesced += 1;
+				wait[i] = 1;
+			} else {
+				//ours to read, runs of missing frames are one request
+				if ( (count > 0) && (ops[count - 1].frm + ops[count - 1].n == frm + i) &&
+						(ops[count - 1].n < CART_BATCH_MAX_FRAMES) ) {
+					ops[count - 1].n++;
+				} else if (count < CART_BATCH_MAX_FRAMES) {
+					ops[count].op = CART_OP_RDFRME;
+					ops[count].cart = cart;
+					ops[count].frm = frm + i;
+					ops[count].n = 1;
+					ops[count].buf = &out[i * CART_FRAME_SIZE];
+					count++;
+				} else {
+					//too scattered for one pass, the next one gets it
+					continue;
+				}
+				new_frame(cart, frm + i, PROXY_FRAME_LOADING);
+				proxy_fetched += 1;
+				have[i] = 1;
+				left--;
+			}
+		}
+
+		//the reads go out together, the frames land in out
+		if (count > 0) {
+			pthread_mutex_unlock(&cache_lock);
+			if (run_ops(ops, count) == -1) {
+				return( -1 );
+			}
+			pthread_mutex_lock(&cache_lock);
+		}
+
+		//then whatever others were reading, looked at again in the next pass
+		for (i = 0; i < n; i++) {
+			while ( wait[i] && ((f = lookup_frame(cart, frm + i)) != NULL) &&
+					(f->state == PROXY_FRAME_LOADING) ) {
+				pthread_cond_wait(&frame_ready, &cache_lock);
+			}
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_write
+// Description  : write frames for a client, through the cache to the
+//                servers
+//
+// Inputs       : cart, frm - the first frame, n - how many
+//                in - the frames
+// Outputs      : 0 if successful, -1 if failure
+
+static int proxy_write(CartridgeIndex cart, CartFrameIndex frm, uint32_t n, char *in) {
+	proxy_op ops[CART_CARTRIDGE_SIZE / CART_BATCH_MAX_FRAMES];
+	uint32_t count = 0;
+	proxy_frame *f;
+
+	//readers see the new frames at once, a read on its way will not
+	//overwrite them
+	pthread_mutex_lock(&cache_lock);
+	for (uint32_t i = 0; i < n; i++) {
+		f = lookup_frame(cart, frm + i);
+		if (f == NULL) {
+			f = new_frame(cart, frm + i, PROXY_FRAME_VALID);
+		}
+		if (f != NULL) {
+			memcpy(f->data, &in[i * CART_FRAME_SIZE], CART_FRAME_SIZE);
+			f->state = PROXY_FRAME_VALID;
+			f->stale = 0;
+			touch_frame(f);
+		}
+	}
+	pthread_cond_broadcast(&frame_ready);
+	pthread_mutex_unlock(&cache_lock);
+
+	for (uint32_t i = 0; i < n; i += CART_BATCH_MAX_FRAMES, count++) {
+		ops[count].op = CART_OP_WRFRME;
+		ops[count].cart = cart;
+		ops[count].frm = frm + i;
+		ops[count].n = (n - i < CART_BATCH_MAX_FRAMES) ? n - i : CART_BATCH_MAX_FRAMES;
+		ops[count].buf = &in[i * CART_FRAME_SIZE];
+	}
+	pthread_mutex_lock(&queue_lock);
+	proxy_writes += n;
+	pthread_mutex_unlock(&queue_lock);
+	return( run_ops(ops, count) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_bzero
+// Description  : zero a cartridge for a client, its cached frames go
+//
+// Inputs       : cart - the cartridge
+// Outputs      : 0 if successful, -1 if failure
+
+static int proxy_bzero(CartridgeIndex cart) {
+	proxy_op op;
+
+	pthread_mutex_lock(&cache_lock);
+	for (uint32_t i = 0; i < cache_frames; i++) {
+		proxy_frame *f = &frame_pool[i];
+		if (f->cached && (f->cart == cart)) {
+			if (f->state == PROXY_FRAME_VALID) {
+				drop_frame(f);
+			} else {
+				//the read was queued before the zeroing, its data is old
+				f->stale = 1;
+			}
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	op.op = CART_OP_BZERO;
+	op.cart = cart;
+	op.frm = 0;
+	op.n = 0;
+	op.buf = NULL;
+	return( run_ops(&op, 1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_ops
+// Description  : order the requests of a round by cartridge, starting from
+//                the one the servers have loaded, then by arrival
+//
+// Inputs       : a, b - pointers to the requests
+// Outputs      : <0, 0, >0 as for qsort
+
+static int compare_ops(const void *a, const void *b) {
+	const proxy_op *x = *(proxy_op * const *)a, *y = *(proxy_op * const *)b;
+	uint32_t base = (server_cart == -1) ? 0 : server_cart;
+	uint32_t cx = (x->cart + cart_bus_cartridges - base) % cart_bus_cartridges;
+	uint32_t cy = (y->cart + cart_bus_cartridges - base) % cart_bus_cartridges;
+
+	if (cx != cy) {
+		return( (cx < cy) ? -1 : 1 );
+	}
+	return( (x->seq < y->seq) ? -1 : (x->seq > y->seq) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : scheduler
+// Description  : the thread talking to the servers.  It takes everything
+//                queued since the last round, sends it ordered by
+//                cartridge in one pipelined round and answers it.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void *scheduler(void *arg) {
+	proxy_op **round = NULL, *op;
+	uint32_t count, room = 0;
+	int failed;
+
+	pthread_mutex_lock(&queue_lock);
+	while (!proxy_stop || (queue_head != NULL)) {
+		if (queue_head == NULL) {
+			pthread_cond_wait(&queue_wake, &queue_lock);
+			continue;
+		}
+
+		//take the whole queue
+		for (count = 0, op = queue_head; op != NULL; op = op->next, count++) {
+			if (count == room) {
+				room = room ? room * 2 : 64;
+				round = realloc(round, room * sizeof(proxy_op *));
+			}
+			round[count] = op;
+		}
+		queue_head = NULL;
+		queue_tail = &queue_head;
+		proxy_rounds += 1;
+		proxy_ops += count;
+		pthread_mutex_unlock(&queue_lock);
+
+		//one load per cartridge, the frames of a request in one batch
+		qsort(round, count, sizeof(proxy_op *), compare_ops);
+		for (uint32_t i = 0; i < count; i++) {
+			op = round[i];
+			if (op->cart != server_cart) {
+				client_cart_bus_submit(cart_register(CART_OP_LDCART, op->cart, 0, 0), NULL);
+				server_cart = op->cart;
+				proxy_loads += 1;
+			}
+			if (op->op == CART_OP_BZERO) {
+				client_cart_bus_submit(cart_register(CART_OP_BZERO, op->cart, 0, 0), NULL);
+			} else if ( (op->n > 1) && (cart_bus_features & CART_FEATURE_BATCH) ) {
+				client_cart_bus_submit(cart_register(op->op, op->cart, op->frm, op->n), op->buf);
+			} else {
+				for (uint32_t k = 0; k < op->n; k++) {
+					client_cart_bus_submit(cart_register(op->op, op->cart, op->frm + k, 0),
+						&op->buf[k * CART_FRAME_SIZE]);
+				}
+			}
+		}
+		failed = (client_cart_bus_flush() != 0);
+
+		//the frames read go in the cache, unless written or zeroed meanwhile
+		pthread_mutex_lock(&cache_lock);
+		for (uint32_t i = 0; i < count; i++) {
+			op = round[i];
+			for (uint32_t k = 0; (op->op == CART_OP_RDFRME) && (k < op->n); k++) {
+				proxy_frame *f = lookup_frame(op->cart, op->frm + k);
+				if ( (f == NULL) || (f->state != PROXY_FRAME_LOADING) ) {
+					continue;
+				}
+				if (failed || f->stale) {
+					drop_frame(f);
+				} else {
+					memcpy(f->data, &op->buf[k * CART_FRAME_SIZE], CART_FRAME_SIZE);
+					f->state = PROXY_FRAME_VALID;
+				}
+			}
+		}
+		pthread_cond_broadcast(&frame_ready);
+		pthread_mutex_unlock(&cache_lock);
+
+		pthread_mutex_lock(&queue_lock);
+		for (uint32_t i = 0; i < count; i++) {
+			round[i]->failed = failed;
+			round[i]->done = 1;
+		}
+		pthread_cond_broadcast(&op_done);
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	free(round);
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : session_start
+// Description  : give a client the cartridges of a free session
+//
+// Inputs       : none
+// Outputs      : the session, -1 if they are all taken
+
+static int session_start(void) {
+	int slot = -1;
+
+	pthread_mutex_lock(&session_lock);
+	for (int i = 0; i < max_sessions; i++) {
+		if (!session_used[i]) {
+			session_used[i] = 1;
+			sessions_open += 1;
+			slot = i;
+			break;
+		}
+	}
+	if (slot == -1) {
+		proxy_refused += 1;
+	}
+	pthread_mutex_unlock(&session_lock);
+	return( slot );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : session_end
+// Description  : give the cartridges of a session back, once they are all
+//                gone the next session zeroes the shared cartridges again
+//
+// Inputs       : slot - the session, -1 for none
+// Outputs      : none
+
+static void session_end(int slot) {
+	if (slot != -1) {
+		pthread_mutex_lock(&session_lock);
+		session_used[slot] = 0;
+		if (--sessions_open == 0) {
+			memset(carts_zeroed, 0, sizeof(carts_zeroed));
+		}
+		pthread_mutex_unlock(&session_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : session_bzero
+// Description  : zero a cartridge for a session.  Shared cartridges are
+//                only zeroed by the first session to ask, the others wait
+//                for that and go on with what is there.
+//
+// Inputs       : cart - the cartridge (on the servers)
+// Outputs      : 0 if successful, -1 if failure
+
+static int session_bzero(CartridgeIndex cart) {
+	int ret = 0;
+
+	if (!shared_carts) {
+		return( proxy_bzero(cart) );
+	}
+
+	pthread_mutex_lock(&session_lock);
+	while (carts_zeroed[cart] == 1) {
+		pthread_cond_wait(&zero_done, &session_lock);
+	}
+	if (carts_zeroed[cart] == 0) {
+		carts_zeroed[cart] = 1;
+		pthread_mutex_unlock(&session_lock);
+		ret = proxy_bzero(cart);
+		pthread_mutex_lock(&session_lock);
+		carts_zeroed[cart] = (ret == 0) ? 2 : 0;
+		pthread_cond_broadcast(&zero_done);
+	}
+	pthread_mutex_unlock(&session_lock);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : xfer_full
+// Description  : move every byte described by an io vector over a socket
+//
+// Inputs       : sock - the socket, out - 1 to send, 0 to receive
+//                iov, cnt - the io vector (changed as it is used up)
+// Outputs      : 0 if successful, -1 if failure
+
+static int xfer_full(int sock, int out, struct iovec *iov, int cnt) {
+
+	while (cnt > 0) {
+		ssize_t n = out ? writev(sock, iov, cnt) : readv(sock, iov, cnt);
+		if (n <= 0) {
+			if ( (n == -1) && (errno == EINTR) && !proxy_stop ) {
+				continue;
+			}
+			return( -1 );
+		}
+		while ( (cnt > 0) && ((size_t)n >= iov->iov_len) ) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serve_client
+// Description  : the thread of one client, answers its requests until it
+//                powers off or goes away
+//
+// Inputs       : arg - the connection (the socket in the pointer)
+// Outputs      : NULL
+
+static void *serve_client(void *arg) {
+	int sock = (int)(intptr_t)arg;
+	CartXferRegister reg, resp;
+	int slot = -1;	//the session, its cartridges on the servers
+	int cart = -1;	//the session's loaded cartridge, on the servers
+	CartFrameIndex frm;
+	struct iovec iov[2];
+	uint32_t n;
+	int op, ret, asked;
+	char *frames = malloc(CART_CARTRIDGE_SIZE * CART_FRAME_SIZE);
+
+	while ( (frames != NULL) && !proxy_stop ) {
+		iov[0].iov_base = &reg;
+		iov[0].iov_len = sizeof(reg);
+		if (xfer_full(sock, 0, iov, 1) == -1) {
+			break;
+		}
+		reg = ntohll64(reg);
+		op = (reg >> 56) & 0xff;
+		frm = (reg >> 15) & 0xffff;
+		n = CART_BATCH_FRAMES(reg);
+		if ( (n > CART_CARTRIDGE_SIZE) || (((reg >> 48) & CART_FEATURE_PARTIAL) && (op == CART_OP_WRFRME)) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART proxy: unsupported request, dropping the client.");
+			break;
+		}
+		if (op == CART_OP_WRFRME) {
+			iov[0].iov_base = frames;
+			iov[0].iov_len = n * CART_FRAME_SIZE;
+			if (xfer_full(sock, 0, iov, 1) == -1) {
+				break;
+			}
+		}
+
+		ret = 0;
+		resp = reg;
+		switch (op) {
+		case CART_OP_INITMS: // the servers are up already, offer batches and tell the cartridges
+			resp &= ~((0xffULL << 48) | (0xffffULL << 31) | (0xffffULL << 15));
+			asked = ((reg >> 48) & CART_FEATURE_ASK) ? (reg >> 48) & CART_FEATURE_CARTS : 0;
+			if ((reg >> 48) & CART_FEATURE_ASK) {
+				resp |= (uint64_t)(CART_FEATURE_BATCH | asked) << 48;
+			}
+			if ( !asked && (session_carts < CART_MAX_CARTRIDGES) ) {
+				logMessage(LOG_ERROR_LEVEL, "CART proxy: a client that cannot take %u cartridges, refusing it.",
+					session_carts);
+				ret = -1;
+				break;
+			}
+			if ( (slot == -1) && ((slot = session_start()) == -1) ) {
+				logMessage(LOG_ERROR_LEVEL, "CART proxy: all %d sessions in use, refusing a client.",
+					max_sessions);
+				ret = -1;
+				break;
+			}
+
+			//the session goes in FM1, clients on other cartridges share no frames
+			if (asked) {
+				resp |= (uint64_t)session_carts << 31;
+				resp |= (uint64_t)(shared_carts ? 0 : slot + 1) << 15;
+			}
+			break;
+
+		case CART_OP_LDCART: // only the session changes
+			cart = (reg >> 31) & 0xffff;
+			if ( (slot == -1) || (cart >= session_carts) ) {
+				cart = -1;
+				ret = -1;
+			} else if (!shared_carts) {
+				cart += slot * session_carts;
+			}
+			pthread_mutex_lock(&queue_lock);
+			proxy_client_loads += 1;
+			pthread_mutex_unlock(&queue_lock);
+			break;
+
+		case CART_OP_BZERO:
+			ret = (cart == -1) ? -1 : session_bzero(cart);
+			break;
+
+		case CART_OP_RDFRME:
+			ret = ( (cart == -1) || (frm + n > CART_CARTRIDGE_SIZE) ) ? -1 :
+				proxy_read(cart, frm, n, frames);
+			if (ret == -1) {
+				memset(frames, 0, n * CART_FRAME_SIZE);
+			}
+			break;
+
+		case CART_OP_WRFRME:
+			ret = ( (cart == -1) || (frm + n > CART_CARTRIDGE_SIZE) ) ? -1 :
+				proxy_write(cart, frm, n, frames);
+			break;
+
+		case CART_OP_POWOFF: // the servers stay up for the other clients
+			session_end(slot);
+			slot = -1;
+			break;
+
+		default:
+			ret = -1;
+		}
+
+		resp = htonll64((ret == -1) ? (resp | (1ULL << 47)) : (resp & ~(1ULL << 47)));
+		iov[0].iov_base = &resp;
+		iov[0].iov_len = sizeof(resp);
+		iov[1].iov_base = frames;
+		iov[1].iov_len = n * CART_FRAME_SIZE;
+		if ( (xfer_full(sock, 1, iov, (op == CART_OP_RDFRME) ? 2 : 1) == -1) || (op == CART_OP_POWOFF) ) {
+			break;
+		}
+	}
+
+	session_end(slot);
+	free(frames);
+	close(sock);
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listen_clients
+// Description  : accept clients until stopped, each gets a thread
+//
+// Inputs       : t - where to listen
+// Outputs      : 0 if successful, -1 if failure
+
+static int listen_clients(CartTransport *t) {
+	struct sockaddr_in saddr;
+	struct sockaddr_un uaddr;
+	int sock, client, one = 1, bufsize = CART_SOCKET_BUFFER;
+	pthread_t thread;
+
+	sock = socket((t->type == CART_TRANSPORT_TCP) ? PF_INET : AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART proxy: socket() create failed : [%s]", strerror(errno));
+		return( -1 );
+	}
+
+	if (t->type == CART_TRANSPORT_TCP) {
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		memset(&saddr, 0, sizeof(saddr));
+		saddr.sin_family = AF_INET;
+		saddr.sin_port = htons(t->port ? t->port : CART_DEFAULT_PORT);
+		saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if ( (t->host[0] != '\0') && (inet_aton(t->host, &saddr.sin_addr) == 0) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART proxy: bad address [%s]", t->host);
+			close(sock);
+			return( -1 );
+		}
+		if (bind(sock, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART proxy: bind() failed : [%s]", strerror(errno));
+			close(sock);
+			return( -1 );
+		}
+	} else {
+		memset(&uaddr, 0, sizeof(uaddr));
+		uaddr.sun_family = AF_UNIX;
+		if (strlen(t->path) >= sizeof(uaddr.sun_path)) {
+			logMessage(LOG_ERROR_LEVEL, "CART proxy: socket path too long [%s]", t->path);
+			close(sock);
+			return( -1 );
+		}
+		strcpy(uaddr.sun_path, t->path);
+		unlink(t->path);
+		if (bind(sock, (struct sockaddr *)&uaddr, sizeof(uaddr)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART proxy: bind() failed : [%s]", strerror(errno));
+			close(sock);
+			return( -1 );
+		}
+	}
+
+	if (listen(sock, CART_MAX_BACKLOG) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART proxy: listen() failed : [%s]", strerror(errno));
+		close(sock);
+		return( -1 );
+	}
+
+	while (!proxy_stop) {
+		if ((client = accept(sock, NULL, NULL)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			logMessage(LOG_ERROR_LEVEL, "CART proxy: accept failed, aborting.");
+			break;
+		}
+		if (t->type == CART_TRANSPORT_TCP) {
+			setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		setsockopt(client, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+		setsockopt(client, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+		if (pthread_create(&thread, NULL, serve_client, (void *)(intptr_t)client) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "CART proxy: cannot start a client thread.");
+			close(client);
+			continue;
+		}
+		pthread_detach(thread);
+		proxy_clients += 1;
+	}
+
+	close(sock);
+	if (t->type == CART_TRANSPORT_UNIX) {
+		unlink(t->path);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART proxy
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, ret;
+	char *uri = CART_PROXY_DEFAULT_URI;
+	struct sigaction sa;
+	CartTransport t;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_PROXY_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 't': // Where the clients connect
+			uri = optarg;
+			break;
+
+		case 's': // The servers
+			cart_network_uri = strdup(optarg);
+			break;
+
+		case 'a': // The sessions share the cartridges
+			shared_carts = 1;
+			break;
+
+		case 'n': // Sessions
+			if ( (sscanf(optarg, "%d", &max_sessions) != 1) || (max_sessions < 1) ||
+					(max_sessions > CART_PROXY_MAX_SESSIONS) ) {
+				fprintf( stderr, "Bad session count [%s], 1 to %d\n", optarg, CART_PROXY_MAX_SESSIONS );
+				return( -1 );
+			}
+			break;
+
+		case 'c': // Cache size
+			if ( (sscanf(optarg, "%u", &cache_frames) != 1) || (cache_frames == 0) ) {
+				fprintf( stderr, "Bad cache size [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+
+	if ( (cart_transport_parse(uri, &t) == -1) || (t.type == CART_TRANSPORT_SHM) ) {
+		fprintf( stderr, "Bad proxy transport [%s], expected unix:// or tcp://\n", uri );
+		return( -1 );
+	}
+	if (init_cache() == -1) {
+		return( -1 );
+	}
+
+	// Power the servers on for all the clients to come
+	if ( (client_cart_bus_connect() == -1) ||
+			((client_cart_bus_request(cart_register(CART_OP_INITMS, 0, 0, 0), NULL) >> 47) & 1) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART proxy: cannot reach the CART server(s).");
+		return( -1 );
+	}
+
+	//split the cartridges, or share them all
+	if (max_sessions == 0) {
+		max_sessions = shared_carts ? CART_PROXY_MAX_SESSIONS : CART_PROXY_SESSIONS;
+	}
+	session_carts = shared_carts ? cart_bus_cartridges : cart_bus_cartridges / max_sessions;
+	if (session_carts == 0) {
+		logMessage(LOG_ERROR_LEVEL, "CART proxy: %d sessions for %u cartridges, at most one each.",
+			max_sessions, cart_bus_cartridges);
+		return( -1 );
+	}
+
+	//no SA_RESTART, a blocked accept has to notice the stop
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_proxy;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_create(&scheduler_thread, NULL, scheduler, NULL);
+	logMessage(LOG_OUTPUT_LEVEL, "CART proxy: listening on %s for %d sessions of %u %scartridges, %u cached frames",
+		uri, max_sessions, session_carts, shared_carts ? "shared " : "", cache_frames);
+	ret = listen_clients(&t);
+
+	// Finish what is queued, then power the servers off
+	pthread_mutex_lock(&queue_lock);
+	proxy_stop = 1;
+	pthread_cond_signal(&queue_wake);
+	pthread_mutex_unlock(&queue_lock);
+	pthread_join(scheduler_thread, NULL);
+
+	logMessage(LOG_OUTPUT_LEVEL, "CART proxy: %lu clients (%lu refused), %lu frames read (%lu cached, %lu coalesced, %lu from the servers), %lu written",
+		(unsigned long)proxy_clients, (unsigned long)proxy_refused, (unsigned long)proxy_reads, (unsigned long)proxy_hits,
+		(unsigned long)proxy_coalesced, (unsigned long)proxy_fetched, (unsigned long)proxy_writes);
+	logMessage(LOG_OUTPUT_LEVEL, "CART proxy: %lu requests in %lu rounds, %lu cartridge loads for %lu client loads",
+		(unsigned long)proxy_ops, (unsigned long)proxy_rounds, (unsigned long)proxy_loads,
+		(unsigned long)proxy_client_loads);
+	client_cart_bus_request(cart_register(CART_OP_POWOFF, 0, 0, 0), NULL);
+	client_cart_bus_report();
+
+	return( ret );
+}
@@ -0,0 +1,395 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_replay.c
+//  Description    : This is the main program of the CART bus replay tool.  It
+//                   plays a trace recorded by the client (cart_sim -R) back
+//                   to a server or a stand-in, at the pace it was recorded
+//                   or as fast as the server answers, optionally as several
+//                   copies at once, each with its own connections.
+//
+//                   The trace keeps a digest of each payload, not the bytes:
+//                   frames written are filled from a fixed random pattern
+//                   picked by the digest, so sizes and offsets are those of
+//                   the recording but not the contents.
+//
+//   Author        : Jason Jincheng Tu
+//   Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Project Includes
+#include <cart_network.h>
+#include <cart_controller.h>
+#include <cart_trace.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_REPLAY_ARGUMENTS "hvml:t:n:"
+#define CART_REPLAY_MAX_COPIES 64
+#define CART_REPLAY_PATTERN (CART_CARTRIDGE_SIZE * CART_FRAME_SIZE) // Bytes of write payload
+#define USAGE \
+	"USAGE: cart_replay [-h] [-v] [-m] [-l <logfile>] [-t <uri>[,<uri>...]] [-n <copies>]\n" \
+	"                   <tracefile>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output (the latencies of every copy)\n" \
+	"    -m - as fast as the servers answer, not at the recorded pace\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -t - the server(s), as for cart_sim -t (default tcp on the default port),\n" \
+	"         requests of the servers of the trace go round them\n" \
+	"    -n - play <copies> copies at once (default 1)\n" \
+	"\n" \
+	"    <tracefile> - bus traffic recorded with cart_sim -R\n" \
+	"\n"
+
+// What a copy did, sent back to the parent
+typedef struct {
+	uint64_t requests;     // requests played
+	uint64_t bytes;        // frame bytes moved
+	uint64_t failed;       // requests the servers failed
+	uint64_t ns;           // from the first request to the last answer
+} ReplayResult;
+
+//
+// Global data
+CartTraceRecord *trace = NULL;  // the records of the trace
+uint64_t         trace_count;   // how many
+int              max_speed = 0; // ignore the recorded times
+char            *pattern;       // write payloads come from here
+char            *scratch;       // reads land here
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : now_ns
+// Description  : read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : nanoseconds
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return( (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : load_trace
+// Description  : read a trace into memory
+//
+// Inputs       : path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+static int load_trace(const char *path) {
+	CartTraceHeader hdr;
+	FILE *f = fopen(path, "rb");
+	long size;
+
+	if (f == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CART replay: cannot open [%s] : [%s]", path, strerror(errno));
+		return( -1 );
+	}
+	if ( (fread(&hdr, sizeof(hdr), 1, f) != 1) || memcmp(hdr.magic, CART_TRACE_MAGIC, sizeof(hdr.magic)) ||
+			(hdr.record_size != sizeof(CartTraceRecord)) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART replay: [%s] is not a bus trace", path);
+		fclose(f);
+		return( -1 );
+	}
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f) - sizeof(hdr);
+	fseek(f, sizeof(hdr), SEEK_SET);
+	trace_count = size / sizeof(CartTraceRecord);
+	trace = malloc((trace_count + 1) * sizeof(CartTraceRecord));
+	if ( (trace == NULL) || (fread(trace, sizeof(CartTraceRecord), trace_count, f) != trace_count) ) {
+		logMessage(LOG_ERROR_LEVEL, "CART replay: cannot read [%s]", path);
+		fclose(f);
+		return( -1 );
+	}
+	fclose(f);
+
+	logMessage(LOG_INFO_LEVEL, "CART replay: %lu requests to %u server(s) in [%s]",
+		(unsigned long)trace_count, hdr.servers, path);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : play_request
+// Description  : send one request of the trace.  INITMS and POWOFF are
+//                waited for (they go to every server), the rest is
+//                pipelined.  Batches and partial writes the servers did
+//                not agree to go out as whole single frames.
+//
+// Inputs       : rec - the request, res - what the copy did so far
+// Outputs      : 0 if successful, -1 if the connection failed
+
+static int play_request(CartTraceRecord *rec, ReplayResult *res) {
+	uint64_t op = rec->reg >> 56;
+	uint16_t cart = CART_BUS_CART(rec->server % cart_bus_servers, (rec->reg >> 31) & 0xffff);
+	CartXferRegister reg = (rec->reg & ~(0xffffULL << 31) & ~(0xffULL << 48) & ~(uint64_t)CART_BATCH_MASK) |
+		((uint64_t)cart << 31);
+	uint32_t n = CART_BATCH_FRAMES(rec->reg), frm = (rec->reg >> 15) & 0xffff;
+	char *buf = (op == CART_OP_WRFRME) ? &pattern[rec->digest % CART_REPLAY_PATTERN] : scratch;
+	CartXferRegister resp;
+
+	res->requests += 1;
+	res->bytes += rec->bytes;
+
+	if ( (op == CART_OP_INITMS) || (op == CART_OP_POWOFF) ) {
+		resp = client_cart_bus_request(reg, NULL);
+		if (resp == (CartXferRegister)-1) {
+			return( -1 );
+		}
+		res->failed += (resp >> 47) & 1;
+		return( 0 );
+	}
+
+	if ( (op == CART_OP_WRFRME) && ((rec->reg >> 48) & CART_FEATURE_PARTIAL) ) {
+		if (cart_bus_features & CART_FEATURE_PARTIAL) {
+			return( client_cart_bus_submit_partial(reg, rec->offset, rec->bytes, buf) );
+		}
+		return( client_cart_bus_submit(reg, buf) );
+	}
+
+	if ( (n > 1) && (cart_bus_features & CART_FEATURE_BATCH) ) {
+		return( client_cart_bus_submit(reg | n, buf) );
+	}
+	for (uint32_t k = 0; k < n; k++) {
+		reg = (reg & ~(0xffffULL << 15)) | ((uint64_t)(frm + k) << 15);
+		if (client_cart_bus_submit(reg, &buf[k * CART_FRAME_SIZE]) == -1) {
+			return( -1 );
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : play_trace
+// Description  : play the whole trace once, the body of a copy
+//
+// Inputs       : copy - which copy this is, res - what it did
+// Outputs      : 0 if successful, -1 if failure
+
+static int play_trace(int copy, ReplayResult *res) {
+	struct timespec until;
+	uint64_t start, at;
+	int ret;
+
+	memset(res, 0, sizeof(*res));
+	if (client_cart_bus_connect() == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART replay: copy %d cannot reach the CART server(s).", copy);
+		return( -1 );
+	}
+
+	start = now_ns();
+	for (uint64_t i = 0; i < trace_count; i++) {
+		CartTraceRecord *rec = &trace[i];
+		uint64_t op = rec->reg >> 56;
+
+		//INITMS and POWOFF were recorded once per server, they are sent once
+		if ( ((op == CART_OP_INITMS) || (op == CART_OP_POWOFF)) && (rec->server != 0) ) {
+			continue;
+		}
+
+		if (!max_speed) {
+			at = start + rec->sent;
+			until.tv_sec = at / 1000000000ULL;
+			until.tv_nsec = at % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+		}
+		if (play_request(rec, res) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART replay: copy %d lost the server at request %lu.",
+				copy, (unsigned long)i);
+			return( -1 );
+		}
+	}
+
+	if (cart_network_shutdown) {
+		if ( (ret = client_cart_bus_flush()) == -1 ) {
+			return( -1 );
+		}
+		res->failed += ret;
+	}
+	res->ns = now_ns() - start;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_result
+// Description  : log what a copy, or all of them, did
+//
+// Inputs       : who - the name in the log, res - the result
+// Outputs      : none
+
+static void log_result(const char *who, ReplayResult *res) {
+	double secs = res->ns / 1e9;
+
+	logMessage(LOG_OUTPUT_LEVEL, "CART replay %s: %lu requests in %.3f s, %.0f requests/s, %.1f MB/s, %lu failed",
+		who, (unsigned long)res->requests, secs, secs > 0 ? res->requests / secs : 0.0,
+		secs > 0 ? res->bytes / secs / 1e6 : 0.0, (unsigned long)res->failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART replay tool
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, copies = 1, status, ret = 0;
+	int pipes[2];
+	ReplayResult res, total;
+	uint64_t start, recorded;
+	char who[32];
+	pid_t pid;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_REPLAY_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'm': // Maximum speed
+			max_speed = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 't': // The servers
+			cart_network_uri = strdup(optarg);
+			break;
+
+		case 'n': // Concurrent copies
+			if ( (sscanf(optarg, "%d", &copies) != 1) || (copies < 1) || (copies > CART_REPLAY_MAX_COPIES) ) {
+				fprintf( stderr, "Bad number of copies [%s], 1 to %d\n", optarg, CART_REPLAY_MAX_COPIES );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+
+	if (optind != argc - 1) {
+		fprintf( stderr, USAGE );
+		return( -1 );
+	}
+	if (load_trace(argv[optind]) == -1) {
+		return( -1 );
+	}
+	recorded = (trace_count > 0) ? trace[trace_count - 1].sent + trace[trace_count - 1].took : 0;
+
+	//one random pattern for every write, a frame's worth of slack at the end
+	pattern = malloc(CART_REPLAY_PATTERN + CART_CARTRIDGE_SIZE * CART_FRAME_SIZE);
+	scratch = malloc(CART_CARTRIDGE_SIZE * CART_FRAME_SIZE);
+	if ( (pattern == NULL) || (scratch == NULL) ) {
+		return( -1 );
+	}
+	srandom(0x43415254);
+	for (size_t i = 0; i < CART_REPLAY_PATTERN + CART_CARTRIDGE_SIZE * CART_FRAME_SIZE; i++) {
+		pattern[i] = random() & 0xff;
+	}
+
+	// A single copy plays in this process
+	if (copies == 1) {
+		ret = play_trace(0, &res);
+		log_result("1 copy", &res);
+		logMessage(LOG_OUTPUT_LEVEL, "CART replay: recorded in %.3f s", recorded / 1e9);
+		client_cart_bus_report();
+		return( ret );
+	}
+
+	// Otherwise each copy is a process with its own connections
+	if (pipe(pipes) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART replay: pipe failed : [%s]", strerror(errno));
+		return( -1 );
+	}
+	start = now_ns();
+	for (int c = 0; c < copies; c++) {
+		if ( (pid = fork()) == -1 ) {
+			logMessage(LOG_ERROR_LEVEL, "CART replay: fork failed : [%s]", strerror(errno));
+			copies = c;
+			ret = -1;
+			break;
+		}
+		if (pid == 0) {
+			close(pipes[0]);
+			status = play_trace(c, &res);
+			if (verbose) {
+				client_cart_bus_report();
+			}
+			if (status == -1) {
+				memset(&res, 0, sizeof(res));
+			}
+			if (write(pipes[1], &res, sizeof(res)) != sizeof(res)) {
+				status = -1;
+			}
+			_exit( status == -1 );
+		}
+	}
+	close(pipes[1]);
+
+	// The results arrive as the copies finish
+	memset(&total, 0, sizeof(total));
+	for (int c = 0; c < copies; c++) {
+		if (read(pipes[0], &res, sizeof(res)) != sizeof(res)) {
+			break;
+		}
+		log_result("copy", &res);
+		total.requests += res.requests;
+		total.bytes += res.bytes;
+		total.failed += res.failed;
+	}
+	while (wait(&status) > 0) {
+		if ( !WIFEXITED(status) || (WEXITSTATUS(status) != 0) ) {
+			ret = -1;
+		}
+	}
+	total.ns = now_ns() - start;
+	snprintf(who, sizeof(who), "%d copies", copies);
+	log_result(who, &total);
+	logMessage(LOG_OUTPUT_LEVEL, "CART replay: recorded in %.3f s", recorded / 1e9);
+
+	return( ret );
+}
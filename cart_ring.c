@@ -0,0 +1,479 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_ring.c
+//  Description    : This is the asynchronous submission/completion ring for
+//                   the CART driver.  Callers queue requests on the
+//                   submission ring and a pool of I/O threads runs them
+//                   through the driver at the same time, posting the results
+//                   on the completion ring as they finish.
+//
+//  Author         : [Jason Jincheng Tu]
+//  Last Modified  : [10/18/2026]
+//
+
+// Includes
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
+// Project Includes
+#include <cart_driver.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_RING_SPINS 64 // Polls of an empty ring before going to sleep
+#define CART_RING_WORKERS 4 // I/O threads, so requests overlap on the bus
+
+// One slot of the submission ring, seq tells producers and the consumer
+// whose turn it is (Vyukov bounded queue)
+typedef struct {
+	atomic_uint seq;
+	CartRingSqe sqe;
+} sq_slot;
+
+// A ring that can be woken up when it goes from empty to non-empty
+typedef struct {
+	atomic_int sleeping;	// the reader is (about to be) asleep on wake
+	sem_t wake;
+} ring_waiter;
+
+//
+// Global data
+
+sq_slot *sq;				// submission ring, many producers, I/O threads consume
+uint32_t sq_mask;
+atomic_uint sq_head;		// next slot producers claim
+uint32_t sq_tail;			// next slot an I/O thread takes (under sq_lock)
+pthread_mutex_t sq_lock = PTHREAD_MUTEX_INITIALIZER;	// the I/O threads taking requests
+pthread_cond_t sq_work = PTHREAD_COND_INITIALIZER;		// an I/O thread waiting for work
+atomic_int sq_sleepers;		// I/O threads waiting on sq_work
+
+//requests that use the file position run one after another on each file,
+//in the order they were taken (under sq_lock / pos_lock)
+uint32_t pos_taken[CART_MAX_TOTAL_FILES];
+uint32_t pos_done[CART_MAX_TOTAL_FILES];
+pthread_mutex_t pos_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pos_turn = PTHREAD_COND_INITIALIZER;
+
+CartRingCqe *cq;			// completion ring, I/O threads produce, one reaper
+uint32_t cq_mask;
+atomic_uint cq_head;		// next slot the I/O threads fill (under cq_lock)
+atomic_uint cq_tail;		// next slot the reaper takes
+pthread_mutex_t cq_lock = PTHREAD_MUTEX_INITIALIZER;	// the I/O threads posting
+pthread_cond_t cq_room = PTHREAD_COND_INITIALIZER;		// an I/O thread waiting for the reaper
+atomic_int cq_sleepers;		// I/O threads waiting on cq_room
+
+ring_waiter cq_waiter;		// the reaper waiting for completions
+
+pthread_t ring_threads[CART_RING_WORKERS];
+int ring_workers;			// I/O threads started
+atomic_int ring_running = 0;	// set while the ring accepts requests
+atomic_int ring_done = 0;		// I/O threads that have drained and stopped
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_sleep
+// Description  : put the reader of a ring to sleep unless the ring became
+//                ready while it was getting there
+//
+// Inputs       : w - the waiter of the ring
+//                ready - check of the ring, returns non-zero when ready
+// Outputs      : none
+
+static void ring_sleep(ring_waiter *w, int (*ready)(void)){
+
+	for (int i = 0; i < CART_RING_SPINS; i++){
+		if (ready()){
+			return;
+		}
+		sched_yield();
+	}
+
+	//announce the sleep, then look once more so a wake up is not lost
+	atomic_store(&w->sleeping, 1);
+	if (ready()){
+		if (atomic_exchange(&w->sleeping, 0) == 0){
+			sem_wait(&w->wake);	//someone already posted for us
+		}
+		return;
+	}
+	sem_wait(&w->wake);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_wake
+// Description  : wake the reader of a ring if it went to sleep
+//
+// Inputs       : w - the waiter of the ring
+// Outputs      : none
+
+static void ring_wake(ring_waiter *w){
+	if (atomic_load(&w->sleeping) && atomic_exchange(&w->sleeping, 0) == 1){
+		sem_post(&w->wake);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sq_ready / cq_ready / cq_has_space
+// Description  : ring state checks used while waiting
+//
+// Inputs       : none
+// Outputs      : non-zero when the waiter can go on
+
+static int sq_ready(void){
+	sq_slot *slot = &sq[sq_tail & sq_mask];
+	return atomic_load(&slot->seq) == sq_tail + 1 || !atomic_load(&ring_running);
+}
+
+static int cq_ready(void){
+	return atomic_load_explicit(&cq_head, memory_order_acquire) !=
+		atomic_load_explicit(&cq_tail, memory_order_relaxed);
+}
+
+static int cq_has_space(void){
+	return atomic_load_explicit(&cq_head, memory_order_relaxed) - atomic_load(&cq_tail) <= cq_mask;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_execute
+// Description  : run one submitted request through the driver
+//
+// Inputs       : sqe - the request
+// Outputs      : the result of the driver call
+
+static int32_t ring_execute(CartRingSqe *sqe){
+
+	//requests with an offset leave the file position alone
+	if (sqe->offset >= 0){
+		switch (sqe->op){
+		case CART_RING_READ:
+			return cart_pread(sqe->fd, sqe->buf, sqe->count, (uint32_t)sqe->offset);
+		case CART_RING_WRITE:
+			return cart_pwrite(sqe->fd, sqe->buf, sqe->count, (uint32_t)sqe->offset);
+		}
+	}
+
+	switch (sqe->op){
+	case CART_RING_READ:
+		return cart_read(sqe->fd, sqe->buf, sqe->count);
+	case CART_RING_WRITE:
+		return cart_write(sqe->fd, sqe->buf, sqe->count);
+	case CART_RING_FSYNC:
+		return cart_fsync(sqe->fd);
+	default:
+		return (-1);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_take
+// Description  : take the next request off the submission ring, waiting
+//                for one if it is empty
+//
+// Inputs       : sqe - where to put the request
+//                turn - receives the place of a request using the file
+//                       position among those of its file
+// Outputs      : 1 if a request was taken, 0 if the ring stopped and is empty
+
+static int ring_take(CartRingSqe *sqe, uint32_t *turn){
+	sq_slot *slot;
+
+	//spin a little before sleeping, the next request is often close behind
+	for (int i = 0; i < CART_RING_SPINS && !sq_ready(); i++){
+		sched_yield();
+	}
+
+	pthread_mutex_lock(&sq_lock);
+	while (1){
+		slot = &sq[sq_tail & sq_mask];
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) == sq_tail + 1){
+			break;
+		}
+		if (!atomic_load(&ring_running)){
+			pthread_mutex_unlock(&sq_lock);
+			return (0);
+		}
+
+		//announce the sleep, then look once more so a wake up is not lost
+		atomic_fetch_add(&sq_sleepers, 1);
+		if (!sq_ready()){
+			pthread_cond_wait(&sq_work, &sq_lock);
+		}
+		atomic_fetch_sub(&sq_sleepers, 1);
+	}
+
+	//take it and hand the slot back to the producers
+	*sqe = slot->sqe;
+	atomic_store_explicit(&slot->seq, sq_tail + sq_mask + 1, memory_order_release);
+	sq_tail++;
+	if (sqe->offset < 0 && sqe->fd > 0 && sqe->fd < CART_MAX_TOTAL_FILES){
+		*turn = pos_taken[sqe->fd]++;
+	}
+	pthread_mutex_unlock(&sq_lock);
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_post
+// Description  : post a completion, waiting on the reaper if the ring is full
+//
+// Inputs       : cqe - the completion
+// Outputs      : none
+
+static void ring_post(CartRingCqe *cqe){
+
+	pthread_mutex_lock(&cq_lock);
+	while (!cq_has_space()){
+		atomic_fetch_add(&cq_sleepers, 1);
+		if (!cq_has_space()){
+			pthread_cond_wait(&cq_room, &cq_lock);
+		}
+		atomic_fetch_sub(&cq_sleepers, 1);
+	}
+	uint32_t head = atomic_load_explicit(&cq_head, memory_order_relaxed);
+	cq[head & cq_mask] = *cqe;
+	atomic_store_explicit(&cq_head, head + 1, memory_order_release);
+	pthread_mutex_unlock(&cq_lock);
+	ring_wake(&cq_waiter);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_worker
+// Description  : an I/O thread, takes requests off the submission ring and
+//                posts their results on the completion ring.  The threads
+//                run requests at the same time, so completions may come
+//                back out of order, except that requests using the file
+//                position run in order on each file.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void *ring_worker(void *arg){
+	CartRingSqe sqe;
+	CartRingCqe cqe;
+	uint32_t turn = 0;
+
+	while (ring_take(&sqe, &turn)){
+		int ordered = sqe.offset < 0 && sqe.fd > 0 && sqe.fd < CART_MAX_TOTAL_FILES;
+
+		//wait for the requests on the file position taken before this one
+		if (ordered){
+			pthread_mutex_lock(&pos_lock);
+			while (pos_done[sqe.fd] != turn){
+				pthread_cond_wait(&pos_turn, &pos_lock);
+			}
+			pthread_mutex_unlock(&pos_lock);
+		}
+
+		cqe.user_data = sqe.user_data;
+		cqe.result = ring_execute(&sqe);
+
+		if (ordered){
+			pthread_mutex_lock(&pos_lock);
+			pos_done[sqe.fd]++;
+			pthread_cond_broadcast(&pos_turn);
+			pthread_mutex_unlock(&pos_lock);
+		}
+		ring_post(&cqe);
+	}
+
+	atomic_fetch_add(&ring_done, 1);
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_ring_init
+// Description  : Create the rings and start the I/O threads
+//
+// Inputs       : entries - the number of slots in each ring, rounded up to a
+//                          power of two
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_ring_init(uint32_t entries) {
+	uint32_t size = 2;
+
+	if (atomic_load(&ring_running)){
+		return (-1);
+	}
+	while (size < entries){
+		size <<= 1;
+	}
+
+	sq = malloc(size * sizeof(sq_slot));
+	cq = malloc(size * sizeof(CartRingCqe));
+	if (sq == NULL || cq == NULL){
+		free(sq);
+		free(cq);
+		return (-1);
+	}
+	for (uint32_t i = 0; i < size; i++){
+		atomic_init(&sq[i].seq, i);
+	}
+	sq_mask = size - 1;
+	cq_mask = size - 1;
+	atomic_init(&sq_head, 0);
+	sq_tail = 0;
+	atomic_init(&cq_head, 0);
+	atomic_init(&cq_tail, 0);
+
+	memset(pos_taken, 0, sizeof(pos_taken));
+	memset(pos_done, 0, sizeof(pos_done));
+
+	atomic_init(&sq_sleepers, 0);
+	atomic_init(&cq_sleepers, 0);
+	atomic_init(&cq_waiter.sleeping, 0);
+	sem_init(&cq_waiter.wake, 0, 0);
+
+	atomic_store(&ring_done, 0);
+	atomic_store(&ring_running, 1);
+	for (ring_workers = 0; ring_workers < CART_RING_WORKERS; ring_workers++){
+		if (pthread_create(&ring_threads[ring_workers], NULL, ring_worker, NULL) != 0){
+			break;
+		}
+	}
+	if (ring_workers == 0){
+		logMessage(LOG_ERROR_LEVEL, "CART ring: failed to start the I/O threads.");
+		atomic_store(&ring_running, 0);
+		sem_destroy(&cq_waiter.wake);
+		free(sq);
+		free(cq);
+		return (-1);
+	}
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_ring_submit
+// Description  : Queue a request on the submission ring, safe to call from
+//                several threads at once
+//
+// Inputs       : sqe - the request to queue (copied)
+// Outputs      : 0 if successful, -1 if the ring is full or not running
+
+int32_t cart_ring_submit(CartRingSqe *sqe) {
+	uint32_t pos = atomic_load_explicit(&sq_head, memory_order_relaxed);
+	sq_slot *slot;
+
+	if (!atomic_load(&ring_running)){
+		return (-1);
+	}
+
+	//claim a slot, losing the race to another producer just means retry
+	while (1){
+		slot = &sq[pos & sq_mask];
+		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		int32_t diff = (int32_t)(seq - pos);
+
+		if (diff == 0){
+			if (atomic_compare_exchange_weak_explicit(&sq_head, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		} else if (diff < 0){
+			return (-1);	//full
+		} else {
+			pos = atomic_load_explicit(&sq_head, memory_order_relaxed);
+		}
+	}
+
+	slot->sqe = *sqe;
+	atomic_store(&slot->seq, pos + 1);
+
+	//an I/O thread that went to sleep checks the ring after announcing it
+	if (atomic_load(&sq_sleepers) > 0){
+		pthread_mutex_lock(&sq_lock);
+		pthread_cond_signal(&sq_work);
+		pthread_mutex_unlock(&sq_lock);
+	}
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_ring_reap
+// Description  : Take the next completion off the completion ring, only one
+//                thread may reap at a time
+//
+// Inputs       : cqe - where to put the completion
+//                wait - block until a completion is available
+// Outputs      : 1 if a completion was reaped, 0 if none was ready
+
+int32_t cart_ring_reap(CartRingCqe *cqe, int wait) {
+	uint32_t tail = atomic_load_explicit(&cq_tail, memory_order_relaxed);
+
+	while (!cq_ready()){
+		if (!wait){
+			return (0);
+		}
+		ring_sleep(&cq_waiter, cq_ready);
+	}
+
+	*cqe = cq[tail & cq_mask];
+	atomic_store(&cq_tail, tail + 1);
+	if (atomic_load(&cq_sleepers) > 0){
+		pthread_mutex_lock(&cq_lock);
+		pthread_cond_broadcast(&cq_room);
+		pthread_mutex_unlock(&cq_lock);
+	}
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_ring_exit
+// Description  : Finish the queued requests and stop the I/O threads, any
+//                completions not reaped are dropped
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if the ring was not running
+
+int32_t cart_ring_exit(void) {
+	CartRingCqe cqe;
+
+	if (!atomic_load(&ring_running)){
+		return (-1);
+	}
+
+	//let the threads drain the ring, reaping so they never stall on us
+	pthread_mutex_lock(&sq_lock);
+	atomic_store(&ring_running, 0);
+	pthread_cond_broadcast(&sq_work);
+	pthread_mutex_unlock(&sq_lock);
+	while (atomic_load(&ring_done) < ring_workers){
+		cart_ring_reap(&cqe, 0);
+		sched_yield();
+	}
+	for (int i = 0; i < ring_workers; i++){
+		pthread_join(ring_threads[i], NULL);
+	}
+
+	sem_destroy(&cq_waiter.wake);
+	free(sq);
+	free(cq);
+	sq = NULL;
+	cq = NULL;
+
+	// Return successfully
+	return (0);
+}
@@ -0,0 +1,661 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : cart_server.c
+//  Description   : This is the server side of the CART communication
+//                  protocol, a stand-in for the reference cart_server.  It
+//                  keeps the cartridges in memory (or in a mapped file),
+//                  speaks TCP, Unix-domain sockets and the shared-memory
+//                  ring, and can add delays that model the cost of real
+//                  hardware.
+//
+//   Author       : Jason Jincheng Tu
+//  Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <cart_network.h>
+#include <cart_transport.h>
+#include <cart_codec.h>
+#include <cart_controller.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CART_MEMORY_SIZE ((size_t)CART_MAX_CARTRIDGES * sizeof(CartCartridge))
+#define CART_SPIN_DELAY_NS 50000 // Shorter delays spin, longer ones sleep
+
+//
+//  Global data
+char     *cart_server_uri = NULL;     // Transport to listen on, TCP if NULL
+unsigned short cart_server_port = 0;  // TCP port when there is no URI
+char     *cart_server_backing = NULL; // File backing the cartridges, memory if NULL
+uint64_t  cart_server_op_ns[CART_OP_MAXVAL]; // Delay added to each opcode
+uint64_t  cart_server_byte_ns = 0;    // Delay added per frame byte moved
+
+CartCartridge *cart_memory = NULL;    // the cartridges
+int        cart_initialized = 0;      // INITMS seen since the last POWOFF
+CartridgeIndex loaded_cart = CART_NO_CARTRIDGE; // the cartridge loaded
+volatile sig_atomic_t server_stop = 0; // set by SIGINT/SIGTERM
+CartShmRegion *server_region = NULL;  // the region of a shm server
+uint8_t    server_features = 0;       // extensions offered on this transport
+CartCartridge scratch;                // where the frames of a bad request go
+char       tx_frames[CART_CARTRIDGE_SIZE * (CART_CODEC_HEADER + CART_FRAME_SIZE)]; // encoded answers
+CartCodecStats codec_out, codec_in;   // frames compressed / expanded
+
+//for the report at power off, the cost of each opcode in the units the
+//reference server uses
+uint64_t   server_ops[CART_OP_MAXVAL];		// frames for reads and writes
+uint64_t   server_msgs[CART_OP_MAXVAL];		// requests
+uint64_t   server_partial;					// partial frame writes
+uint64_t   server_delay_ns[CART_OP_MAXVAL];
+static const uint64_t op_cost[CART_OP_MAXVAL] = { 15000, 100, 250, 500, 1000, 10000 };
+static const char *op_names[CART_OP_MAXVAL] = {
+	"INITMS", "BZERO", "LDCART", "RDFRME", "WRFRME", "POWOFF" };
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stop_server
+// Description  : signal handler, finish the current request and stop
+//
+// Inputs       : sig - the signal
+// Outputs      : none
+
+static void stop_server(int sig) {
+	server_stop = 1;
+	if (server_region != NULL) {
+		atomic_store(&server_region->closing, 1);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : inject_delay
+// Description  : hold a request up for the time the latency model gives it,
+//                short delays spin since a sleep is never that precise
+//
+// Inputs       : op - the opcode, bytes - frame bytes moved
+// Outputs      : none
+
+static void inject_delay(int op, size_t bytes) {
+	uint64_t ns = cart_server_op_ns[op] + cart_server_byte_ns * bytes;
+	struct timespec start, now, wait;
+
+	if (ns == 0) {
+		return;
+	}
+	server_delay_ns[op] += ns;
+
+	if (ns >= CART_SPIN_DELAY_NS) {
+		wait.tv_sec = ns / 1000000000ULL;
+		wait.tv_nsec = ns % 1000000000ULL;
+		while ( (nanosleep(&wait, &wait) == -1) && (errno == EINTR) && !server_stop );
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ( (uint64_t)(now.tv_sec - start.tv_sec) * 1000000000ULL +
+		now.tv_nsec - start.tv_nsec < ns );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : open_memory
+// Description  : map the cartridges, from the backing file if there is one
+//                so they survive the server
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int open_memory(void) {
+	int fd;
+
+	if (cart_server_backing == NULL) {
+		cart_memory = mmap(NULL, CART_MEMORY_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	} else {
+		if ( ((fd = open(cart_server_backing, O_RDWR | O_CREAT, 0600)) == -1) ||
+				(ftruncate(fd, CART_MEMORY_SIZE) == -1) ) {
+			logMessage(LOG_ERROR_LEVEL, "Failure opening cart backing store [%s], error=[%s]",
+				cart_server_backing, strerror(errno));
+			return( -1 );
+		}
+		cart_memory = mmap(NULL, CART_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+
+	if (cart_memory == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "CART server: cannot map the cartridges [%s]", strerror(errno));
+		cart_memory = NULL;
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : frame_of
+// Description  : find the frame a read or write addresses in the loaded
+//                cartridge, the frames of a batch follow it
+//
+// Inputs       : reg - the request register
+// Outputs      : the frame, NULL if the request cannot be served
+
+static char *frame_of(CartXferRegister reg) {
+	CartFrameIndex frm = (reg >> 15) & 0xffff;
+	uint32_t n = CART_BATCH_FRAMES(reg);
+
+	if ( !cart_initialized || (loaded_cart >= CART_MAX_CARTRIDGES) ||
+			(frm + n > CART_CARTRIDGE_SIZE) ||
+			((n > 1) && !(server_features & CART_FEATURE_BATCH)) ||
+			((((reg >> 48) & 0xff) & CART_FEATURE_PARTIAL) &&
+				(!(server_features & CART_FEATURE_PARTIAL) || (n > 1))) ) {
+		return( NULL );
+	}
+	return( cart_memory[loaded_cart][frm] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : power_off
+// Description  : put the memory system down and report what it did
+//
+// Inputs       : none
+// Outputs      : none
+
+static void power_off(void) {
+	int op;
+
+	if ( (cart_server_backing != NULL) && (msync(cart_memory, CART_MEMORY_SIZE, MS_SYNC) == -1) ) {
+		logMessage(LOG_ERROR_LEVEL, "Failure writing CART backing store [%s], error=[%s]",
+			cart_server_backing, strerror(errno));
+	}
+	cart_initialized = 0;
+	loaded_cart = CART_NO_CARTRIDGE;
+
+	logMessage(LOG_OUTPUT_LEVEL, "** Start Performance Metrics **");
+	for (op = 0; op < CART_OP_MAXVAL; op++) {
+		logMessage(LOG_OUTPUT_LEVEL, "%-6s operations %lu in %lu requests [total cost=%lu, injected delay=%.3f ms]",
+			op_names[op], (unsigned long)server_ops[op], (unsigned long)server_msgs[op],
+			(unsigned long)(server_ops[op] * op_cost[op]), server_delay_ns[op] / 1e6);
+	}
+	if (server_partial > 0) {
+		logMessage(LOG_OUTPUT_LEVEL, "WRFRME partial frame writes %lu", (unsigned long)server_partial);
+	}
+	cart_codec_report("CART server", "sent", &codec_out);
+	cart_codec_report("CART server", "received", &codec_in);
+	logMessage(LOG_OUTPUT_LEVEL, "** End Performance Metrics **");
+	memset(&codec_out, 0, sizeof(codec_out));
+	memset(&codec_in, 0, sizeof(codec_in));
+	server_partial = 0;
+	memset(server_ops, 0, sizeof(server_ops));
+	memset(server_msgs, 0, sizeof(server_msgs));
+	memset(server_delay_ns, 0, sizeof(server_delay_ns));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_server_execute
+// Description  : carry out one request against the cartridges.  The frame
+//                of a write has already been stored by the transport (it
+//                reads it straight into frame_of), a read is sent by the
+//                transport from frame_of after this returns.
+//
+// Inputs       : reg - the request register
+//                bytes - frame bytes the request moves
+// Outputs      : the response register, RT1 set if the request failed
+
+static CartXferRegister cart_server_execute(CartXferRegister reg, size_t bytes) {
+	int op = (reg >> 56) & 0xff, failed = 0;
+	CartridgeIndex cart = (reg >> 31) & 0xffff;
+	uint8_t ky2 = (reg >> 48) & 0xff;
+	uint32_t frames = CART_BATCH_FRAMES(reg);
+
+	if ( (op == CART_OP_WRFRME) && (ky2 & CART_FEATURE_PARTIAL) ) {
+		server_partial += 1;
+	}
+
+	if (op >= CART_OP_MAXVAL) {
+		logMessage(LOG_ERROR_LEVEL, "CART BUS FAULT: unknown op instruction [%x]", op);
+		return( reg | (1ULL << 47) );
+	}
+	server_msgs[op] += 1;
+	server_ops[op] += (op == CART_OP_RDFRME || op == CART_OP_WRFRME) ? frames : 1;
+
+	switch (op) {
+	case CART_OP_INITMS:
+		failed = cart_initialized;
+		cart_initialized = 1;
+		loaded_cart = CART_NO_CARTRIDGE;
+
+		//answer an ask with the extensions both sides know
+		if (ky2 & CART_FEATURE_ASK) {
+			reg = (reg & ~(0xffULL << 48)) | ((uint64_t)(ky2 & server_features) << 48);
+		}
+		break;
+
+	case CART_OP_BZERO:
+		if ( (failed = (!cart_initialized || loaded_cart >= CART_MAX_CARTRIDGES)) == 0 ) {
+			memset(cart_memory[loaded_cart], 0, sizeof(CartCartridge));
+		}
+		break;
+
+	case CART_OP_LDCART:
+		if ( (failed = (!cart_initialized || cart >= CART_MAX_CARTRIDGES)) == 0 ) {
+			loaded_cart = cart;
+		}
+		break;
+
+	case CART_OP_RDFRME:
+	case CART_OP_WRFRME:
+		failed = (frame_of(reg) == NULL);
+		break;
+
+	case CART_OP_POWOFF:
+		power_off();
+		break;
+	}
+
+	inject_delay(op, failed ? 0 : bytes);
+
+	if (failed) {
+		logMessage(LOG_ERROR_LEVEL, "CART server: %s failed [%016lx]", op_names[op], (unsigned long)reg);
+		return( reg | (1ULL << 47) );
+	}
+	return( reg & ~(1ULL << 47) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : xfer_full
+// Description  : move every byte described by an io vector over a socket,
+//                picking up where a short read or write left off
+//
+// Inputs       : sock - the socket, out - 1 to send, 0 to receive
+//                iov, cnt - the io vector (changed as it is used up)
+// Outputs      : 0 if successful, -1 if failure or the client went away
+
+static int xfer_full(int sock, int out, struct iovec *iov, int cnt) {
+
+	while (cnt > 0) {
+		ssize_t n = out ? writev(sock, iov, cnt) : readv(sock, iov, cnt);
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR && !server_stop) {
+				continue;
+			}
+			return( -1 );
+		}
+
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : recv_compressed
+// Description  : read the frames of a write on a compressed connection,
+//                each comes with a header giving its length
+//
+// Inputs       : sock - the connection, frames - where they go
+//                n - how many
+// Outputs      : 0 if successful, -1 if failure
+
+static int recv_compressed(int sock, char *frames, uint32_t n) {
+	char data[CART_FRAME_SIZE];
+	struct iovec iov[1];
+	uint16_t header;
+
+	for (uint32_t i = 0; i < n; i++) {
+		iov[0].iov_base = &header;
+		iov[0].iov_len = sizeof(header);
+		if (xfer_full(sock, 0, iov, 1) == -1) {
+			return( -1 );
+		}
+		header = ntohs(header);
+		iov[0].iov_base = data;
+		iov[0].iov_len = header & CART_CODEC_LEN_MASK;
+		if ( (iov[0].iov_len > CART_FRAME_SIZE) || (xfer_full(sock, 0, iov, 1) == -1) ||
+				(cart_codec_decode(header, data, &frames[i * CART_FRAME_SIZE], &codec_in) == -1) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART server: bad compressed frame.");
+			return( -1 );
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serve_socket
+// Description  : answer the requests of one connected client until it
+//                powers off or goes away.  Frames move straight between
+//                the socket and the cartridges.
+//
+// Inputs       : sock - the connection
+// Outputs      : none
+
+static void serve_socket(int sock) {
+	CartXferRegister reg, resp;
+	struct iovec iov[2];
+	uint16_t partial[2];
+	size_t bytes, at;
+	uint8_t features = 0;	//agreed at INITMS
+	char *frame;
+	int op, bad;
+
+	while (!server_stop) {
+		iov[0].iov_base = &reg;
+		iov[0].iov_len = sizeof(reg);
+		if (xfer_full(sock, 0, iov, 1) == -1) {
+			break;
+		}
+		reg = ntohll64(reg);
+		op = (reg >> 56) & 0xff;
+		bytes = CART_BATCH_FRAMES(reg) * CART_FRAME_SIZE;
+		if ( (reg & CART_BATCH_MASK) > CART_CARTRIDGE_SIZE ) {
+			logMessage(LOG_ERROR_LEVEL, "CART server: batch of %u frames, dropping the client.",
+				(unsigned)(reg & CART_BATCH_MASK));
+			break;
+		}
+
+		//a partial write says where its bytes go first
+		bad = 0;
+		at = 0;
+		if ( (op == CART_OP_WRFRME) && (((reg >> 48) & 0xff) & CART_FEATURE_PARTIAL) ) {
+			iov[0].iov_base = partial;
+			iov[0].iov_len = sizeof(partial);
+			if (xfer_full(sock, 0, iov, 1) == -1) {
+				break;
+			}
+			at = ntohs(partial[0]);
+			bytes = ntohs(partial[1]);
+			if (bytes > CART_FRAME_SIZE) {
+				logMessage(LOG_ERROR_LEVEL, "CART server: partial write of %u bytes, dropping the client.",
+					(unsigned)bytes);
+				break;
+			}
+			bad = (at + bytes > CART_FRAME_SIZE);
+		}
+
+		//the frames of a write land in their cartridge, or nowhere if it is bad
+		if (op == CART_OP_WRFRME) {
+			frame = bad ? NULL : frame_of(reg);
+			iov[0].iov_base = (frame != NULL) ? frame + at : (char *)scratch;
+			iov[0].iov_len = bytes;
+			if ( (features & CART_FEATURE_COMPRESS) && !(((reg >> 48) & 0xff) & CART_FEATURE_PARTIAL) ) {
+				//whole frames are compressed, the bytes of a partial write are not
+				if (recv_compressed(sock, iov[0].iov_base, bytes / CART_FRAME_SIZE) == -1) {
+					break;
+				}
+			} else if (xfer_full(sock, 0, iov, 1) == -1) {
+				break;
+			}
+		}
+
+		resp = cart_server_execute(reg, (op == CART_OP_RDFRME || op == CART_OP_WRFRME) ? bytes : 0);
+		resp = htonll64(bad ? (resp | (1ULL << 47)) : resp);
+		iov[0].iov_base = &resp;
+		iov[0].iov_len = sizeof(resp);
+		if (op == CART_OP_RDFRME) {
+			frame = frame_of(reg);
+			iov[1].iov_base = (frame != NULL) ? frame : memset(scratch, 0, bytes);
+			iov[1].iov_len = bytes;
+			if (features & CART_FEATURE_COMPRESS) {
+				for (at = 0, iov[1].iov_len = 0; at < bytes; at += CART_FRAME_SIZE) {
+					iov[1].iov_len += cart_codec_encode((char *)iov[1].iov_base + at,
+						&tx_frames[iov[1].iov_len], &codec_out);
+				}
+				iov[1].iov_base = tx_frames;
+			}
+		}
+		if (op == CART_OP_INITMS) {
+			features = (((reg >> 48) & 0xff) & CART_FEATURE_ASK) ? (ntohll64(resp) >> 48) & 0xff : 0;
+		}
+		if (xfer_full(sock, 1, iov, (op == CART_OP_RDFRME) ? 2 : 1) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART send failed : [%s]", strerror(errno));
+			break;
+		}
+		if (op == CART_OP_POWOFF) {
+			break;
+		}
+	}
+	close(sock);
+
+	//a client that went away without a power off leaves the system down
+	if (cart_initialized && !server_stop) {
+		power_off();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listen_socket
+// Description  : accept clients on a TCP or Unix-domain socket, one at a
+//                time
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful, -1 if failure
+
+static int listen_socket(CartTransport *t) {
+	struct sockaddr_in saddr;
+	struct sockaddr_un uaddr;
+	int sock, client, one = 1, bufsize = CART_SOCKET_BUFFER;
+
+	sock = socket((t->type == CART_TRANSPORT_TCP) ? PF_INET : AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART socket() create failed : [%s]", strerror(errno));
+		return( -1 );
+	}
+
+	if (t->type == CART_TRANSPORT_TCP) {
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		memset(&saddr, 0, sizeof(saddr));
+		saddr.sin_family = AF_INET;
+		saddr.sin_port = htons(t->port ? t->port : CART_DEFAULT_PORT);
+		saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+		if ( (t->host[0] != '\0') && (inet_aton(t->host, &saddr.sin_addr) == 0) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART server: bad address [%s]", t->host);
+			close(sock);
+			return( -1 );
+		}
+		if (bind(sock, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART bind() create failed : [%s]", strerror(errno));
+			close(sock);
+			return( -1 );
+		}
+	} else {
+		memset(&uaddr, 0, sizeof(uaddr));
+		uaddr.sun_family = AF_UNIX;
+		if (strlen(t->path) >= sizeof(uaddr.sun_path)) {
+			logMessage(LOG_ERROR_LEVEL, "CART server: socket path too long [%s]", t->path);
+			close(sock);
+			return( -1 );
+		}
+		strcpy(uaddr.sun_path, t->path);
+		unlink(t->path);
+		if (bind(sock, (struct sockaddr *)&uaddr, sizeof(uaddr)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART bind() create failed : [%s]", strerror(errno));
+			close(sock);
+			return( -1 );
+		}
+	}
+
+	if (listen(sock, CART_MAX_BACKLOG) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART listen() create failed : [%s]", strerror(errno));
+		close(sock);
+		return( -1 );
+	}
+
+	while (!server_stop) {
+		if ((client = accept(sock, NULL, NULL)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			logMessage(LOG_ERROR_LEVEL, "CART server accept failed, aborting.");
+			break;
+		}
+		server_features = CART_FEATURE_BATCH | CART_FEATURE_PARTIAL | CART_FEATURE_COMPRESS;
+		if (t->type == CART_TRANSPORT_TCP) {
+			setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		setsockopt(client, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+		setsockopt(client, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+		serve_socket(client);
+	}
+
+	close(sock);
+	if (t->type == CART_TRANSPORT_UNIX) {
+		unlink(t->path);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serve_shm
+// Description  : answer requests on the shared-memory rings, one client at
+//                a time.  A write is copied from its request slot into the
+//                cartridge and a read from the cartridge into its answer
+//                slot, nothing else copies a frame.
+//
+// Inputs       : t - the transport
+// Outputs      : 0 if successful, -1 if failure
+
+static int serve_shm(CartTransport *t) {
+	CartShmRegion *r;
+	CartShmSlot *slot;
+	CartXferRegister reg, resp;
+	char *frame;
+	int op;
+
+	if ((r = cart_shm_map(t->path, 1)) == NULL) {
+		return( -1 );
+	}
+	server_region = r;
+	server_features = 0;	//a slot carries one frame
+
+	while (!server_stop) {
+		if ((slot = cart_shm_peek(r, &r->requests)) == NULL) {
+			//the client died, make ready for the next one
+			if (!server_stop) {
+				logMessage(LOG_ERROR_LEVEL, "CART server: shm client went away.");
+				cart_shm_reset(r);
+				if (cart_initialized) {
+					power_off();
+				}
+			}
+			continue;
+		}
+		reg = slot->reg;
+		op = (reg >> 56) & 0xff;
+		if ( (op == CART_OP_WRFRME) && ((frame = frame_of(reg)) != NULL) ) {
+			memcpy(frame, slot->frame, CART_FRAME_SIZE);
+		}
+		cart_shm_release(&r->requests);
+
+		resp = cart_server_execute(reg, (op == CART_OP_RDFRME || op == CART_OP_WRFRME) ?
+			CART_FRAME_SIZE : 0);
+		frame = (op == CART_OP_RDFRME) ? frame_of(reg) : NULL;
+		if (cart_shm_put(r, &r->answers, resp, frame) == -1) {
+			if (!server_stop) {
+				cart_shm_reset(r);
+				if (cart_initialized) {
+					power_off();
+				}
+			}
+			continue;
+		}
+
+		//the client detaches once it has the answer to a power off
+		if (op == CART_OP_POWOFF) {
+			while ( atomic_load(&r->attached) && !server_stop &&
+					((r->client_pid == 0) || (kill(r->client_pid, 0) == 0)) ) {
+				usleep(1000);
+			}
+			cart_shm_reset(r);
+		}
+	}
+
+	server_region = NULL;
+	cart_shm_unmap(r, t->path, 1);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_server
+// Description  : Run the stand-in server until it is signalled to stop
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_server(void) {
+	struct sigaction sa;
+	CartTransport t;
+	int ret;
+
+	if (cart_server_uri != NULL) {
+		if (cart_transport_parse(cart_server_uri, &t) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART server: bad transport [%s]", cart_server_uri);
+			return( -1 );
+		}
+	} else {
+		memset(&t, 0, sizeof(t));
+		t.type = CART_TRANSPORT_TCP;
+		t.port = cart_server_port;
+	}
+
+	if (open_memory() == -1) {
+		return( -1 );
+	}
+
+	//no SA_RESTART, a blocked accept or read has to notice the stop
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_server;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	logMessage(LOG_OUTPUT_LEVEL, "CART server: listening on %s", (cart_server_uri != NULL) ?
+		cart_server_uri : "tcp");
+	ret = (t.type == CART_TRANSPORT_SHM) ? serve_shm(&t) : listen_socket(&t);
+
+	logMessage(LOG_OUTPUT_LEVEL, "Shutting down CART server ...");
+	if (cart_initialized) {
+		power_off();
+	}
+	munmap(cart_memory, CART_MEMORY_SIZE);
+	cart_memory = NULL;
+	return( ret );
+}
@@ -20,30 +20,64 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <aio.h>
 
 // Project Includes
 #include <cart_driver.h>
 #include <cart_cache.h>
 #include <cart_network.h>
+#include <cart_workload.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
 #define CART_WORKLOAD_DIR "workload"
 #define CART_SIM_MAX_OPEN_FILES 128
-#define CART_ARGUMENTS "huvl:c:i:p:"
+#define CART_SIM_MAX_THREADS 64
+#define CART_SIM_VALIDATE_CHUNK (64 * CART_FRAME_SIZE) // Bytes compared at a time
+#define CART_SIM_VALIDATE_THREADS 4 // Files validated at a time, they wait on the bus
+#define CART_ARGUMENTS "huUvwLdkzH:S:M:R:A:j:C:V:B:l:c:i:p:t:"
 #define USAGE \
-	"USAGE: cart_sim [-h] [-v] [-l <logfile>] [-c <sz>] <workload-file>\n" \
+	"USAGE: cart_sim [-h] [-u] [-U] [-v] [-w] [-L] [-d] [-k] [-z] [-H <n>] [-S <w>:<u>] [-l <logfile>] [-c <sz>]\n" \
+	"                [-M /<name>[:<frames>]] [-R <tracefile>] [-A <tracefile>] [-j <n>] [-C <binfile>]\n" \
+	"                [-V <n>] [-B none|sync|async] [-t <uri>]\n" \
+	"                <workload-file> [<workload-file> ...]\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
+	"    -u - run the unit tests (no server needed)\n" \
+	"    -U - run the driver unit tests against the server\n" \
 	"    -v - verbose output\n" \
+	"    -w - buffer writes in the cache until a sync (no write-through)\n" \
+	"    -L - log-structured layout, writes go to the head of a log\n" \
+	"    -d - defragment the files after the workload, before validation\n" \
+	"    -k - clone every file after the workload, validate the clones too\n" \
+	"    -z - compress frames on the wire if the server supports it\n" \
+	"    -H - keep the busiest files on the first <n> cartridges\n" \
+	"    -S - stripe every file over <w> servers, <u> frames per stripe unit\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
 	"    -c - set the cart block cache to size <sz> (disabled for assign #2)\n" \
+	"    -M - share the frames read with the other processes mapping the\n" \
+	"         shared memory segment /<name> (created with <frames> frames,\n" \
+	"         removed by the last process, refused to other servers' clients)\n" \
+	"    -R - record the bus traffic to <tracefile>, for cart_replay\n" \
+	"    -A - record the frame cache accesses to <tracefile>, for cart_cachesim\n" \
+	"    -j - split every workload over <n> threads by filename\n" \
+	"    -C - compile the workload to <binfile> and stop, a compiled workload\n" \
+	"         is replayed from memory without parsing (given in place of the text)\n" \
+	"    -V - validate <n> files at a time, default 4\n" \
+	"    -B - how the .cmm backups of the files validated are written: not at\n" \
+	"         all, as they are read (the default) or in the background\n" \
 	"    -i - IP address of server to connect to.\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -t - server transport: tcp://ip:port, unix:///path or shm://name, a\n" \
+	"         comma separated list spreads the cartridges over the servers\n" \
 	"\n" \
-	"    <workload-file> - file contain the workload to simulate\n" \
+	"    <workload-file> - file contain the workload to simulate, several are\n" \
+	"                      replayed at the same time, one thread each\n" \
 	"\n" \
 
 // This is the file table
@@ -52,15 +86,72 @@ typedef struct {
 	int16_t   fhandle;   // This is a file handle for the opened file
 } CartSimulationTable;
 
+// A thread replaying a workload, or the files of one that hash to its part
+typedef struct {
+	char     *wload;      // the workload file
+	int       part;       // which of the parts of the workload this is
+	int       parts;
+	pthread_t thread;
+	int       result;     // 0 if the replay succeeded
+	CartSimulationTable ftable[CART_SIM_MAX_OPEN_FILES];
+	uint64_t  ops;        // workload commands
+	uint64_t  bytes;      // read and written
+	uint64_t  busy_ns;    // time in the driver
+	uint64_t  max_ns;     // slowest command
+	uint64_t  elapsed_ns; // start to finish
+} CartSimulationThread;
+
+// A file to validate
+typedef struct {
+	char     *filename;   // the source in the workload directory
+	int16_t   fhandle;    // the file (or its clone) in the driver
+	char     *backup;     // name of the .cmm backup, without the .cmm
+	int       result;     // 0 if it validated
+} CartSimulationCheck;
+
+// The files the validation threads take from
+typedef struct {
+	CartSimulationCheck *checks;
+	int       count;
+	int       next;       // the next one to take
+	pthread_mutex_t lock;
+} CartSimulationPool;
+
+// How the .cmm backups are written
+typedef enum {
+	CART_BACKUP_NONE  = 0,
+	CART_BACKUP_SYNC  = 1,  // each chunk as it is read
+	CART_BACKUP_ASYNC = 2,  // each chunk in the background while the next is read
+} CartBackupMode;
+
 //
 // Global Data
 int verbose;
+int buffered_writes = 0;  // turn write-through off in the driver
+int log_layout = 0;       // use the log-structured layout
+int defrag_files = 0;     // defragment before validating
+unsigned int hot_carts = 0; // cartridges kept for the busiest files
+unsigned short stripe_width = 0, stripe_unit = 0; // striping of every file
+int clone_files = 0;      // clone the files before validating
+int replay_parts = 1;     // threads each workload is split over
+char *compile_to = NULL;  // write a compiled workload here instead of replaying
+int validate_threads = CART_SIM_VALIDATE_THREADS; // files validated at a time
+CartBackupMode backup_mode = CART_BACKUP_SYNC; // how the .cmm backups are written
 
 //
 // Functional Prototypes
 
-int simulate_CART( char *wload );             // control loop of the CART simulation
-int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesystem
+int simulate_CART( char **wloads, int count ); // control loop of the CART simulation
+int replay_workload(CartSimulationThread *r); // Replay (part of) one workload
+int replay_compiled(CartSimulationThread *r); // Replay (part of) a compiled workload
+int compile_workload(char *wload, char *out); // Compile a text workload
+void *replay_thread(void *arg);               // Thread running replay_workload
+int validate_file(char *fname, int16_t mfh, char *bkname); // Validate a file in the filesystem
+int validate_files(CartSimulationTable *ftable, int16_t *clones); // Validate them all, in parallel
+void *validate_worker(void *arg);             // Thread taking files to validate
+int backup_wait(struct aiocb *cb);            // Wait for a backup write to finish
+void log_layouts(CartSimulationTable *ftable, const char *when); // Log file fragmentation
+int clone_table(CartSimulationTable *ftable, int16_t *clones);  // Clone every file
 
 //
 // Functions
@@ -77,8 +168,9 @@ int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesyst
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0, unit_tests = 0;
-	uint32_t cache_size = 0;
+	int ch, verbose = 0, log_initialized = 0, unit_tests = 0, driver_tests = 0;
+	uint32_t cache_size = 0, shared_frames = 0;
+	char *sep, *shared_name = NULL;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, CART_ARGUMENTS)) != -1) {
@@ -92,10 +184,100 @@ int main( int argc, char *argv[] ) {
 			verbose = 1;
 			break;
 
+		case 'w': // Buffered writes flag
+			buffered_writes = 1;
+			break;
+
+		case 'L': // Log-structured layout flag
+			log_layout = 1;
+			break;
+
+		case 'd': // Defragment flag
+			defrag_files = 1;
+			break;
+
+		case 'k': // Clone flag
+			clone_files = 1;
+			break;
+
+		case 'z': // Wire compression flag
+			cart_network_compress = 1;
+			break;
+
+		case 'H': // Hot cartridges
+			if ( sscanf( optarg, "%u", &hot_carts ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad hot cartridge count [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'S': // Striping
+			if ( (sscanf( optarg, "%hu:%hu", &stripe_width, &stripe_unit ) != 2) || (stripe_unit == 0) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad striping [%s], expected <width>:<unit>", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'M': // Shared frame cache
+			shared_name = strdup(optarg);
+			if ( (sep = strchr(shared_name, ':')) != NULL ) {
+				*sep = '\0';
+				if ( sscanf( sep + 1, "%u", &shared_frames ) != 1 ) {
+				    logMessage( LOG_ERROR_LEVEL, "Bad shared cache size [%s]", optarg );
+				    return( -1 );
+				}
+			}
+			break;
+
+		case 'R': // Record the bus traffic
+			cart_network_trace = strdup(optarg);
+			break;
+
+		case 'A': // Record the cache accesses
+			set_cart_cache_trace(optarg);
+			break;
+
+		case 'j': // Threads per workload
+			if ( (sscanf( optarg, "%d", &replay_parts ) != 1) || (replay_parts < 1) ||
+					(replay_parts > CART_SIM_MAX_THREADS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad thread count [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'C': // Compile the workload
+			compile_to = strdup(optarg);
+			break;
+
+		case 'V': // Validation threads
+			if ( (sscanf( optarg, "%d", &validate_threads ) != 1) || (validate_threads < 1) ||
+					(validate_threads > CART_SIM_MAX_THREADS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad validation thread count [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'B': // Backup mode
+			if (strcmp(optarg, "none") == 0) {
+				backup_mode = CART_BACKUP_NONE;
+			} else if (strcmp(optarg, "sync") == 0) {
+				backup_mode = CART_BACKUP_SYNC;
+			} else if (strcmp(optarg, "async") == 0) {
+				backup_mode = CART_BACKUP_ASYNC;
+			} else {
+			    logMessage( LOG_ERROR_LEVEL, "Bad backup mode [%s], expected none, sync or async", optarg );
+			    return( -1 );
+			}
+			break;
+
 		case 'u': // Unit test Flag
 			unit_tests = 1;
 			break;
 
+		case 'U': // Driver unit test Flag
+			driver_tests = 1;
+			break;
+
 		case 'l': // Set the log filename
 			initializeLogWithFilename( optarg );
 			log_initialized = 1;
@@ -122,6 +304,18 @@ int main( int argc, char *argv[] ) {
 			}
             break;			
 
+		case 't': // Set the transport to the server(s)
+			for (sep = optarg; sep != NULL; sep = strchr(sep, ',')) {
+				sep += (*sep == ',');
+				if ( strncmp(sep, "tcp://", 6) && strncmp(sep, "unix://", 7) &&
+						strncmp(sep, "shm://", 6) ) {
+					logMessage( LOG_ERROR_LEVEL, "Bad transport [%s]", optarg );
+					return(-1);
+				}
+			}
+			cart_network_uri = strdup(optarg);
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -140,6 +334,10 @@ int main( int argc, char *argv[] ) {
 	if (cache_size != 0) {
 		set_cart_cache_size(cache_size);
 	}
+	if ( (shared_name != NULL) && (set_cart_cache_shared(shared_name, shared_frames) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Bad shared cache name [%s], expected /<name>", shared_name );
+		return( -1 );
+	}
 
 	// If exgtracting file from data
 	if (unit_tests) {
@@ -153,6 +351,21 @@ int main( int argc, char *argv[] ) {
 			logMessage(LOG_ERROR_LEVEL, "Unit tests failed, aborting.\n\n");
 		}
 
+	} else if (driver_tests) {
+
+		// Run the driver unit tests, twice in one power cycle
+		enableLogLevels( LOG_INFO_LEVEL );
+		if ( cart_poweron() == -1 ) {
+			logMessage(LOG_ERROR_LEVEL, "Driver unit tests cannot power on, aborting.\n\n");
+			return( -1 );
+		}
+		if ( (cartDriverUnitTest() == 0) && (cartDriverUnitTest() == 0) ) {
+			logMessage(LOG_INFO_LEVEL, "Driver unit tests completed successfully.\n\n");
+		} else {
+			logMessage(LOG_ERROR_LEVEL, "Driver unit tests failed, aborting.\n\n");
+		}
+		cart_poweroff();
+
 	} else {
 
 		// The filename should be the next option
@@ -164,8 +377,13 @@ int main( int argc, char *argv[] ) {
 
 		}
 
+		// Compile the workload instead if asked to
+		if (compile_to != NULL) {
+			return( compile_workload(argv[optind], compile_to) );
+		}
+
 		// Run the simulation
-		if ( simulate_CART(argv[optind]) == 0 ) {
+		if ( simulate_CART(&argv[optind], argc - optind) == 0 ) {
 			logMessage( LOG_INFO_LEVEL, "CART simulation completed successfully.\n\n" );
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CART simulation failed.\n\n" );
@@ -176,43 +394,228 @@ int main( int argc, char *argv[] ) {
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : now_ns
+// Description  : read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : nanoseconds
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return( (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_part
+// Description  : Which thread replays a file when a workload is split, all
+//                of the commands of a file stay on one thread and in order
+//
+// Inputs       : fname - the file in the workload
+//                parts - the threads the workload is split over
+// Outputs      : the part
+
+static int file_part(const char *fname, int parts) {
+	uint32_t h = 2166136261U;
+
+	while (*fname) {
+		h = (h ^ (uint8_t)*fname++) * 16777619U;
+	}
+	return( h % parts );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : simulate_CART
 // Description  : The main control loop for the processing of the CART
-//                simulation.
+//                simulation.  Every workload (or part of one with -j) is
+//                replayed through the driver on its own thread, then the
+//                files of all of them are validated.
 //
-// Inputs       : wload - the name of the workload file
+// Inputs       : wloads - the names of the workload files
+//                count - how many there are
 // Outputs      : 0 if successful test, -1 if failure
 
-int simulate_CART( char *wload ) {
+int simulate_CART( char **wloads, int count ) {
 
 	// Local variables
-	char line[1024], fname[128], command[128], text[1025], *sep, *rbuf;
-	FILE *fhandle = NULL;
-	int32_t err=0, len, off, fields, linecount;
 	CartSimulationTable ftable[CART_SIM_MAX_OPEN_FILES];
-	int idx, i;
+	int16_t clones[CART_SIM_MAX_OPEN_FILES];
+	CartSimulationThread *replays;
+	uint64_t started, elapsed, ops = 0, bytes = 0, busy = 0, slowest = 0;
+	int nreplays = count * replay_parts, failed = 0, files = 0, idx, i, j;
+	FILE *fhandle;
 
 	// Setup the file table
 	memset(ftable, 0x0, sizeof(CartSimulationTable)*CART_SIM_MAX_OPEN_FILES);
-
-	// Open the workload file
-	linecount = 0;
-	if ( (fhandle=fopen(wload, "r")) == NULL ) {
-		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
-			wload, strerror(errno) );
+	if (nreplays > CART_SIM_MAX_THREADS) {
+		logMessage( LOG_ERROR_LEVEL, "CART simulator can run at most %d threads, not %d.",
+			CART_SIM_MAX_THREADS, nreplays );
 		return( -1 );
 	}
 
+	// Check the workload files before starting
+	for (i=0; i<count; i++) {
+		if ( (fhandle=fopen(wloads[i], "r")) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
+				wloads[i], strerror(errno) );
+			return( -1 );
+		}
+		fclose( fhandle );
+	}
+
 	// Startup the interface
 	if (cart_poweron() == -1) {
 		logMessage( LOG_ERROR_LEVEL, "CART simulator failed initialization.");
-		fclose( fhandle );
 		return( -1 );
 	}
+	if (buffered_writes) {
+		cart_set_write_through(0);
+	}
+	if (log_layout) {
+		cart_set_log_structured(1);
+	}
+	if (hot_carts && cart_set_hot_cold(hot_carts) == -1) {
+		logMessage( LOG_ERROR_LEVEL, "CART simulator cannot use %u hot cartridges.", hot_carts );
+	}
 	logMessage(CartSimulatorLLevel, "CART simulator initialization complete.");
 
+	// Replay the workloads, all at once
+	replays = calloc(nreplays, sizeof(CartSimulationThread));
+	started = now_ns();
+	for (i=0; i<nreplays; i++) {
+		replays[i].wload = wloads[i / replay_parts];
+		replays[i].part = i % replay_parts;
+		replays[i].parts = replay_parts;
+		if (nreplays == 1) {
+			replay_thread(&replays[i]);
+		} else if (pthread_create(&replays[i].thread, NULL, replay_thread, &replays[i]) != 0) {
+			logMessage( LOG_ERROR_LEVEL, "CART simulator cannot start a replay thread.");
+			replays[i].result = -1;
+			replays[i].parts = 0;
+		}
+	}
+	for (i=0; (nreplays > 1) && (i<nreplays); i++) {
+		if (replays[i].parts != 0) {
+			pthread_join(replays[i].thread, NULL);
+		}
+	}
+	elapsed = now_ns() - started;
+
+	// Report each thread and all of them, gather their files
+	for (i=0; i<nreplays; i++) {
+		CartSimulationThread *r = &replays[i];
+		for (j=0, idx=0; j<CART_SIM_MAX_OPEN_FILES; j++) {
+			if (r->ftable[j].filename != NULL) {
+				CMPSC_ASSERT1(files<CART_SIM_MAX_OPEN_FILES, "Too many open files on CART sim [%d]", files);
+				ftable[files++] = r->ftable[j];
+				idx++;
+			}
+		}
+		if (nreplays > 1) {
+			logMessage(LOG_OUTPUT_LEVEL, "CART replay thread %d [%s %d/%d]: %lu ops on %d files in %.3f s, "
+				"%.0f ops/s, %.2f MB/s, latency avg %.1f us max %.1f us%s", i, r->wload, r->part + 1, r->parts,
+				(unsigned long)r->ops, idx, r->elapsed_ns / 1e9, r->ops / (r->elapsed_ns / 1e9 + 1e-9),
+				r->bytes / (r->elapsed_ns / 1e3 + 1e-3), r->ops ? r->busy_ns / 1e3 / r->ops : 0.0,
+				r->max_ns / 1e3, (r->result == 0) ? "" : " (failed)");
+		}
+		ops += r->ops;
+		bytes += r->bytes;
+		busy += r->busy_ns;
+		slowest = (r->max_ns > slowest) ? r->max_ns : slowest;
+		failed |= (r->result != 0);
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "CART replay: %d thread%s, %lu ops in %.3f s, %.0f ops/s, %.2f MB/s, "
+		"latency avg %.1f us max %.1f us", nreplays, (nreplays == 1) ? "" : "s", (unsigned long)ops,
+		elapsed / 1e9, ops / (elapsed / 1e9 + 1e-9), bytes / (elapsed / 1e3 + 1e-3),
+		ops ? busy / 1e3 / ops : 0.0, slowest / 1e3);
+	free(replays);
+	if (failed) {
+		return( -1 );
+	}
+
+	// Defragment the files first if asked to (offline mode)
+	if (defrag_files) {
+		log_layouts(ftable, "before defrag");
+		logMessage(LOG_OUTPUT_LEVEL, "CART defrag moved %d frames.", cart_defrag());
+		log_layouts(ftable, "after defrag");
+	}
+
+	// Clone the files, the clones must hold the same data
+	if (clone_files && (clone_table(ftable, clones) != 0)) {
+		return( -1 );
+	}
+
+	// Now validate the files (and their clones)
+	if (validate_files(ftable, clone_files ? clones : NULL) != 0) {
+		return(-1);
+	}
+
+	// Shut down the interface
+	if (cart_poweroff() == -1) {
+		logMessage( LOG_ERROR_LEVEL, "CART simulator failed shutdown.");
+		return( -1 );
+	}
+	logMessage(CartSimulatorLLevel, "CART simulator shutdown complete.");
+	logMessage(LOG_OUTPUT_LEVEL, "CART simulation: all tests successful!!!.");
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_thread
+// Description  : Thread replaying (part of) a workload
+//
+// Inputs       : arg - the CartSimulationThread
+// Outputs      : NULL
+
+void *replay_thread(void *arg) {
+	CartSimulationThread *r = arg;
+	uint64_t started = now_ns();
+
+	r->result = replay_workload(r);
+	r->elapsed_ns = now_ns() - started;
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_workload
+// Description  : Run the commands of a workload through the driver, only
+//                those on the files of the thread's part if it is split
+//
+// Inputs       : r - the thread, its file table and statistics are filled in
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_workload(CartSimulationThread *r) {
+
+	// Local variables
+	char line[1024], fname[128], command[128], text[1025], *sep, *rbuf = NULL;
+	FILE *fhandle = NULL;
+	int32_t err=0, len, off, fields, linecount, rbuf_size = 0;
+	uint64_t started, took;
+	int idx, i;
+
+	// Open the workload file, a compiled one is mapped instead
+	linecount = 0;
+	if ( (fhandle=fopen(r->wload, "r")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
+			r->wload, strerror(errno) );
+		return( -1 );
+	}
+	if ( (fread(line, 1, sizeof(CART_WORKLOAD_MAGIC) - 1, fhandle) == sizeof(CART_WORKLOAD_MAGIC) - 1) &&
+			(memcmp(line, CART_WORKLOAD_MAGIC, sizeof(CART_WORKLOAD_MAGIC) - 1) == 0) ) {
+		fclose( fhandle );
+		return( replay_compiled(r) );
+	}
+	rewind( fhandle );
+
 	// While file not done
 	while (!feof(fhandle)) {
 
@@ -230,6 +633,11 @@ int simulate_CART( char *wload ) {
 				return( -1 );
 			}
 
+			// Other threads replay the files outside this part
+			if ( (r->parts > 1) && (file_part(fname, r->parts) != r->part) ) {
+				continue;
+			}
+
 			// Just log the contents
 			logMessage(CartSimulatorLLevel, "File [%s], command [%s], len=%d, offset=%d",
 					fname, command, len, off);
@@ -238,7 +646,7 @@ int simulate_CART( char *wload ) {
 			idx = -1;
 			i = 0;
 			while ( (i < CART_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-				if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
+				if ( (r->ftable[i].filename != NULL) && (strcmp(r->ftable[i].filename,fname) == 0) ) {
 					idx = i;
 				}
 				i++;
@@ -250,32 +658,41 @@ int simulate_CART( char *wload ) {
 				// Log message, find unused index and save filename for later use
 				logMessage(CartSimulatorLLevel, "CART_SIM : Opening file [%s]", fname);
 				idx = 0;
-				while ((ftable[idx].filename != NULL) && (idx < CART_SIM_MAX_OPEN_FILES)) {
+				while ((r->ftable[idx].filename != NULL) && (idx < CART_SIM_MAX_OPEN_FILES)) {
 					idx++;
 				}
 				CMPSC_ASSERT1(idx<CART_SIM_MAX_OPEN_FILES, "Too many open files on CART sim [%d]", idx);
-				ftable[idx].filename = strdup(fname);
+				r->ftable[idx].filename = strdup(fname);
 
 				// Now perform the open
-				ftable[idx].fhandle = cart_open(ftable[idx].filename);
-				if (ftable[idx].fhandle == -1) {
+				r->ftable[idx].fhandle = cart_open(r->ftable[idx].filename);
+				if (r->ftable[idx].fhandle == -1) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
+					fclose( fhandle );
+					return(-1);
+				}
+				if (stripe_width && (cart_set_striping(r->ftable[idx].fhandle, stripe_width, stripe_unit) == -1)) {
+					logMessage(LOG_ERROR_LEVEL, "Cannot stripe [%s] over %u servers, aborting simulation.",
+						fname, stripe_width);
+					fclose( fhandle );
 					return(-1);
 				}
 
 			}
 
 			// Now execute the specific command
+			started = now_ns();
 			if (strncmp(command, "WRITEAT", 7) == 0) {
 
 				// Log the command executed
 				logMessage(CartSimulatorLLevel, "CART_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
 
 				// First perform the seek
-				if (cart_seek(ftable[idx].fhandle, off)) {
+				if (cart_seek(r->ftable[idx].fhandle, off)) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
+					fclose( fhandle );
 					return(-1);
 				}
 
@@ -284,16 +701,17 @@ int simulate_CART( char *wload ) {
 				CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
 				strncpy(text, sep+1, len);
 				text[len] = 0x0;
-				for (i=0; i<strlen(text); i++) {
+				for (i=0; i<len; i++) {
 					if (text[i] == '^') {
 						text[i] = '\n';
 					}
 				}
 
 				// Now perform the write
-				if (cart_write(ftable[idx].fhandle, text, len) != len) {
+				if (cart_write(r->ftable[idx].fhandle, text, len) != len) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
+					fclose( fhandle );
 					return(-1);
 				}
 
@@ -305,7 +723,7 @@ int simulate_CART( char *wload ) {
 				CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
 				strncpy(text, sep+1, len);
 				text[len] = 0x0;
-				for (i=0; i<strlen(text); i++) {
+				for (i=0; i<len; i++) {
 					if (text[i] == '^') {
 						text[i] = '\n';
 					}
@@ -315,9 +733,10 @@ int simulate_CART( char *wload ) {
 				logMessage(CartSimulatorLLevel, "CART_SIM : Writing %d bytes to file [%s]", len, fname);
 
 				// Now perform the write
-				if (cart_write(ftable[idx].fhandle, text, len) != len) {
+				if (cart_write(r->ftable[idx].fhandle, text, len) != len) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
+					fclose( fhandle );
 					return(-1);
 				}
 
@@ -328,9 +747,10 @@ int simulate_CART( char *wload ) {
 				logMessage(CartSimulatorLLevel, "CART_SIM : Seeking to position %d in file [%s]", off, fname);
 
 				// Now perform the seek
-				if (cart_seek(ftable[idx].fhandle, off) != len) {
+				if (cart_seek(r->ftable[idx].fhandle, off) != len) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
+					fclose( fhandle );
 					return(-1);
 				}
 
@@ -339,15 +759,18 @@ int simulate_CART( char *wload ) {
 				// Log the command executed
 				logMessage(CartSimulatorLLevel, "CART_SIM : Reading %d bytes from file [%s]", len, fname);
 
-				// Now perform the read
-				rbuf = malloc(len);
-				if (cart_read(ftable[idx].fhandle, rbuf, len) != len) {
+				// Now perform the read, into a buffer kept for the next ones
+				if (len > rbuf_size) {
+					free(rbuf);
+					rbuf = malloc(len);
+					rbuf_size = len;
+				}
+				if (cart_read(r->ftable[idx].fhandle, rbuf, len) != len) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
+					fclose( fhandle );
 					return(-1);
 				}
-				free(rbuf);
-				rbuf = NULL;
 
 			} else {
 
@@ -355,6 +778,15 @@ int simulate_CART( char *wload ) {
 				CMPSC_ASSERT1(0, "CART_SIM : Failed, unknown command [%s]", command);
 
 			}
+
+			// Account for the command
+			took = now_ns() - started;
+			r->ops++;
+			r->bytes += (strncmp(command, "SEEK", 4) == 0) ? 0 : len;
+			r->busy_ns += took;
+			if (took > r->max_ns) {
+				r->max_ns = took;
+			}
 		}
 
 		// Check for the virtual level failing
@@ -365,48 +797,397 @@ int simulate_CART( char *wload ) {
 		}
 	}
 
-	// Now walk the the table of files to validate
-	for (i=0; i<CART_SIM_MAX_OPEN_FILES; i++) {
-		if (ftable[i].filename != NULL) {
-			if (validate_file(ftable[i].filename, ftable[i].fhandle) != 0) {
-				logMessage(LOG_ERROR_LEVEL, "CART Validation failed on file [%s].", ftable[i].filename,fname);
-				fclose( fhandle );
-				return(-1);
+	// Close the workload file, successfully
+	free(rbuf);
+	fclose( fhandle );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_compiled
+// Description  : Run a compiled workload through the driver, straight from
+//                a mapping of the file: file handles are looked up by the
+//                file number, writes come from the payloads in place and
+//                reads go to one buffer
+//
+// Inputs       : r - the thread, its file table and statistics are filled in
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_compiled(CartSimulationThread *r) {
+
+	// Local variables
+	static const char *commands[] = { "WRITE", "WRITEAT", "SEEK", "READ" };
+	CartWorkloadHeader *hdr;
+	CartWorkloadOp *ops, *op;
+	char *map, *names, *payloads, *rbuf;
+	uint8_t mine[CART_SIM_MAX_OPEN_FILES];
+	uint64_t started, took, need;
+	struct stat st;
+	int fh, ok = 1;
+	int16_t cfh;
+	uint32_t i;
+
+	// Map the workload and check it holds what its header says
+	if ( ((fh = open(r->wload, O_RDONLY)) == -1) || (fstat(fh, &st) == -1) ||
+			((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fh, 0)) == MAP_FAILED) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.",
+			r->wload, strerror(errno) );
+		if (fh != -1) {
+			close(fh);
+		}
+		return( -1 );
+	}
+	close(fh);
+	hdr = (CartWorkloadHeader *)map;
+	need = sizeof(CartWorkloadHeader);
+	if ((uint64_t)st.st_size >= need) {
+		need += (uint64_t)hdr->files * CART_WORKLOAD_NAME + (uint64_t)hdr->ops * sizeof(CartWorkloadOp) +
+			hdr->payload_size;
+	}
+	if ( (need != (uint64_t)st.st_size) || (hdr->op_size != sizeof(CartWorkloadOp)) ||
+			(hdr->files > CART_SIM_MAX_OPEN_FILES) ) {
+		logMessage( LOG_ERROR_LEVEL, "CART compiled workload [%s] is damaged.", r->wload );
+		munmap(map, st.st_size);
+		return( -1 );
+	}
+	names = map + sizeof(CartWorkloadHeader);
+	ops = (CartWorkloadOp *)(names + hdr->files * CART_WORKLOAD_NAME);
+	payloads = (char *)(ops + hdr->ops);
+	for (i=0; i<hdr->ops; i++) {
+		if ( (ops[i].file >= hdr->files) || (ops[i].command > CART_WORKLOAD_READ) || (ops[i].len > INT32_MAX) ||
+				((ops[i].command <= CART_WORKLOAD_WRITEAT) &&
+				((uint64_t)ops[i].data + ops[i].len > hdr->payload_size)) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART compiled workload [%s] has a bad operation %u.", r->wload, i );
+			munmap(map, st.st_size);
+			return( -1 );
+		}
+	}
+
+	// Which files are this thread's, and the one read buffer
+	for (i=0; i<hdr->files; i++) {
+		mine[i] = (r->parts == 1) || (file_part(names + i * CART_WORKLOAD_NAME, r->parts) == r->part);
+	}
+	rbuf = malloc(hdr->max_read + 1);
+
+	// Replay, the file table is indexed by the file number
+	for (i=0; ok && (i<hdr->ops); i++) {
+		op = &ops[i];
+		if ( !mine[op->file] ) {
+			continue;
+		}
+
+		// Open the file the first time it is used
+		if (r->ftable[op->file].filename == NULL) {
+			r->ftable[op->file].filename = strdup(names + op->file * CART_WORKLOAD_NAME);
+			r->ftable[op->file].fhandle = cart_open(r->ftable[op->file].filename);
+			if (r->ftable[op->file].fhandle == -1) {
+				logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.",
+					r->ftable[op->file].filename);
+				ok = 0;
+				break;
 			}
-		}		
+			if (stripe_width && (cart_set_striping(r->ftable[op->file].fhandle, stripe_width, stripe_unit) == -1)) {
+				logMessage(LOG_ERROR_LEVEL, "Cannot stripe [%s] over %u servers, aborting simulation.",
+					r->ftable[op->file].filename, stripe_width);
+				ok = 0;
+				break;
+			}
+		}
+		cfh = r->ftable[op->file].fhandle;
+
+		// Now execute the specific command
+		started = now_ns();
+		switch (op->command) {
+		case CART_WORKLOAD_WRITEAT:
+			ok = (cart_seek(cfh, op->off) == 0) && (cart_write(cfh, payloads + op->data, op->len) == op->len);
+			break;
+		case CART_WORKLOAD_WRITE:
+			ok = (cart_write(cfh, payloads + op->data, op->len) == op->len);
+			break;
+		case CART_WORKLOAD_SEEK:
+			ok = (cart_seek(cfh, op->off) == op->len);
+			break;
+		case CART_WORKLOAD_READ:
+			ok = (cart_read(cfh, rbuf, op->len) == op->len);
+			break;
+		}
+		if ( !ok ) {
+			logMessage(LOG_ERROR_LEVEL, "%s of file [%s], length %u at %u failed, aborting simulation.",
+				commands[op->command], r->ftable[op->file].filename, op->len, op->off);
+			break;
+		}
+
+		// Account for the command
+		took = now_ns() - started;
+		r->ops++;
+		r->bytes += (op->command == CART_WORKLOAD_SEEK) ? 0 : op->len;
+		r->busy_ns += took;
+		if (took > r->max_ns) {
+			r->max_ns = took;
+		}
 	}
 
-	// Shut down the interface
-	if (cart_poweroff() == -1) {
-		logMessage( LOG_ERROR_LEVEL, "CART simulator failed shutdown.");
-		fclose( fhandle );
+	// Unmap the workload
+	free(rbuf);
+	munmap(map, st.st_size);
+	return( ok ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compile_workload
+// Description  : Turn a text workload into a compiled one: the file names
+//                numbered in the order they appear, one fixed-size
+//                operation per line and the write payloads with '^' made
+//                newlines.  Lines can be of any length.
+//
+// Inputs       : wload - the text workload
+//                out - the compiled workload to write
+// Outputs      : 0 if successful, -1 if failure
+
+int compile_workload(char *wload, char *out) {
+
+	// Local variables
+	char names[CART_SIM_MAX_OPEN_FILES][CART_WORKLOAD_NAME], *line = NULL, *fname, *command, *sep;
+	CartWorkloadHeader hdr;
+	CartWorkloadOp *ops = NULL, *op;
+	char *payloads = NULL;
+	size_t line_size = 0;
+	uint64_t ops_size = 0, payloads_size = 0;
+	int32_t len, off, linecount = 0;
+	FILE *fhandle, *ohandle;
+	int idx, err = 0;
+
+	// Open the workload file
+	if ( (fhandle=fopen(wload, "r")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
+			wload, strerror(errno) );
 		return( -1 );
 	}
-	logMessage(CartSimulatorLLevel, "CART simulator shutdown complete.");
-	logMessage(LOG_OUTPUT_LEVEL, "CART simulation: all tests successful!!!.");
+	memset(names, 0x0, sizeof(names));
+	memset(&hdr, 0x0, sizeof(hdr));
+	fname = malloc(CART_WORKLOAD_NAME);
+	command = malloc(CART_WORKLOAD_NAME);
+
+	while ( !err && (getline(&line, &line_size, fhandle) != -1) ) {
+
+		// Parse out the string
+		linecount ++;
+		sep = strchr(line, ':');
+		if ( (sscanf(line, "%127s %127s %d %d", fname, command, &len, &off) != 4) || (sep == NULL) ||
+				(len < 0) || (off < 0) ) {
+			logMessage( LOG_ERROR_LEVEL, "CART un-parsable workload string, aborting [%s], line %d",
+					line, linecount );
+			err = 1;
+			break;
+		}
 
-	// Close the workload file, successfully
+		// Number the file
+		for (idx=0; (idx<(int)hdr.files) && strcmp(names[idx], fname); idx++);
+		if (idx == (int)hdr.files) {
+			if (hdr.files == CART_SIM_MAX_OPEN_FILES) {
+				logMessage( LOG_ERROR_LEVEL, "Too many files in the workload, line %d", linecount );
+				err = 1;
+				break;
+			}
+			strcpy(names[hdr.files++], fname);
+		}
+
+		// Add the operation
+		if (hdr.ops == ops_size) {
+			ops_size = ops_size ? ops_size * 2 : 4096;
+			ops = realloc(ops, ops_size * sizeof(CartWorkloadOp));
+		}
+		op = &ops[hdr.ops++];
+		memset(op, 0x0, sizeof(CartWorkloadOp));
+		op->file = idx;
+		op->len = len;
+		op->off = off;
+		if (strncmp(command, "WRITEAT", 7) == 0) {
+			op->command = CART_WORKLOAD_WRITEAT;
+		} else if (strncmp(command, "WRITE", 5) == 0) {
+			op->command = CART_WORKLOAD_WRITE;
+		} else if (strncmp(command, "SEEK", 4) == 0) {
+			op->command = CART_WORKLOAD_SEEK;
+		} else if (strncmp(command, "READ", 4) == 0) {
+			op->command = CART_WORKLOAD_READ;
+			hdr.max_read = (op->len > hdr.max_read) ? op->len : hdr.max_read;
+		} else {
+			logMessage( LOG_ERROR_LEVEL, "CART_SIM : unknown command [%s], line %d", command, linecount );
+			err = 1;
+			break;
+		}
+
+		// Keep the payload of a write, with the newlines put back
+		if (op->command <= CART_WORKLOAD_WRITEAT) {
+			if ( (strlen(sep+1) < (size_t)len) || (hdr.payload_size + len > UINT32_MAX) ) {
+				logMessage( LOG_ERROR_LEVEL, "Workload payload too short or too large, line %d", linecount );
+				err = 1;
+				break;
+			}
+			if (hdr.payload_size + len > payloads_size) {
+				while (hdr.payload_size + len > payloads_size) {
+					payloads_size = payloads_size ? payloads_size * 2 : 65536;
+				}
+				payloads = realloc(payloads, payloads_size);
+			}
+			op->data = hdr.payload_size;
+			for (idx=0; idx<len; idx++) {
+				payloads[hdr.payload_size + idx] = (sep[1 + idx] == '^') ? '\n' : sep[1 + idx];
+			}
+			hdr.payload_size += len;
+		}
+	}
 	fclose( fhandle );
-	return( 0 );
+
+	// Write it out
+	memcpy(hdr.magic, CART_WORKLOAD_MAGIC, sizeof(hdr.magic));
+	hdr.op_size = sizeof(CartWorkloadOp);
+	if ( !err && ( ((ohandle = fopen(out, "w")) == NULL) ||
+			(fwrite(&hdr, sizeof(hdr), 1, ohandle) != 1) ||
+			(fwrite(names, CART_WORKLOAD_NAME, hdr.files, ohandle) != hdr.files) ||
+			(fwrite(ops, sizeof(CartWorkloadOp), hdr.ops, ohandle) != hdr.ops) ||
+			(fwrite(payloads, 1, hdr.payload_size, ohandle) != hdr.payload_size) ||
+			(fclose(ohandle) != 0) ) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure writing the compiled workload [%s], error: %s.",
+			out, strerror(errno) );
+		err = 1;
+	}
+	if ( !err ) {
+		logMessage(LOG_OUTPUT_LEVEL, "CART workload [%s] compiled to [%s]: %u operations on %u files, "
+			"%lu payload bytes.", wload, out, hdr.ops, hdr.files, (unsigned long)hdr.payload_size);
+	}
+
+	// Clean up and return
+	free(line);
+	free(fname);
+	free(command);
+	free(ops);
+	free(payloads);
+	return( err ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : validate_files
+// Description  : Validate every file in the table, and its clone if there
+//                is one, on a pool of threads
+//
+// Inputs       : ftable - the table of files
+//                clones - the handles of the clones, NULL if none
+// Outputs      : 0 if all of them validated, -1 if failure
+
+int validate_files(CartSimulationTable *ftable, int16_t *clones) {
+
+	// Local variables
+	CartSimulationCheck checks[2 * CART_SIM_MAX_OPEN_FILES];
+	CartSimulationPool pool;
+	pthread_t threads[CART_SIM_MAX_THREADS];
+	int nthreads = validate_threads, count = 0, failed = 0, i;
+	uint64_t started = now_ns();
+
+	// The files, then the clones under their own backup names
+	for (i=0; i<CART_SIM_MAX_OPEN_FILES; i++) {
+		if (ftable[i].filename != NULL) {
+			checks[count].filename = ftable[i].filename;
+			checks[count].fhandle = ftable[i].fhandle;
+			checks[count].backup = strdup(ftable[i].filename);
+			count++;
+			if (clones != NULL) {
+				checks[count].filename = ftable[i].filename;
+				checks[count].fhandle = clones[i];
+				checks[count].backup = malloc(CART_MAX_PATH_LENGTH);
+				snprintf(checks[count].backup, CART_MAX_PATH_LENGTH, "%s.clone", ftable[i].filename);
+				count++;
+			}
+		}
+	}
+
+	// Run them on the pool, the main thread is one of the workers
+	nthreads = (nthreads > count) ? count : nthreads;
+	pool.checks = checks;
+	pool.count = count;
+	pool.next = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	for (i=1; i<nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, validate_worker, &pool) != 0) {
+			nthreads = i;
+			break;
+		}
+	}
+	validate_worker(&pool);
+	for (i=1; i<nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool.lock);
+
+	// Report the failures
+	for (i=0; i<count; i++) {
+		if (checks[i].result != 0) {
+			if (strcmp(checks[i].filename, checks[i].backup) == 0) {
+				logMessage(LOG_ERROR_LEVEL, "CART Validation failed on file [%s].", checks[i].filename);
+			} else {
+				logMessage(LOG_ERROR_LEVEL, "CART Validation failed on the clone of [%s].", checks[i].filename);
+			}
+			failed = 1;
+		}
+		free(checks[i].backup);
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "CART validation: %d files in %.3f s on %d threads.", count,
+		(now_ns() - started) / 1e9, (nthreads < 1) ? 1 : nthreads);
+	return( failed ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : validate_worker
+// Description  : Validate files until there are none left
+//
+// Inputs       : arg - the pool (see validate_files)
+// Outputs      : NULL
+
+void *validate_worker(void *arg) {
+	CartSimulationPool *pool = arg;
+	CartSimulationCheck *check;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i >= pool->count) {
+			break;
+		}
+		check = &pool->checks[i];
+		check->result = validate_file(check->filename, check->fhandle, check->backup);
+	}
+	return( NULL );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : validate_file
-// Description  : Vadliate a file in the filesystem
+// Description  : Vadliate a file in the filesystem, a chunk at a time
+//                against a mapping of the source, writing each chunk to
+//                the backup as it goes (see backup_mode)
 //
 // Inputs       : fname - the name of the file to validate
 //                mfh - the memory file handle
+//                bkname - the name of the backup, without the .cmm
 // Outputs      : 0 if successful test, -1 if failure
 
-int validate_file(char *fname, int16_t mfh) {
+int validate_file(char *fname, int16_t mfh, char *bkname) {
 
 	// Local variables
-	char filename[256], bkfile[256], *filbuf, *membuf;
+	char filename[256], bkfile[256], *filbuf, *membuf[2], *buf;
+	struct aiocb pending;
 	struct stat stats;
-	int idx, fh;
+	int fh, bk = -1, writing = 0, which = 0, err = 0;
+	int32_t len;
+	off_t pos, idx, bad = -1;
 
-	// First figure out how big the file is, setup buffer
+	// First figure out how big the file is, map it
 	snprintf(filename, 256, "%s/%s", CART_WORKLOAD_DIR, fname);
 	logMessage(LOG_OUTPUT_LEVEL, "Validating [%s] file ....", fname);
 	if ((stat(filename, &stats) != 0) || (stats.st_size == 0)) {
@@ -414,61 +1195,185 @@ int validate_file(char *fname, int16_t mfh) {
 			"unknown source.", filename);
 		return(-1);		
 	}
-	if ( ((filbuf = malloc(stats.st_size)) == NULL) || ((membuf = malloc(stats.st_size)) == NULL) ) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], failed "
-			"buffer allocation.", filename);
-		return(-1);		
-	}
-
-	// Now open the file and read the contents
 	if ((fh=open(filename, O_RDONLY)) == -1) {
 		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], open failed ", filename);
 		return(-1);		
 	}
-	if ((read(fh, filbuf, stats.st_size)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], read failed ", filename);
-		return(-1);
-	}
+	filbuf = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fh, 0);
 	close(fh);
-
-	// Seek to the beginning of the memory file, read the contents
-	if (cart_seek(mfh, 0) == -1) {
-		// Failed, error out
-		logMessage(LOG_ERROR_LEVEL, "Read cart file [%s] see to zero failed.", fname);
+	if (filbuf == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], map failed ", filename);
 		return(-1);
 	}
-	if (cart_read(mfh, membuf, stats.st_size) != stats.st_size) {
-		// Failed, error out
-		logMessage(LOG_ERROR_LEVEL, "Read cart file [%s] of length %d failed.", fname, stats.st_size);
-		return(-1);
+	madvise(filbuf, stats.st_size, MADV_SEQUENTIAL);
+	membuf[0] = malloc(CART_SIM_VALIDATE_CHUNK);
+	membuf[1] = malloc(CART_SIM_VALIDATE_CHUNK);
+
+	// Create the backup of the memory file so people can debug
+	if (backup_mode != CART_BACKUP_NONE) {
+		snprintf(bkfile, 256, "%s/%s.cmm", CART_WORKLOAD_DIR, bkname);
+		if ((bk=open(bkfile, O_RDWR|O_CREAT|O_TRUNC, S_IRWXU)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "Failure creating backup file [%s], open failed (%s) ", 
+				bkfile, strerror(errno));
+			err = 1;
+		}
 	}
 
-	// Now create a backup of the memory file so people can debug
-	snprintf(bkfile, 256, "%s/%s.cmm", CART_WORKLOAD_DIR, fname);
-	if ((fh=open(bkfile, O_RDWR|O_CREAT|O_TRUNC, S_IRWXU)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure creating backup file [%s], open failed (%s) ", 
-			bkfile, strerror(errno));
-		return(-1);		
+	// Stream the memory file, compare each chunk and back it up
+	for (pos=0; !err && (pos<stats.st_size); pos+=len) {
+		buf = membuf[which];
+		len = (stats.st_size - pos > CART_SIM_VALIDATE_CHUNK) ? CART_SIM_VALIDATE_CHUNK : stats.st_size - pos;
+		if (cart_pread(mfh, buf, len, pos) != len) {
+			logMessage(LOG_ERROR_LEVEL, "Read cart file [%s] of length %d at %ld failed.", fname, len, (long)pos);
+			err = 1;
+			break;
+		}
+
+		// Only the first difference matters, find the byte if there is one
+		if ( (bad == -1) && (memcmp(buf, filbuf + pos, len) != 0) ) {
+			for (idx=0; buf[idx] == filbuf[pos + idx]; idx++);
+			bad = pos + idx;
+			logMessage(LOG_ERROR_LEVEL, "Validation of [%s] failed at offset %ld (mem %x/'%c' "
+				"!= fil %x/'%c'", fname, (long)bad, buf[idx], buf[idx], filbuf[bad], filbuf[bad]);
+			if (bk == -1) {
+				break;
+			}
+		}
+
+		// The backup, either now or while the next chunk is read
+		if ( (bk != -1) && (backup_mode == CART_BACKUP_SYNC) && (pwrite(bk, buf, len, pos) != len) ) {
+			logMessage(LOG_ERROR_LEVEL, "Failure writing backup file [%s].", bkfile);
+			err = 1;
+		} else if ( (bk != -1) && (backup_mode == CART_BACKUP_ASYNC) ) {
+			if ( writing && (backup_wait(&pending) != 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Failure writing backup file [%s].", bkfile);
+				writing = 0;
+				err = 1;
+				break;
+			}
+			memset(&pending, 0x0, sizeof(pending));
+			pending.aio_fildes = bk;
+			pending.aio_buf = buf;
+			pending.aio_nbytes = len;
+			pending.aio_offset = pos;
+			if ((writing = (aio_write(&pending) == 0)) == 0) {
+				logMessage(LOG_ERROR_LEVEL, "Failure writing backup file [%s].", bkfile);
+				err = 1;
+			}
+			which ^= 1;
+		}
 	}
-	if ((write(fh, membuf, stats.st_size)) == -1) {
+
+	// Wait for the last of the backup
+	if ( writing && (backup_wait(&pending) != 0) ) {
 		logMessage(LOG_ERROR_LEVEL, "Failure writing backup file [%s].", bkfile);
+		err = 1;
+	}
+	if (bk != -1) {
+		close(bk);
+	}
+
+	// Free the buffers, log success, and return
+	free(membuf[0]);
+	free(membuf[1]);
+	munmap(filbuf, stats.st_size);
+	if (err || (bad != -1)) {
 		return(-1);
 	}
-	close(fh);
+	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : backup_wait
+// Description  : Wait for a background write of a backup chunk
+//
+// Inputs       : cb - the write
+// Outputs      : 0 if all of it was written, -1 if failure
 
+int backup_wait(struct aiocb *cb) {
+	const struct aiocb *waiting[1] = { cb };
 
-	// Now walk the buffers and compare byte for byte
-	for (idx=0; idx<stats.st_size; idx++) {
-		if (membuf[idx] != filbuf[idx]) {
-			logMessage(LOG_ERROR_LEVEL, "Validation of [%s] failed at offset %d (mem %x/'%c' "
-				"!= fil %x/'%c'", fname, idx, membuf[idx], membuf[idx], filbuf[idx], filbuf[idx]);
-			return(-1);
+	while (aio_error(cb) == EINPROGRESS) {
+		aio_suspend(waiting, 1, NULL);
+	}
+	return( (aio_return(cb) == (ssize_t)cb->aio_nbytes) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_layouts
+// Description  : Log how fragmented each file in the simulation is
+//
+// Inputs       : ftable - the simulation file table
+//                when - label for the log lines
+// Outputs      : none
+
+void log_layouts(CartSimulationTable *ftable, const char *when) {
+
+	// Local variables
+	uint32_t extents, carts, total_extents = 0, total_carts = 0;
+	int i;
+
+	for (i=0; i<CART_SIM_MAX_OPEN_FILES; i++) {
+		if ((ftable[i].filename != NULL) && (cart_file_layout(ftable[i].fhandle, &extents, &carts) == 0)) {
+			logMessage(CartSimulatorLLevel, "Layout of [%s] %s: %u extents on %u cartridges",
+				ftable[i].filename, when, extents, carts);
+			total_extents += extents;
+			total_carts += carts;
 		}
 	}
+	logMessage(LOG_OUTPUT_LEVEL, "Layout %s: %u extents, %u file/cartridge pairs", when,
+		total_extents, total_carts);
+}
 
-	// Free the buffers, log success, and return successfully
-	free(filbuf);
-	free(membuf);
-	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
-	return( 0 );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clone_table
+// Description  : Clone every file in the table, then write the start of
+//                each original back over itself so the shared frames are
+//                copied on write
+//
+// Inputs       : ftable - the table of files
+//                clones - receives the handles of the clones
+// Outputs      : 0 if successful, -1 if failure
+
+int clone_table(CartSimulationTable *ftable, int16_t *clones) {
+
+	// Local variables
+	char name[CART_MAX_PATH_LENGTH], buf[CART_FRAME_SIZE + CART_FRAME_SIZE/2];
+	uint64_t before, after;
+	int32_t len;
+	int i;
+
+	// Cloning moves no frames
+	before = cart_bus_ops[CART_OP_RDFRME] + cart_bus_ops[CART_OP_WRFRME];
+	for (i=0; i<CART_SIM_MAX_OPEN_FILES; i++) {
+		if (ftable[i].filename != NULL) {
+			snprintf(name, CART_MAX_PATH_LENGTH, "%s.clone", ftable[i].filename);
+			if ((clones[i] = cart_clone(ftable[i].fhandle, name)) == -1) {
+				logMessage(LOG_ERROR_LEVEL, "CART simulator failed to clone [%s].", ftable[i].filename);
+				return(-1);
+			}
+		}
+	}
+	after = cart_bus_ops[CART_OP_RDFRME] + cart_bus_ops[CART_OP_WRFRME];
+	logMessage(LOG_OUTPUT_LEVEL, "Cloned the files with %lu frame transfers.", (unsigned long)(after - before));
+
+	// Rewrite the start of each original, the clone keeps the old frames
+	for (i=0; i<CART_SIM_MAX_OPEN_FILES; i++) {
+		if (ftable[i].filename != NULL) {
+			if ((cart_seek(ftable[i].fhandle, 0) == -1) ||
+					((len = cart_read(ftable[i].fhandle, buf, sizeof(buf))) == -1) ||
+					(cart_seek(ftable[i].fhandle, 0) == -1) ||
+					(cart_write(ftable[i].fhandle, buf, len) != len)) {
+				logMessage(LOG_ERROR_LEVEL, "CART simulator failed to rewrite [%s].", ftable[i].filename);
+				return(-1);
+			}
+		}
+	}
+
+	// Return successfully
+	return(0);
 }
@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_standin.c
+//  Description    : This is the main program of the stand-in CART server,
+//                   for profiling and benchmarking the client against a
+//                   server whose costs can be set.
+//
+//   Author        : Jason Jincheng Tu
+//   Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Project Includes
+#include <cart_network.h>
+#include <cart_controller.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_STANDIN_ARGUMENTS "hvl:p:t:f:d:b:"
+#define USAGE \
+	"USAGE: cart_standin [-h] [-v] [-l <logfile>] [-p <port>] [-t <uri>] [-f <file>]\n" \
+	"                    [-d <op>=<us>] [-b <ns>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to listen on.\n" \
+	"    -t - transport to listen on: tcp://ip:port, unix:///path or shm://name\n" \
+	"    -f - keep the cartridges in <file> (mapped) instead of memory\n" \
+	"    -d - add <us> microseconds to every <op> request, e.g. -d LDCART=2000,\n" \
+	"         may be repeated (INITMS, BZERO, LDCART, RDFRME, WRFRME, POWOFF)\n" \
+	"    -b - add <ns> nanoseconds per frame byte read or written\n" \
+	"\n"
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_op_delay
+// Description  : take an <op>=<us> delay apart and set it
+//
+// Inputs       : arg - the option argument
+// Outputs      : 0 if successful, -1 if failure
+
+static int set_op_delay(const char *arg) {
+	static const char *names[CART_OP_MAXVAL] = {
+		"INITMS", "BZERO", "LDCART", "RDFRME", "WRFRME", "POWOFF" };
+	const char *eq = strchr(arg, '=');
+	double us;
+	int op;
+
+	if ( (eq == NULL) || (sscanf(eq + 1, "%lf", &us) != 1) || (us < 0) ) {
+		return( -1 );
+	}
+	for (op = 0; op < CART_OP_MAXVAL; op++) {
+		if ( (strlen(names[op]) == (size_t)(eq - arg)) && (strncmp(arg, names[op], eq - arg) == 0) ) {
+			cart_server_op_ns[op] = (uint64_t)(us * 1000);
+			return( 0 );
+		}
+	}
+	return( -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the stand-in CART server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_STANDIN_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &cart_server_port) != 1 ) {
+				fprintf( stderr, "Bad port number [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 't': // Set the transport
+			cart_server_uri = strdup(optarg);
+			break;
+
+		case 'f': // Backing file
+			cart_server_backing = strdup(optarg);
+			break;
+
+		case 'd': // Delay of an opcode
+			if ( set_op_delay(optarg) == -1 ) {
+				fprintf( stderr, "Bad delay [%s], expected <op>=<us>\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'b': // Delay per byte
+			if ( sscanf(optarg, "%lu", &cart_server_byte_ns) != 1 ) {
+				fprintf( stderr, "Bad per byte delay [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+
+	// Run the server
+	if ( cart_server() == -1 ) {
+		return( -1 );
+	}
+	return( 0 );
+}
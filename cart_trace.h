@@ -0,0 +1,65 @@
+#ifndef CART_TRACE_INCLUDED
+#define CART_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_trace.h
+//  Description    : This is the header file for the traces the client
+//                   records: bus traces (cart_sim -R) that cart_replay plays
+//                   back, and frame cache access traces (cart_sim -A) that
+//                   cart_cachesim runs cache configurations against.  A
+//                   trace is a header followed by fixed-size records, in
+//                   host byte order.
+//
+//  Author         : Jason Jincheng Tu
+//  Last Modified  : 10/18/2026
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CART_TRACE_MAGIC "CARTTRC1" // First bytes of a bus trace file
+#define CART_ACCESS_MAGIC "CARTACC1" // First bytes of a cache access trace file
+#define CART_TRACE_BUFFER (1 << 20) // Bytes buffered before a trace write
+
+// The start of a trace
+typedef struct {
+	char magic[8];         // CART_TRACE_MAGIC or CART_ACCESS_MAGIC
+	uint32_t servers;      // servers the traffic went to
+	uint32_t record_size;  // sizeof(CartTraceRecord) or sizeof(CartAccessRecord)
+} CartTraceHeader;
+
+// A request and its answer
+typedef struct {
+	uint64_t reg;          // the request as its server saw it (its cartridge number)
+	uint64_t sent;         // ns from the start of the trace to the request going out
+	uint32_t took;         // ns until it was answered, saturated
+	uint32_t digest;       // FNV-1a of the frame bytes written or read, 0 if none
+	uint32_t bytes;        // frame bytes written or read
+	uint16_t offset;       // where the bytes of a partial write go
+	uint8_t server;        // which server it went to
+	uint8_t failed;        // RT1 of the answer
+} CartTraceRecord;
+
+// The frame cache calls an access trace records
+typedef enum {
+	CART_ACCESS_GET      = 0,  // get_cart_cache / read_cart_cache, read on a miss
+	CART_ACCESS_PUT      = 1,  // put_cart_cache, the frame was written through
+	CART_ACCESS_DIRTY    = 2,  // dirty_cart_cache, written back later
+	CART_ACCESS_PATCH    = 3,  // patch_cart_cache, part of the frame was written through
+	CART_ACCESS_DROP     = 4,  // drop_cart_cache
+	CART_ACCESS_FLUSH    = 5,  // flush_cart_cache / flush_list_cart_cache, one per frame
+	CART_ACCESS_PREFETCH = 6,  // prefetch_cart_cache, one per frame
+	CART_ACCESS_MAXVAL   = 7,
+} CartAccessOp;
+
+// A frame the cache was asked about
+typedef struct {
+	uint16_t cart;         // the cartridge, over all servers
+	uint16_t frm;
+	uint8_t op;            // CartAccessOp
+	uint8_t pad[3];
+} CartAccessRecord;
+
+#endif
@@ -0,0 +1,341 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_transport.c
+//  Description    : This is the implementation of the pieces of the CART
+//                   transports shared by the client and the server: URI
+//                   parsing and the shared-memory rings.
+//
+//  Author         : Jason Jincheng Tu
+//  Last Modified  : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Project Include Files
+#include <cart_transport.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_SHM_SPINS 128 // Polls of a ring before going to sleep
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_transport_parse
+// Description  : Take a transport URI apart, a missing host, port, path or
+//                name gets the default
+//
+// Inputs       : uri - tcp://host:port, unix:///path or shm://name
+//                t - receives the transport
+// Outputs      : 0 if successful, -1 if the URI is not understood
+
+int cart_transport_parse(const char *uri, CartTransport *t) {
+	const char *rest;
+
+	memset(t, 0, sizeof(CartTransport));
+
+	if (strncmp(uri, "tcp://", 6) == 0) {
+		rest = uri + 6;
+		t->type = CART_TRANSPORT_TCP;
+		const char *colon = strrchr(rest, ':');
+		size_t len = (colon != NULL) ? (size_t)(colon - rest) : strlen(rest);
+		if (len >= CART_TRANSPORT_MAX_URI) {
+			return (-1);
+		}
+		memcpy(t->host, rest, len);
+		t->host[len] = '\0';
+		if ((colon != NULL) && (sscanf(colon + 1, "%hu", &t->port) != 1)) {
+			return (-1);
+		}
+	} else if (strncmp(uri, "unix://", 7) == 0) {
+		rest = uri + 7;
+		t->type = CART_TRANSPORT_UNIX;
+		strncpy(t->path, (*rest != '\0') ? rest : CART_DEFAULT_UNIX_PATH, CART_TRANSPORT_MAX_URI - 1);
+	} else if (strncmp(uri, "shm://", 6) == 0) {
+		rest = uri + 6;
+		t->type = CART_TRANSPORT_SHM;
+		//shm_open wants a single leading slash
+		if (*rest == '\0') {
+			strncpy(t->path, CART_DEFAULT_SHM_NAME, CART_TRANSPORT_MAX_URI - 1);
+		} else {
+			snprintf(t->path, CART_TRANSPORT_MAX_URI, "/%s", (*rest == '/') ? rest + 1 : rest);
+		}
+	} else {
+		return (-1);
+	}
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_map
+// Description  : Map the shared region of a server.  The server creates it
+//                fresh, a client attaches to a region that is ready and
+//                not in use by another live client.
+//
+// Inputs       : name - the shared memory name
+//                create - 1 for the server, 0 for a client
+// Outputs      : the region, NULL if failure
+
+CartShmRegion *cart_shm_map(const char *name, int create) {
+	CartShmRegion *r;
+	uint32_t expected = 0;
+	int fd;
+
+	if (create) {
+		shm_unlink(name);
+		fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	} else {
+		fd = shm_open(name, O_RDWR, 0);
+	}
+	if (fd == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART shm: cannot open [%s] (%s)", name, strerror(errno));
+		return (NULL);
+	}
+	if (create && (ftruncate(fd, sizeof(CartShmRegion)) == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "CART shm: cannot size [%s] (%s)", name, strerror(errno));
+		close(fd);
+		return (NULL);
+	}
+
+	r = mmap(NULL, sizeof(CartShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "CART shm: cannot map [%s] (%s)", name, strerror(errno));
+		return (NULL);
+	}
+
+	if (create) {
+		cart_shm_reset(r);
+		r->server_pid = getpid();
+		atomic_store(&r->magic, CART_SHM_MAGIC);
+		return (r);
+	}
+
+	//a client left behind by a dead process does not keep us out
+	if (atomic_load(&r->magic) != CART_SHM_MAGIC) {
+		logMessage(LOG_ERROR_LEVEL, "CART shm: [%s] is not ready", name);
+		munmap(r, sizeof(CartShmRegion));
+		return (NULL);
+	}
+	if (!atomic_compare_exchange_strong(&r->attached, &expected, 1)) {
+		if ((r->client_pid == 0) || (kill(r->client_pid, 0) == 0) || (errno != ESRCH)) {
+			logMessage(LOG_ERROR_LEVEL, "CART shm: [%s] is in use", name);
+			munmap(r, sizeof(CartShmRegion));
+			return (NULL);
+		}
+	}
+	r->client_pid = getpid();
+
+	return (r);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_unmap
+// Description  : Let go of a shared region
+//
+// Inputs       : r - the region, name - its name
+//                destroy - 1 (server) to remove it, 0 (client) to detach
+// Outputs      : none
+
+void cart_shm_unmap(CartShmRegion *r, const char *name, int destroy) {
+
+	if (destroy) {
+		atomic_store(&r->magic, 0);
+		shm_unlink(name);
+	} else {
+		r->client_pid = 0;
+		atomic_store(&r->attached, 0);
+	}
+	munmap(r, sizeof(CartShmRegion));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_reset
+// Description  : Empty both rings, for the server between clients
+//
+// Inputs       : r - the region
+// Outputs      : none
+
+void cart_shm_reset(CartShmRegion *r) {
+	atomic_store(&r->requests.head, 0);
+	atomic_store(&r->requests.tail, 0);
+	atomic_store(&r->answers.head, 0);
+	atomic_store(&r->answers.tail, 0);
+	atomic_store(&r->closing, 0);
+	r->client_pid = 0;
+	atomic_store(&r->attached, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_wait
+// Description  : wait for a ring word to move away from a value, spinning
+//                briefly before sleeping on the futex.  Gives up if the
+//                process at the other end has gone.
+//
+// Inputs       : r - the region
+//                word - the head or tail being waited on
+//                waiters - the sleeper count the other end checks
+//                seen - the value the word had
+//                peer - pointer to the pid of the other end
+// Outputs      : 0 once the word moved, -1 if the peer is gone or the
+//                server is closing
+
+static int ring_wait(CartShmRegion *r, _Atomic uint32_t *word, _Atomic uint32_t *waiters,
+		uint32_t seen, int32_t *peer) {
+	struct timespec wait = { 0, CART_SHM_WAIT_MS * 1000000L };
+
+	for (int i = 0; i < CART_SHM_SPINS; i++) {
+		if (atomic_load_explicit(word, memory_order_acquire) != seen) {
+			return (0);
+		}
+		sched_yield();
+	}
+
+	while (atomic_load_explicit(word, memory_order_acquire) == seen) {
+		//announce the sleep, the futex rechecks the word so no wake is lost
+		atomic_fetch_add(waiters, 1);
+		syscall(SYS_futex, word, FUTEX_WAIT, seen, &wait, NULL, 0);
+		atomic_fetch_sub(waiters, 1);
+
+		if (atomic_load(&r->closing) ||
+				((*peer != 0) && (kill(*peer, 0) == -1) && (errno == ESRCH))) {
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ring_wake
+// Description  : wake the other end if it is asleep on a ring word
+//
+// Inputs       : word - the head or tail that moved
+//                waiters - the sleepers on it
+// Outputs      : none
+
+static void ring_wake(_Atomic uint32_t *word, _Atomic uint32_t *waiters) {
+	if (atomic_load(waiters) > 0) {
+		syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_put
+// Description  : Put a request or answer on a ring, the frame is copied
+//                straight into the slot
+//
+// Inputs       : r - the region, ring - the ring to add to
+//                reg - the register, frame - the frame or NULL
+// Outputs      : 0 if successful, -1 if the other end is gone
+
+int cart_shm_put(CartShmRegion *r, CartShmRing *ring, CartXferRegister reg, void *frame) {
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	int32_t *peer = (ring == &r->requests) ? &r->server_pid : &r->client_pid;
+	uint32_t tail;
+
+	//full, wait for the consumer to take one
+	while (head - (tail = atomic_load_explicit(&ring->tail, memory_order_acquire)) == CART_SHM_SLOTS) {
+		if (ring_wait(r, &ring->tail, &ring->tail_waiters, tail, peer) == -1) {
+			return (-1);
+		}
+	}
+
+	CartShmSlot *slot = &ring->slots[head & (CART_SHM_SLOTS - 1)];
+	slot->reg = reg;
+	if (frame != NULL) {
+		memcpy(slot->frame, frame, CART_FRAME_SIZE);
+	}
+	atomic_store_explicit(&ring->head, head + 1, memory_order_seq_cst);
+	ring_wake(&ring->head, &ring->head_waiters);
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_peek
+// Description  : Wait for the next request or answer on a ring and return
+//                its slot, which stays valid until cart_shm_release
+//
+// Inputs       : r - the region, ring - the ring to take from
+// Outputs      : the slot, NULL if the other end is gone
+
+CartShmSlot *cart_shm_peek(CartShmRegion *r, CartShmRing *ring) {
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	int32_t *peer = (ring == &r->requests) ? &r->client_pid : &r->server_pid;
+
+	//empty, wait for the producer
+	while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+		if (ring_wait(r, &ring->head, &ring->head_waiters, tail, peer) == -1) {
+			return (NULL);
+		}
+	}
+	return (&ring->slots[tail & (CART_SHM_SLOTS - 1)]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_release
+// Description  : Give the slot returned by cart_shm_peek back to the
+//                producer
+//
+// Inputs       : ring - the ring the slot came from
+// Outputs      : none
+
+void cart_shm_release(CartShmRing *ring) {
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_seq_cst);
+	ring_wake(&ring->tail, &ring->tail_waiters);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_get
+// Description  : Take the next request or answer off a ring, the frame is
+//                copied straight out of the slot
+//
+// Inputs       : r - the region, ring - the ring to take from
+//                reg - receives the register, frame - receives the frame
+//                      (NULL when there is none)
+// Outputs      : 0 if successful, -1 if the other end is gone
+
+int cart_shm_get(CartShmRegion *r, CartShmRing *ring, CartXferRegister *reg, void *frame) {
+	CartShmSlot *slot = cart_shm_peek(r, ring);
+
+	if (slot == NULL) {
+		return (-1);
+	}
+	*reg = slot->reg;
+	if (frame != NULL) {
+		memcpy(frame, slot->frame, CART_FRAME_SIZE);
+	}
+	cart_shm_release(ring);
+
+	// Return successfully
+	return (0);
+}
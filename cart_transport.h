@@ -0,0 +1,104 @@
+#ifndef CART_TRANSPORT_INCLUDED
+#define CART_TRANSPORT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_transport.h
+//  Description    : This is the header file for the transports that carry
+//                   CART requests between the client and a server: TCP,
+//                   Unix-domain sockets and a shared-memory ring for a
+//                   server on the same host.
+//
+//  Author         : Jason Jincheng Tu
+//  Last Modified  : 10/18/2026
+//
+
+// Include files
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Project include files
+#include <cart_controller.h>
+
+// Defines
+#define CART_TRANSPORT_MAX_URI 256
+#define CART_DEFAULT_UNIX_PATH "/tmp/cart_server.sock"
+#define CART_DEFAULT_SHM_NAME "/cart_server"
+#define CART_SHM_MAGIC 0x43415254	// "CART"
+#define CART_SHM_SLOTS 64			// slots in each ring, a power of two
+#define CART_SHM_WAIT_MS 100		// sleep this long before checking the peer
+
+// The kinds of transport
+typedef enum {
+	CART_TRANSPORT_TCP  = 0,  // tcp://host:port
+	CART_TRANSPORT_UNIX = 1,  // unix:///path/to/socket
+	CART_TRANSPORT_SHM  = 2,  // shm://name
+} CartTransportType;
+
+// Where a server is, as taken apart from a URI
+typedef struct {
+	CartTransportType type;
+	char host[CART_TRANSPORT_MAX_URI];   // TCP only
+	unsigned short port;                 // TCP only, 0 for the default
+	char path[CART_TRANSPORT_MAX_URI];   // socket path or shared memory name
+} CartTransport;
+
+// One request or answer on a shared-memory ring, the register is in host
+// order and the frame is only used by writes (requests) and reads (answers)
+typedef struct {
+	CartXferRegister reg;
+	char frame[CART_FRAME_SIZE];
+} CartShmSlot;
+
+// A single-producer single-consumer ring, head and tail double as the
+// futex words the consumer and the producer sleep on
+typedef struct {
+	_Atomic uint32_t head;          // next slot the producer fills
+	_Atomic uint32_t head_waiters;  // consumers asleep on head
+	char pad1[56];
+	_Atomic uint32_t tail;          // next slot the consumer takes
+	_Atomic uint32_t tail_waiters;  // producers asleep on tail
+	char pad2[56];
+	CartShmSlot slots[CART_SHM_SLOTS];
+} CartShmRing;
+
+// The shared region a server creates for its client
+typedef struct {
+	_Atomic uint32_t magic;     // CART_SHM_MAGIC once the region is ready
+	_Atomic uint32_t attached;  // a client is using the region
+	int32_t server_pid;         // to notice a server that went away
+	int32_t client_pid;         // to notice a client that went away
+	_Atomic uint32_t closing;   // the server is shutting down
+	char pad[44];
+	CartShmRing requests;       // client to server
+	CartShmRing answers;        // server to client
+} CartShmRegion;
+
+//
+// Functional Prototypes
+
+int cart_transport_parse(const char *uri, CartTransport *t);
+	// Take a transport URI apart (tcp://, unix://, shm://)
+
+CartShmRegion *cart_shm_map(const char *name, int create);
+	// Map a shared-memory region, creating it (server) or attaching (client)
+
+void cart_shm_unmap(CartShmRegion *r, const char *name, int destroy);
+	// Unmap a region, the server also removes it
+
+void cart_shm_reset(CartShmRegion *r);
+	// Empty both rings for the next client
+
+int cart_shm_put(CartShmRegion *r, CartShmRing *ring, CartXferRegister reg, void *frame);
+	// Add a request or answer to a ring, waiting while it is full
+
+int cart_shm_get(CartShmRegion *r, CartShmRing *ring, CartXferRegister *reg, void *frame);
+	// Take the next request or answer off a ring, waiting while it is empty
+
+CartShmSlot *cart_shm_peek(CartShmRegion *r, CartShmRing *ring);
+	// Wait for the next slot of a ring and look at it in place
+
+void cart_shm_release(CartShmRing *ring);
+	// Hand the slot returned by cart_shm_peek back to the producer
+
+#endif
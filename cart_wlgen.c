@@ -0,0 +1,492 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_wlgen.c
+//  Description    : This is the main program of the CART workload generator.
+//                   It writes a workload in the cart_sim format (WRITE,
+//                   WRITEAT, READ and SEEK lines) and, for every file the
+//                   workload touches, the source file cart_sim validates
+//                   the result against.
+//
+//                   Files are picked with a Zipf skew, file and operation
+//                   sizes come from a distribution each, and the mix is
+//                   set by the read ratio, the share of writes appended to
+//                   files still short of their size, and the share of
+//                   operations that carry on from the file position rather
+//                   than go to a random offset.  The files are kept in
+//                   memory as they would be after each operation, so the
+//                   reads stay inside the files and the sources match.
+//
+//   Author        : Jason Jincheng Tu
+//   Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_WLGEN_ARGUMENTS "hvl:f:n:s:b:z:r:a:q:p:o:x:"
+#define CART_WLGEN_MAX_FILES 128    // as many as cart_sim keeps open
+#define CART_WLGEN_MAX_NAME 64
+#define CART_WLGEN_LINE 1024        // cart_sim reads lines of up to this
+#define USAGE \
+	"USAGE: cart_wlgen [-h] [-v] [-l <logfile>] [-f <files>] [-n <ops>] [-s <dist>] [-b <dist>] [-z <skew>]\n" \
+	"                  [-r <ratio>] [-a <ratio>] [-q <ratio>] [-p <prefix>] [-o <dir>] [-x <seed>]\n" \
+	"                  <workload-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -f - number of files, default 16\n" \
+	"    -n - number of operations, default 10000\n" \
+	"    -s - file sizes in bytes, default exp:65536\n" \
+	"    -b - operation sizes in bytes, default uniform:1:900 (cut to fit a line)\n" \
+	"    -z - Zipf skew of the file picked, 0 for uniform, default 0.8\n" \
+	"    -r - share of the operations that are reads, default 0.3\n" \
+	"    -a - share of the writes appended while a file is short of its size,\n" \
+	"         default 0.7, the others overwrite\n" \
+	"    -q - share of the operations at the file position (sequential),\n" \
+	"         default 0.5, the others seek to a random offset\n" \
+	"    -p - file name prefix, default gen\n" \
+	"    -o - directory the source files are written to, default workload\n" \
+	"    -x - random seed, default 1\n" \
+	"\n" \
+	"    <dist> - fixed:<n>, uniform:<min>:<max> or exp:<mean>[:<max>]\n" \
+	"    <workload-file> - the workload to write, for cart_sim\n" \
+	"\n"
+
+// The size distributions
+typedef enum {
+	WLGEN_FIXED   = 0,  // always a
+	WLGEN_UNIFORM = 1,  // a to b
+	WLGEN_EXP     = 2,  // mean a, at most b
+} WlgenDistKind;
+
+typedef struct {
+	WlgenDistKind kind;
+	uint32_t a, b;
+} WlgenDist;
+
+// A file of the workload as it is after the operations so far
+typedef struct {
+	char      name[CART_WLGEN_MAX_NAME];
+	char     *data;
+	uint32_t  length;    // bytes in the file
+	uint32_t  capacity;  // bytes allocated
+	uint32_t  target;    // size it grows to by appends
+	uint32_t  pos;       // the file position
+} WlgenFile;
+
+// What the workload does
+typedef struct {
+	uint64_t reads, writes, writeats, appends, seeks;
+	uint64_t read_bytes, write_bytes;
+} WlgenStats;
+
+//
+// Global data
+uint64_t rand_state = 1;  // xorshift64*
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : next_random / uniform
+// Description  : the generator's own random numbers, so a seed gives the
+//                same workload everywhere
+//
+// Inputs       : none
+// Outputs      : 64 random bits / a double in [0, 1)
+
+static uint64_t next_random(void) {
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return( rand_state * 2685821657736338717ULL );
+}
+
+static double uniform(void) {
+	return( (next_random() >> 11) * (1.0 / 9007199254740992.0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parse_dist
+// Description  : read a size distribution from the command line
+//
+// Inputs       : spec - fixed:<n>, uniform:<min>:<max> or exp:<mean>[:<max>]
+//                dist - filled in
+// Outputs      : 0 if successful, -1 if failure
+
+static int parse_dist(const char *spec, WlgenDist *dist) {
+	if (sscanf(spec, "fixed:%u", &dist->a) == 1) {
+		dist->kind = WLGEN_FIXED;
+		dist->b = dist->a;
+	} else if (sscanf(spec, "uniform:%u:%u", &dist->a, &dist->b) == 2) {
+		dist->kind = WLGEN_UNIFORM;
+	} else if (sscanf(spec, "exp:%u", &dist->a) == 1) {
+		dist->kind = WLGEN_EXP;
+		if (sscanf(spec, "exp:%*u:%u", &dist->b) != 1) {
+			dist->b = UINT32_MAX;
+		}
+	} else {
+		return( -1 );
+	}
+	return( ((dist->a == 0) || (dist->b < dist->a)) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sample
+// Description  : draw a size
+//
+// Inputs       : dist - the distribution
+// Outputs      : the size, at least 1
+
+static uint32_t sample(WlgenDist *dist) {
+	double x;
+
+	switch (dist->kind) {
+	case WLGEN_UNIFORM:
+		return( dist->a + next_random() % ((uint64_t)dist->b - dist->a + 1) );
+	case WLGEN_EXP:
+		x = ceil(-log(1.0 - uniform()) * dist->a);
+		return( (x < 1) ? 1 : (x > dist->b) ? dist->b : (uint32_t)x );
+	default:
+		return( dist->a );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : zipf_table / zipf_pick
+// Description  : the cumulative Zipf weights of the files, file i has
+//                weight 1/(i+1)^skew, and a draw from them
+//
+// Inputs       : cdf - the table, files - how many, skew - the exponent
+// Outputs      : none / the file
+
+static void zipf_table(double *cdf, int files, double skew) {
+	double sum = 0;
+
+	for (int i = 0; i < files; i++) {
+		sum += 1.0 / pow(i + 1, skew);
+		cdf[i] = sum;
+	}
+	for (int i = 0; i < files; i++) {
+		cdf[i] /= sum;
+	}
+}
+
+static int zipf_pick(double *cdf, int files) {
+	double u = uniform();
+	int lo = 0, hi = files - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cdf[mid] > u) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return( lo );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : emit_write
+// Description  : write a WRITE (at the position) or WRITEAT line with a
+//                random payload and apply it to the file
+//
+// Inputs       : out - the workload, f - the file, off - where, len - bytes
+//                at - 1 for WRITEAT, 0 for WRITE
+// Outputs      : 0 if successful, -1 if failure
+
+static int emit_write(FILE *out, WlgenFile *f, uint32_t off, uint32_t len, int at) {
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789      ";
+	char payload[CART_WLGEN_LINE];
+	char *data;
+
+	if (off + len > f->capacity) {
+		uint32_t cap = f->capacity ? f->capacity : 4096;
+		while (cap < off + len) {
+			cap *= 2;
+		}
+		if ((data = realloc(f->data, cap)) == NULL) {
+			return( -1 );
+		}
+		f->data = data;
+		f->capacity = cap;
+	}
+
+	//'^' stands for a newline in the workload
+	for (uint32_t i = 0; i < len; i++) {
+		uint64_t r = next_random();
+		payload[i] = ((r & 63) == 0) ? '^' : alphabet[(r >> 8) % (sizeof(alphabet) - 1)];
+		f->data[off + i] = (payload[i] == '^') ? '\n' : payload[i];
+	}
+	payload[len] = '\0';
+	fprintf(out, "%s %s %u %u:%s\n", f->name, at ? "WRITEAT" : "WRITE", len, at ? off : 0, payload);
+
+	f->pos = off + len;
+	if (f->pos > f->length) {
+		f->length = f->pos;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : generate
+// Description  : write the workload and keep the files up to date
+//
+// Inputs       : out - the workload, files/nfiles - the files
+//                ops - operations, sizes/opsizes - the size distributions
+//                skew, read_ratio, append_ratio, seq_ratio - the mix
+//                stats - filled in
+// Outputs      : 0 if successful, -1 if failure
+
+static int generate(FILE *out, WlgenFile *files, int nfiles, uint64_t ops, WlgenDist *sizes,
+		WlgenDist *opsizes, double skew, double read_ratio, double append_ratio, double seq_ratio,
+		WlgenStats *stats) {
+	double *cdf = malloc(nfiles * sizeof(double));
+	uint32_t len, off, maxlen;
+	int sequential;
+	WlgenFile *f;
+
+	if (cdf == NULL) {
+		return( -1 );
+	}
+	zipf_table(cdf, nfiles, skew);
+	for (int i = 0; i < nfiles; i++) {
+		files[i].target = sample(sizes);
+	}
+
+	for (uint64_t i = 0; i < ops; i++) {
+		f = &files[zipf_pick(cdf, nfiles)];
+
+		//the payload and the line header have to fit a line
+		maxlen = CART_WLGEN_LINE - 2 - (strlen(f->name) + 26);
+		len = sample(opsizes);
+		len = (len > maxlen) ? maxlen : len;
+
+		if ( (f->length > 0) && (uniform() < read_ratio) ) {
+
+			// Read, on from the position (back from the start at the end)
+			// or from a random offset
+			len = (len > f->length) ? f->length : len;
+			sequential = (uniform() < seq_ratio);
+			if ( sequential && (f->pos < f->length) ) {
+				len = (f->pos + len > f->length) ? f->length - f->pos : len;
+			} else {
+				off = sequential ? 0 : next_random() % (f->length - len + 1);
+				fprintf(out, "%s SEEK 0 %u:\n", f->name, off);
+				f->pos = off;
+				stats->seeks++;
+			}
+			fprintf(out, "%s READ %u 0:\n", f->name, len);
+			f->pos += len;
+			stats->reads++;
+			stats->read_bytes += len;
+
+		} else if ( (f->length < f->target) && ((f->length == 0) || (uniform() < append_ratio)) ) {
+
+			// Append, a plain write if the position is at the end already
+			if (emit_write(out, f, f->length, len, f->pos != f->length) == -1) {
+				return( -1 );
+			}
+			stats->appends++;
+			stats->write_bytes += len;
+
+		} else {
+
+			// Overwrite, on from the position or at a random offset
+			if (uniform() < seq_ratio) {
+				if (emit_write(out, f, f->pos, len, 0) == -1) {
+					return( -1 );
+				}
+				stats->writes++;
+			} else {
+				if (emit_write(out, f, next_random() % f->length, len, 1) == -1) {
+					return( -1 );
+				}
+				stats->writeats++;
+			}
+			stats->write_bytes += len;
+
+		}
+	}
+
+	free(cdf);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART workload generator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, nfiles = 16, written = 0;
+	uint64_t ops = 10000, total = 0;
+	double skew = 0.8, read_ratio = 0.3, append_ratio = 0.7, seq_ratio = 0.5;
+	WlgenDist sizes = { WLGEN_EXP, 65536, UINT32_MAX }, opsizes = { WLGEN_UNIFORM, 1, 900 };
+	char *prefix = "gen", *dir = "workload", path[PATH_MAX];
+	WlgenFile *files;
+	WlgenStats stats;
+	FILE *out;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_WLGEN_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'f': // Files
+			if ( (sscanf(optarg, "%d", &nfiles) != 1) || (nfiles < 1) || (nfiles > CART_WLGEN_MAX_FILES) ) {
+				fprintf( stderr, "Bad file count [%s], 1 to %d\n", optarg, CART_WLGEN_MAX_FILES );
+				return( -1 );
+			}
+			break;
+
+		case 'n': // Operations
+			if (sscanf(optarg, "%lu", (unsigned long *)&ops) != 1) {
+				fprintf( stderr, "Bad operation count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 's': // File sizes
+		case 'b': // Operation sizes
+			if (parse_dist(optarg, (ch == 's') ? &sizes : &opsizes) == -1) {
+				fprintf( stderr, "Bad size distribution [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'z': // The mix
+		case 'r':
+		case 'a':
+		case 'q': {
+			double x;
+			if ( (sscanf(optarg, "%lf", &x) != 1) || (x < 0) || ((ch != 'z') && (x > 1)) ) {
+				fprintf( stderr, "Bad value [%s] for -%c\n", optarg, ch );
+				return( -1 );
+			}
+			*((ch == 'z') ? &skew : (ch == 'r') ? &read_ratio : (ch == 'a') ? &append_ratio : &seq_ratio) = x;
+			break;
+		}
+
+		case 'p': // File name prefix
+			if (strlen(optarg) > CART_WLGEN_MAX_NAME - 16) {
+				fprintf( stderr, "File name prefix [%s] too long\n", optarg );
+				return( -1 );
+			}
+			prefix = optarg;
+			break;
+
+		case 'o': // Source directory
+			dir = optarg;
+			break;
+
+		case 'x': // Seed
+			if ( (sscanf(optarg, "%lu", (unsigned long *)&rand_state) != 1) || (rand_state == 0) ) {
+				fprintf( stderr, "Bad seed [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+	if (optind != argc - 1) {
+		fprintf( stderr, USAGE );
+		return( -1 );
+	}
+
+	// Generate the workload
+	if ((out = fopen(argv[optind], "w")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CART wlgen: cannot create [%s] : [%s]", argv[optind], strerror(errno));
+		return( -1 );
+	}
+	files = calloc(nfiles, sizeof(WlgenFile));
+	memset(&stats, 0, sizeof(stats));
+	for (int i = 0; i < nfiles; i++) {
+		snprintf(files[i].name, CART_WLGEN_MAX_NAME, "%s%03d.txt", prefix, i);
+	}
+	if (generate(out, files, nfiles, ops, &sizes, &opsizes, skew, read_ratio, append_ratio, seq_ratio,
+			&stats) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART wlgen: out of memory.");
+		return( -1 );
+	}
+	if (fclose(out) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "CART wlgen: cannot write [%s] : [%s]", argv[optind], strerror(errno));
+		return( -1 );
+	}
+
+	// The source files, what cart_sim validates against
+	for (int i = 0; i < nfiles; i++) {
+		if (files[i].length == 0) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+		if ( ((out = fopen(path, "w")) == NULL) || (fwrite(files[i].data, files[i].length, 1, out) != 1) ||
+				(fclose(out) != 0) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART wlgen: cannot write [%s] : [%s]", path, strerror(errno));
+			return( -1 );
+		}
+		logMessage(LOG_INFO_LEVEL, "CART wlgen: [%s] %u bytes (size drawn %u)", path, files[i].length,
+			files[i].target);
+		total += files[i].length;
+		written++;
+		free(files[i].data);
+	}
+
+	logMessage(LOG_OUTPUT_LEVEL, "CART wlgen: %lu operations on %d files (%lu bytes) to [%s]", (unsigned long)ops,
+		written, (unsigned long)total, argv[optind]);
+	logMessage(LOG_OUTPUT_LEVEL, "CART wlgen: %lu reads (%lu bytes), %lu appends, %lu writes, %lu writeats "
+		"(%lu bytes), %lu seeks", (unsigned long)stats.reads, (unsigned long)stats.read_bytes,
+		(unsigned long)stats.appends, (unsigned long)stats.writes, (unsigned long)stats.writeats,
+		(unsigned long)stats.write_bytes, (unsigned long)stats.seeks);
+	free(files);
+	return( 0 );
+}
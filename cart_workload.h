@@ -0,0 +1,54 @@
+#ifndef CART_WORKLOAD_INCLUDED
+#define CART_WORKLOAD_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_workload.h
+//  Description    : This is the header file for compiled workloads (cart_sim
+//                   -C), the text workload turned into a stream of fixed-size
+//                   operations that cart_sim maps and replays without any
+//                   parsing.  A compiled workload is a header, the names of
+//                   its files, the operations and the payloads of the
+//                   writes ('^' already turned into newlines), in host byte
+//                   order.
+//
+//  Author         : Jason Jincheng Tu
+//  Last Modified  : 10/18/2026
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CART_WORKLOAD_MAGIC "CARTWLB1" // First bytes of a compiled workload
+#define CART_WORKLOAD_NAME 128         // Bytes of each file name, NUL padded
+
+// The commands of a workload
+typedef enum {
+	CART_WORKLOAD_WRITE   = 0,  // write len bytes at the position
+	CART_WORKLOAD_WRITEAT = 1,  // seek to off, then write len bytes
+	CART_WORKLOAD_SEEK    = 2,  // seek to off (the driver has to return len)
+	CART_WORKLOAD_READ    = 3,  // read len bytes at the position
+} CartWorkloadCommand;
+
+// The start of a compiled workload
+typedef struct {
+	char magic[8];         // CART_WORKLOAD_MAGIC
+	uint32_t files;        // names after the header
+	uint32_t ops;          // operations after the names
+	uint64_t payload_size; // payload bytes after the operations
+	uint32_t max_read;     // longest READ, for sizing one read buffer
+	uint32_t op_size;      // sizeof(CartWorkloadOp)
+} CartWorkloadHeader;
+
+// An operation
+typedef struct {
+	uint8_t command;       // CartWorkloadCommand
+	uint8_t pad;
+	uint16_t file;         // index of the file name
+	uint32_t len;
+	uint32_t off;
+	uint32_t data;         // where the payload of a write starts in the payloads
+} CartWorkloadOp;
+
+#endif